@@ -30,6 +30,8 @@ World.reset()
 -- creating terrain
 terrain = GridTerrain(origin, xstep, ystep, width, depth)
 terrain:setTexture("LlanoTex2.jpg")
+-- the generated terrain is read back when the script runs again
+terrain:setCacheResults(true)
 terrain:faultLineGeneration(200)
 terrain:smooth(0.7)
 
@@ -38,21 +40,15 @@ patch:addPoints(Point(-10, -10), Point(10, -10), Point(15, 0), Point(10, 10), Po
 patch:setAttribute("texture", "dirt.jpg")
 terrain:addPatch(patch)
 
--- now I'm gonna sweep a 2d paraboloid along the channel axis
-for j = 0, depth - 1 do
-	for i = 0, width - 1 do
-		local p = terrain:point(i, j)
-		local h = ((p:x()) ^ 2.0) / 10.0 - 10.0
-		if h < p:z() then
-			terrain:setPoint(i, j, h)
-			if j == 64 then
-				local loc = terrain:point(i, j)
-				loc = Point(loc:x(), loc:y(), loc:z() + 1.0)
-				cam:setLocation(loc)
-			end
-		end
-	end
-end
+-- now I'm gonna sweep a 2d paraboloid along the channel axis, it is
+-- x^2/10 - 10 across the channel, up to r away from its axis
+local r = 32
+local axis = { Point(0, -64, r*r/10 - 10), Point(0, 64, r*r/10 - 10) }
+terrain:sweep(axis, r, -r*r/10, "paraboloid", "lower")
+
+-- the camera sits on the channel bed
+local loc = terrain:point(width/2, 64)
+cam:setLocation(Point(loc:x(), loc:y(), loc:z() + 1.0))
 
 terrain:addToWorld()
 
@@ -61,9 +57,16 @@ World.view(0):setCamera(cam)
 -- creating flowing water
 
 water = WaterHeightField(origin, xstep, ystep, width, depth)
+-- the water may be coarser than the terrain, e.g. at a quarter of it
+--water = WaterHeightField(origin, 4 * xstep, 4 * ystep, (width-1)/4 + 1, (depth-1)/4 + 1)
+-- or solved by the explicit shallow water model, whose sources pour
+-- cubic metres per second
+--water = ShallowWaterHeightField(origin, xstep, ystep, width, depth)
 water:setTexture("water001.jpg")
 water:addSource(Point(0, 60), 0.001)
 water:setBottom(terrain)
+-- large fields may be solved by a few threads
+--water:setSolverThreads(2)
 water:addToWorld()
 
 World.start()
@@ -24,24 +24,23 @@ World.reset()
 -- creating terrain
 terrain = GridTerrain(origin, xstep, ystep, width, depth)
 terrain:setTexture("LlanoTex2.jpg")
+-- the generated terrain is read back when the script runs again
+terrain:setCacheResults(true)
 terrain:faultLineGeneration(200)
 terrain:smooth(0.7)
+-- draw far away chunks coarser, with at most two pixels of error
+-- terrain:setLODError(2.0)
 
 patch = Patch()
 patch:addPoints(Point(-10, -10), Point(10, -10), Point(15, 0), Point(10, 10), Point(-10, 10))
 patch:setAttribute("texture", "dirt.jpg")
 terrain:addPatch(patch)
 
--- now I'm gonna sweep a 2d paraboloid along the channel axis
-for j = 0, depth - 1 do
-	for i = 0, width - 1 do
-		local p = terrain:point(i, j)
-		local h = ((p:x()) ^ 2.0) / 10.0 - 10.0
-		if h < p:z() then
-			terrain:setPoint(i, j, h)
-		end
-	end
-end
+-- now I'm gonna sweep a 2d paraboloid along the channel axis, it is
+-- x^2/10 - 10 across the channel, up to r away from its axis
+local r = 32
+local axis = { Point(0, -64, r*r/10 - 10), Point(0, 64, r*r/10 - 10) }
+terrain:sweep(axis, r, -r*r/10, "paraboloid", "lower")
 
 terrain:addToWorld()
 
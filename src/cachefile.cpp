@@ -0,0 +1,173 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifdef __GNUG__
+#pragma implementation
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <utility>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cachefile.hpp>
+
+namespace Orbis {
+
+	namespace Util {
+
+unsigned hash(const void* data, unsigned size, unsigned value)
+{
+	const unsigned char *p = static_cast<const unsigned char*>(data);
+	for(unsigned k = 0; k < size; k++) {
+		value = (value ^ p[k]) * 16777619u;
+	}
+
+	return value;
+}
+
+unsigned hash(const std::string& s)
+{
+	return hash(s.data(), s.size());
+}
+
+bool makeDirectory(const std::string& dir)
+{
+	if(dir.empty()) {
+		return false;
+	}
+
+	// each parent in turn, the root excluded
+	std::string::size_type slash = dir.find('/', 1);
+	while(slash != std::string::npos) {
+		mkdir(dir.substr(0, slash).c_str(), 0755);
+		slash = dir.find('/', slash + 1);
+	}
+	mkdir(dir.c_str(), 0755);
+
+	struct stat st;
+	return stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void trimDirectory(const std::string& dir, const std::string& prefix,
+								double bytes)
+{
+	DIR *d = opendir(dir.c_str());
+	if(!d) {
+		return;
+	}
+
+	// the files of the kind, by the time they were last modified
+	typedef std::pair<time_t, std::pair<double, std::string> > File;
+	std::vector<File> files;
+	struct dirent *entry;
+	while((entry = readdir(d)) != 0) {
+		std::string name = entry->d_name;
+		struct stat st;
+		std::string path = dir + '/' + name;
+		if(name.compare(0, prefix.size(), prefix) == 0 &&
+				stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+			files.push_back(File(st.st_mtime,
+					std::make_pair(static_cast<double>(st.st_size), path)));
+		}
+	}
+	closedir(d);
+
+	// the newest first, and the rest while they fit
+	std::sort(files.begin(), files.end());
+	double total = 0.0;
+	for(unsigned k = files.size(); k-- > 0; ) {
+		total += files[k].second.first;
+		if(total > bytes && k + 1 < files.size()) {
+			remove(files[k].second.second.c_str());
+		}
+	}
+}
+
+std::string temporaryFile(const std::string& path)
+{
+	static unsigned files = 0;
+
+	std::ostringstream name;
+	name << path << '.' << static_cast<long>(getpid()) << '.'
+						<< files++ << ".tmp";
+
+	return name.str();
+}
+
+bool finishFile(const std::string& temp, const std::string& path,
+							bool complete)
+{
+	if(complete && rename(temp.c_str(), path.c_str()) == 0) {
+		return true;
+	}
+	remove(temp.c_str());
+
+	return false;
+}
+
+void putMagic(std::ostream& out, const char magic[MagicSize])
+{
+	out.write(magic, MagicSize);
+}
+
+bool getMagic(std::istream& in, const char magic[MagicSize])
+{
+	char read[MagicSize];
+	in.read(read, MagicSize);
+
+	return in && memcmp(read, magic, MagicSize) == 0;
+}
+
+void putString(std::ostream& out, const std::string& s)
+{
+	put<unsigned>(out, s.size());
+	out.write(s.data(), s.size());
+}
+
+std::string getString(std::istream& in, unsigned longest)
+{
+	unsigned length = get<unsigned>(in);
+	if(!in || length > longest) {
+		in.setstate(std::ios::failbit);
+		return std::string();
+	}
+	std::string s(length, ' ');
+	if(length > 0) {
+		in.read(&s[0], length);
+	}
+
+	return s;
+}
+
+void skipString(std::istream& in)
+{
+	unsigned length = get<unsigned>(in);
+	in.seekg(length, std::ios::cur);
+}
+
+} } // namespace declarations
@@ -0,0 +1,184 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifndef __ORBIS_CACHEFILE_HPP__
+#define __ORBIS_CACHEFILE_HPP__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+
+/*!
+ * \file cachefile.hpp
+ * \brief This file declares the helpers shared by the files of the disk
+ * caches: binary numbers, arrays and strings, the magic first bytes,
+ * the hash of the names and the creation of the directories.
+ */
+
+namespace Orbis {
+
+	namespace Util {
+
+//! Number of the magic bytes at the start of a file
+const unsigned MagicSize = 8;
+
+//! Longest string read back by default, more than any file name
+const unsigned MaxString = 65536;
+
+//! Starting value of an FNV-1a hash
+const unsigned HashBasis = 2166136261u;
+
+/*!
+ * \brief Extends an FNV-1a hash with some bytes.
+ * \param data The bytes.
+ * \param size The number of bytes.
+ * \param value The hash so far.
+ * \return The extended hash.
+ */
+unsigned hash(const void* data, unsigned size, unsigned value = HashBasis);
+
+/*!
+ * \brief The FNV-1a hash of a string.
+ * \param s The string.
+ * \return The hash.
+ */
+unsigned hash(const std::string& s);
+
+/*!
+ * \brief Creates a directory and any of its parents that are missing.
+ * \param dir The name of the directory.
+ * \return true if the directory exists afterwards.
+ */
+bool makeDirectory(const std::string& dir);
+
+/*!
+ * \brief Removes the oldest files of a kind from a directory.
+ *
+ * The files are kept from the most recently modified on, while their
+ * sizes add up to no more than the limit, and the rest are removed.
+ * The newest file is always kept.
+ * \param dir The directory.
+ * \param prefix The start of the names of the files of the kind.
+ * \param bytes The largest size of all the files kept.
+ */
+void trimDirectory(const std::string& dir, const std::string& prefix,
+								double bytes);
+
+/*!
+ * \brief A name to write a file under until it is complete.
+ *
+ * The name starts with the one of the file, so the file is still of
+ * its kind for trimDirectory(), and is different for each call, so
+ * several threads or processes writing the same file don't meet.
+ * \param path The name of the file.
+ * \return The temporary name.
+ * \sa finishFile
+ */
+std::string temporaryFile(const std::string& path);
+
+/*!
+ * \brief Renames a file written under a temporary name to its own.
+ *
+ * The file appears whole or not at all, so a reader never sees a part
+ * of it, even if the writer crashes.
+ * \param temp The temporary name given by temporaryFile().
+ * \param path The name of the file.
+ * \param complete Whether all of the file was written, otherwise the
+ * temporary file is removed.
+ * \return true if the file has its name.
+ */
+bool finishFile(const std::string& temp, const std::string& path,
+							bool complete);
+
+//! Writes the magic bytes of a kind of file.
+void putMagic(std::ostream& out, const char magic[MagicSize]);
+
+//! Reads the first bytes of a file, false if they are not the magic ones.
+bool getMagic(std::istream& in, const char magic[MagicSize]);
+
+//! Writes a string, after its length.
+void putString(std::ostream& out, const std::string& s);
+
+/*!
+ * \brief Reads a string written by putString().
+ *
+ * A length longer than asked for fails the stream, so that a damaged
+ * file does not make a huge allocation.
+ * \param in The stream.
+ * \param longest The longest string expected.
+ */
+std::string getString(std::istream& in, unsigned longest = MaxString);
+
+//! Skips a string written by putString(), however long.
+void skipString(std::istream& in);
+
+//! Writes a number in the machine's own format.
+template<typename T> void put(std::ostream& out, T value);
+
+//! Reads a number written by put().
+template<typename T> T get(std::istream& in);
+
+//! Writes the elements of an array, without its size.
+template<typename T> void putArray(std::ostream& out,
+						const std::vector<T>& a);
+
+//! Reads the elements of an array already of the right size.
+template<typename T> void getArray(std::istream& in, std::vector<T>& a);
+
+// inline methods
+
+template<typename T> inline void put(std::ostream& out, T value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T> inline T get(std::istream& in)
+{
+	T value = T();
+	in.read(reinterpret_cast<char*>(&value), sizeof(T));
+	return value;
+}
+
+template<typename T> inline void putArray(std::ostream& out,
+						const std::vector<T>& a)
+{
+	if(!a.empty()) {
+		out.write(reinterpret_cast<const char*>(&a[0]),
+							a.size() * sizeof(T));
+	}
+}
+
+template<typename T> inline void getArray(std::istream& in,
+						std::vector<T>& a)
+{
+	if(!a.empty()) {
+		in.read(reinterpret_cast<char*>(&a[0]), a.size() * sizeof(T));
+	}
+}
+
+} } // namespace declarations
+
+#endif  // __ORBIS_CACHEFILE_HPP__
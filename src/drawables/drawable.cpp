@@ -27,8 +27,7 @@
 
 #include <osg/TexEnv>
 #include <osg/Texture2D>
-#include <osgDB/ReadFile>
-
+#include <imagecache.hpp>
 #include <drawable.hpp>
 
 namespace Orbis {
@@ -39,12 +38,14 @@ void Drawable::setTexture(const std::string& texture)
 {
 	_texture = texture;
 
-	osg::Image *img = osgDB::readImageFile(_texture);
-	// creating and setting texture
-	if(img) {
+	// the image is shared by the drawables using the same file, but
+	// each one has its own texture to set up as it likes
+	osg::ref_ptr<osg::Image> img =
+			Orbis::Util::ImageCache::instance()->image(_texture);
+	if(img.valid()) {
 		osg::StateSet *dstate = getOrCreateStateSet();
 		osg::Texture2D *tex = new osg::Texture2D;
-		tex->setImage(img);
+		tex->setImage(img.get());
 		tex->setInternalFormatMode(osg::Texture2D::USE_ARB_COMPRESSION);
 		dstate->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
 		dstate->setTextureAttributeAndModes(0, tex, osg::StateAttribute::ON);
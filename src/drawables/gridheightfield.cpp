@@ -23,13 +23,94 @@
 #pragma implementation
 #endif
 
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <limits>
+#include <iomanip>
+#include <algorithm>
 #include <stdexcept>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include <gdal_priv.h>
 
+#include <cachefile.hpp>
 #include <gridheightfield.hpp>
 
 using Orbis::Math::min;
+using Orbis::Math::max;
+using Orbis::Math::clamp;
+using Orbis::Util::put;
+using Orbis::Util::get;
+using Orbis::Util::putArray;
+using Orbis::Util::getArray;
+
+// the first bytes of the files in the native format
+static const char NativeMagic[Orbis::Util::MagicSize] =
+			{ 'O', 'R', 'B', 'I', 'S', 'H', 'F', '2' };
+
+// the default directory of the converted files
+static std::string defaultCacheDirectory()
+{
+	const char *home = getenv("HOME");
+	return home ? std::string(home) + "/.orbis/heightfields" : std::string();
+}
+
+// the start of the names of the converted files in the cache directory,
+// and the most space they may take together
+static const char ConversionPrefix[] = "dem-";
+static const double ConversionCacheSize = 1024.0 * 1024.0 * 1024.0;
+
+// fewest lines of the raster read at a time
+static const unsigned StripLines = 256;
+
+// the band of a dataset with the elevations
+static GDALRasterBand* elevationBand(GDALDataset& dataset)
+{
+	GDALRasterBand *bandGray = 0;
+	GDALRasterBand *bandRed = 0;
+	GDALRasterBand *bandGreen = 0;
+	GDALRasterBand *bandBlue = 0;
+	GDALRasterBand *bandAlpha = 0;
+	for(int i = 1; i <= dataset.GetRasterCount(); i++) {
+		GDALRasterBand *band = dataset.GetRasterBand(i);
+
+		switch(band->GetColorInterpretation()) {
+			case GCI_GrayIndex:
+				bandGray = band;
+				break;
+			case GCI_RedBand:
+				bandRed = band;
+				break;
+			case GCI_GreenBand:
+				bandGreen = band;
+				break;
+			case GCI_BlueBand:
+				bandBlue = band;
+				break;
+			case GCI_AlphaBand:
+				bandAlpha = band;
+				break;
+			default:
+				bandGray = band;
+		}
+	}
+
+	if(bandGray) {
+		return bandGray;
+	} else if(bandAlpha) {
+		return bandAlpha;
+	} else if(bandRed) {
+		return bandRed;
+	} else if(bandGreen) {
+		return bandGreen;
+	}
+	return bandBlue;
+}
 
 inline static double det(double a, double b, double c,
 				double d, double e, double f)
@@ -41,8 +122,13 @@ namespace Orbis {
 
 	namespace Drawable {
 
+std::string GridHeightField::_cache_directory = defaultCacheDirectory();
+
 GridHeightField::GridHeightField()
-	: HeightField(), _xsamples(0), _ysamples(0), _xstep(0.0), _ystep(0.0)
+	: HeightField(), _xsamples(0), _ysamples(0), _xstep(0.0), _ystep(0.0),
+		_pyramid_revision(0),
+		_normals_revision(0),
+		_dirty_i0(1), _dirty_j0(1), _dirty_i1(0), _dirty_j1(0)
 {
 	_elevs = new FloatArray;
 }
@@ -52,7 +138,9 @@ GridHeightField::GridHeightField(const GridHeightField& src,
 	: HeightField(src, copyOp),
 		_elevs(new FloatArray(*src._elevs, copyOp)),
 		_xsamples(src._xsamples), _ysamples(src._ysamples),
-		_xstep(src._xstep), _ystep(src._ystep)
+		_xstep(src._xstep), _ystep(src._ystep), _pyramid_revision(0),
+		_normals_revision(0),
+		_dirty_i0(1), _dirty_j0(1), _dirty_i1(0), _dirty_j1(0)
 {
 }	
 
@@ -62,20 +150,48 @@ GridHeightField::GridHeightField(const Point& origin,
 	: HeightField(origin),
 		_elevs(new FloatArray(xsize * ysize)),
 		_xsamples(xsize), _ysamples(ysize),
-		_xstep(xstep), _ystep(ystep)
+		_xstep(xstep), _ystep(ystep), _pyramid_revision(0),
+		_normals_revision(0),
+		_dirty_i0(1), _dirty_j0(1), _dirty_i1(0), _dirty_j1(0)
 {
+	buildPyramid();
 }
 
-GridHeightField::GridHeightField(const std::string& filename)
-	: HeightField()
+GridHeightField::GridHeightField(const std::string& filename,
+					unsigned decimation, unsigned column,
+					unsigned line, unsigned columns, unsigned lines)
+	: HeightField(), _xsamples(0), _ysamples(0), _xstep(0.0), _ystep(0.0),
+		_pyramid_revision(0),
+		_normals_revision(0),
+		_dirty_i0(1), _dirty_j0(1), _dirty_i1(0), _dirty_j1(0)
 {
 	_elevs = new FloatArray;
-	load(filename);
+	load(filename, decimation, column, line, columns, lines);
 }
 
 /* loads the heightfield from a data file */
-bool GridHeightField::load(const std::string& filename)
+bool GridHeightField::load(const std::string& filename, unsigned decimation,
+					unsigned column, unsigned line,
+						unsigned columns, unsigned lines)
 {
+	// a file in the native format needs no conversion
+	if(readNative(filename)) {
+		return true;
+	}
+
+	// nor does a file converted before
+	decimation = max(decimation, 1u);
+	std::string source, cached;
+	struct stat st;
+	if(!_cache_directory.empty() && stat(filename.c_str(), &st) == 0) {
+		source = cacheSource(filename, st.st_mtime, decimation,
+						column, line, columns, lines);
+		cached = cacheFile(source);
+		if(readNative(cached, source)) {
+			return true;
+		}
+	}
+
 	static bool gdal_init = false;
 
 	/* one-time initialisation of GDAL */
@@ -86,109 +202,266 @@ bool GridHeightField::load(const std::string& filename)
 
 	std::auto_ptr<GDALDataset>
 		dataset((GDALDataset*)GDALOpen(filename.c_str(), GA_ReadOnly));
-
 	if(!dataset.get()) {
 		return false;
 	}
+	GDALRasterBand *band = elevationBand(*dataset);
+	unsigned raster_width = dataset->GetRasterXSize();
+	unsigned raster_height = dataset->GetRasterYSize();
+	if(!band || column >= raster_width || line >= raster_height) {
+		return false;
+	}
 
-	int width = dataset->GetRasterXSize();
-	width = min(width, 512);
-	int depth = dataset->GetRasterYSize();
-	depth = min(depth, 512);
+	// keeping every decimation-th sample of the window in each direction
+	columns = columns > 0 ? min(columns, raster_width - column)
+						: raster_width - column;
+	lines = lines > 0 ? min(lines, raster_height - line)
+						: raster_height - line;
+	unsigned width = columns / decimation;
+	unsigned depth = lines / decimation;
+	if(width < 2 || depth < 2) {
+		return false;
+	}
 
 	double geo_trans[6];
 	dataset->GetGeoTransform(geo_trans);
-	_xstep = std::abs(geo_trans[1]);
-	_ystep = std::abs(geo_trans[5]);
-
-	GDALRasterBand *bandGray = 0;
-	GDALRasterBand *bandRed = 0;
-	GDALRasterBand *bandGreen = 0;
-	GDALRasterBand *bandBlue = 0;
-	GDALRasterBand *bandAlpha = 0;
-	for(int i = 1; i <= dataset->GetRasterCount(); i++) {
-		GDALRasterBand *band = dataset->GetRasterBand(i);
 
-		switch(band->GetColorInterpretation()) {
-			case GCI_GrayIndex:
-				bandGray = band;
-				break;
-			case GCI_RedBand:
-				bandRed = band;
-				break;
-			case GCI_GreenBand:
-				bandGreen = band;
-				break;
-			case GCI_BlueBand:
-				bandBlue = band;
-				break;
-			case GCI_AlphaBand:
-				bandAlpha = band;
-				break;
-			default:
-				bandGray = band;
+	// the window is read a strip of whole blocks at a time, into a
+	// buffer smaller than the strip when decimating, so GDAL subsamples
+	// it and may use the overviews of the file; the rows are stored
+	// flipped, and nothing is changed until all of them were read
+	int block_x = 0, block_y = 0;
+	band->GetBlockSize(&block_x, &block_y);
+	unsigned rows = max(max(static_cast<unsigned>(max(block_y, 1)),
+					StripLines) / decimation, 1u);
+	std::vector<float> elevs(width * depth);
+	int spacing = static_cast<int>(width * sizeof(float));
+	for(unsigned r = 0; r < depth; r += rows) {
+		unsigned n = min(rows, depth - r);
+		if(band->RasterIO(GF_Read, column, line + r * decimation,
+				width * decimation, n * decimation,
+				&elevs[(depth - 1 - r) * width], width, n,
+				GDT_Float32, 0, -spacing) != CE_None) {
+			return false;
 		}
 	}
 
-	GDALRasterBand *bandSelected = 0;
-	if(!bandSelected && bandGray) {
-		bandSelected = bandGray;
-	} else if(!bandSelected && bandAlpha) {
-		bandSelected = bandAlpha;
-	} else if(!bandSelected && bandRed) {
-		bandSelected = bandRed;
-	} else if(!bandSelected && bandGreen) {
-		bandSelected = bandGreen;
-	} else if(!bandSelected && bandBlue) {
-		bandSelected = bandBlue;
-	}
-
-	if(bandSelected) {
-		_xsamples = width;
-		_ysamples = depth;
-		setOrigin(Point(-1.0*(_xsamples-1)*_xstep/2.0,
-					 -1.0*(_ysamples-1)*_ystep/2.0));
-	
-		// loading from GDAL into array of elevations
-		_elevs->resize(width*depth);
-		bandSelected->RasterIO(GF_Read, 0, 0, width, depth,
-					 static_cast<void*>(&_elevs->front()),
-							 width, depth, GDT_Float32, 0, 0);
-
-		// changing GDAL NODATA values to something more apropriated
-		FloatArray::iterator it;
-		for(it = _elevs->begin(); it != _elevs->end(); it++) {
-			if(*it < -9000.0) {
-				*it = 0.0;
-			}
+	// changing NODATA values to something more apropriated
+	// and finding the extreme elevations
+	int has_nodata = 0;
+	float nodata = band->GetNoDataValue(&has_nodata);
+	double lo =  std::numeric_limits<double>::max();
+	double hi = -std::numeric_limits<double>::max();
+	std::vector<float>::iterator it;
+	for(it = elevs.begin(); it != elevs.end(); it++) {
+		if(*it < -9000.0 || (has_nodata && *it == nodata)) {
+			*it = 0.0;
 		}
+		lo = min<double>(lo, *it);
+		hi = max<double>(hi, *it);
+	}
 
-		// flipping
-		unsigned int copy_r = _ysamples - 1;
-		for(unsigned int r = 0; r < copy_r; r++, copy_r--) {
-			for(unsigned int c = 0; c < _xsamples; c++) {
-				float temp = point(c, r).z();
-				setPoint(c, r, point(c, copy_r).z());
-				setPoint(c, copy_r, temp);
-			}
-		}
+	_xsamples = width;
+	_ysamples = depth;
+	_xstep = std::abs(geo_trans[1]) * decimation;
+	_ystep = std::abs(geo_trans[5]) * decimation;
+	_elevs->swap(elevs);
+	_min_elev = lo;
+	_max_elev = hi;
+	setOrigin(Point(-1.0*(_xsamples-1)*_xstep/2.0,
+				 -1.0*(_ysamples-1)*_ystep/2.0));
+	dirtyBound();
+	modified();
+	buildPyramid();
 
-		return true;
-	} else {
+	if(!cached.empty() && createCacheDirectory()) {
+		save(cached, source);
+		Util::trimDirectory(_cache_directory, ConversionPrefix,
+							ConversionCacheSize);
+	}
+
+	return true;
+}
+
+bool GridHeightField::save(const std::string& filename,
+					const std::string& source) const
+{
+	// written aside, and named once complete
+	std::string temp = Util::temporaryFile(filename);
+	std::ofstream out(temp.c_str(), std::ios::out | std::ios::binary);
+	if(!out.is_open()) {
+		return false;
+	}
+
+	Util::putMagic(out, NativeMagic);
+	Util::putString(out, source);
+	put<unsigned>(out, _xsamples);
+	put<unsigned>(out, _ysamples);
+	put<double>(out, _xstep);
+	put<double>(out, _ystep);
+	put<double>(out, origin().x());
+	put<double>(out, origin().y());
+	put<double>(out, origin().z());
+	put<double>(out, _min_elev);
+	put<double>(out, _max_elev);
+	putArray(out, *_elevs);
+	if(_xsamples > 0 && _ysamples > 0) {
+		putArray(out, *normals());
+	}
+	const std::vector<Level>& levels = pyramid();
+	put<unsigned>(out, levels.size());
+	for(unsigned k = 0; k < levels.size(); k++) {
+		put<unsigned>(out, levels[k].nx);
+		put<unsigned>(out, levels[k].ny);
+		putArray(out, levels[k].lo);
+		putArray(out, levels[k].hi);
+	}
+	out.close();
+
+	return Util::finishFile(temp, filename, !out.fail());
+}
+
+bool GridHeightField::readNative(const std::string& filename,
+					const std::string& source)
+{
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	if(!in.is_open()) {
+		return false;
+	}
+
+	// a cached file must be of the same source, a conversion of the
+	// same samples or the result of the same recipe, and not just of
+	// one whose name hashes the same
+	if(!Util::getMagic(in, NativeMagic)) {
+		return false;
+	}
+	if(source.empty()) {
+		Util::skipString(in);
+	} else if(Util::getString(in, source.size()) != source) {
+		return false;
+	}
+	if(!in) {
+		return false;
+	}
+	unsigned nx = get<unsigned>(in), ny = get<unsigned>(in);
+	double xstep = get<double>(in), ystep = get<double>(in);
+	double ox = get<double>(in), oy = get<double>(in), oz = get<double>(in);
+	double lo = get<double>(in), hi = get<double>(in);
+	if(!in || nx < 2 || ny < 2) {
+		return false;
+	}
+
+	// the elevations and normals must all be there before they are
+	// allocated, so a damaged file can't ask for any size
+	std::streampos here = in.tellg();
+	in.seekg(0, std::ios::end);
+	double left = static_cast<double>(in.tellg() - here);
+	in.seekg(here);
+	double points = static_cast<double>(nx) * ny;
+	if(!in || here < 0 || points > std::numeric_limits<unsigned>::max() ||
+			left < points * (sizeof(float) + sizeof(osg::Vec3))) {
+		return false;
+	}
+
+	// the arrays are read whole, straight into place
+	osg::ref_ptr<FloatArray> elevs = new FloatArray(nx * ny);
+	getArray(in, *elevs);
+	osg::ref_ptr<osg::Vec3Array> norms = new osg::Vec3Array(nx * ny);
+	getArray(in, *norms);
+
+	// the pyramid must have the levels buildPyramid() makes for the
+	// grid, from the cells up to a single node
+	unsigned depth = 1;
+	for(unsigned ax = nx - 1, ay = ny - 1; ax > 1 || ay > 1; depth++) {
+		ax = (ax + 1) / 2;
+		ay = (ay + 1) / 2;
+	}
+	if(get<unsigned>(in) != depth) {
 		return false;
 	}
+	std::vector<Level> levels(depth);
+	for(unsigned k = 0, ax = nx - 1, ay = ny - 1; k < depth; k++) {
+		levels[k].nx = get<unsigned>(in);
+		levels[k].ny = get<unsigned>(in);
+		if(!in || levels[k].nx != ax || levels[k].ny != ay) {
+			return false;
+		}
+		levels[k].lo.resize(ax * ay);
+		levels[k].hi.resize(ax * ay);
+		getArray(in, levels[k].lo);
+		getArray(in, levels[k].hi);
+		ax = (ax + 1) / 2;
+		ay = (ay + 1) / 2;
+	}
+	if(!in) {
+		return false;
+	}
+
+	// the arrays already drawn are kept, with the new contents
+	_xsamples = nx;
+	_ysamples = ny;
+	_xstep = xstep;
+	_ystep = ystep;
+	setOrigin(Point(ox, oy, oz));
+	_min_elev = lo;
+	_max_elev = hi;
+	_elevs->swap(*elevs);
+	if(!_normals.valid()) {
+		_normals = new osg::Vec3Array;
+	}
+	_normals->swap(*norms);
+	_pyramid.swap(levels);
+	dirtyBound();
+	modified();
+	_normals_revision = _pyramid_revision = revision();
+	_dirty_i0 = _dirty_j0 = 1;
+	_dirty_i1 = _dirty_j1 = 0;
+
+	return true;
+}
+
+bool GridHeightField::createCacheDirectory()
+{
+	return Util::makeDirectory(_cache_directory);
+}
+
+std::string GridHeightField::cacheSource(const std::string& filename,
+					time_t mtime, unsigned decimation,
+						unsigned column, unsigned line,
+							unsigned columns, unsigned lines)
+{
+	// the numbers first, so the name can hold anything
+	std::ostringstream source;
+	source << static_cast<unsigned long>(mtime) << ' ' << decimation
+			<< ' ' << column << ' ' << line << ' ' << columns
+				<< ' ' << lines << ' ' << filename;
+
+	return source.str();
+}
+
+std::string GridHeightField::cacheFile(const std::string& source)
+{
+	std::ostringstream name;
+	name << _cache_directory << '/' << ConversionPrefix << std::hex
+		<< std::setfill('0') << std::setw(8) << Util::hash(source) << ".hf";
+
+	return name.str();
 }
 
 Point GridHeightField::point(double x, double y) const
 {
-	// is the point over the terrain?
-	if(x < origin().x() || x > origin().x() + sizeX() ||
+	// is the point over the terrain, which has cells at all?
+	if(_xsamples < 2 || _ysamples < 2 ||
+			x < origin().x() || x > origin().x() + sizeX() ||
 					y < origin().y() || y > origin().y() + sizeY()) {
 		throw std::out_of_range("point is outside the heightfield");
 	}
 	// mapping from coordinates to grid vertices
 	unsigned i = static_cast<unsigned>(floor((x - origin().x()) / stepX()));
 	unsigned j = static_cast<unsigned>(floor((y - origin().y()) / stepY()));
+	// the far borders belong to the last cells
+	i = min(i, _xsamples - 2);
+	j = min(j, _ysamples - 2);
 	// base point
 	Point bp = point(i, j);
 	// using the tangent to find out in which triangle
@@ -225,14 +498,18 @@ Point GridHeightField::point(double x, double y) const
 
 Vector GridHeightField::normal(double x, double y) const
 {
-	// is the point over the terrain?
-	if(x < origin().x() || x > origin().x() + sizeX() ||
+	// is the point over the terrain, which has cells at all?
+	if(_xsamples < 2 || _ysamples < 2 ||
+			x < origin().x() || x > origin().x() + sizeX() ||
 					y < origin().y() || y > origin().y() + sizeY()) {
 		throw std::out_of_range("normal is outside the height field");
 	}
 	// mapping from coordinates to grid vertices
 	unsigned i = static_cast<unsigned>(floor((x - origin().x()) / stepX()));
 	unsigned j = static_cast<unsigned>(floor((y - origin().y()) / stepY()));
+	// the far borders belong to the last cells
+	i = min(i, _xsamples - 2);
+	j = min(j, _ysamples - 2);
 	// points
 	Point p1 = point(i, j), p2, p3;
 	// using the tangent to find out in which triangle
@@ -249,6 +526,88 @@ Vector GridHeightField::normal(double x, double y) const
 	return ((p2 - p1) ^ (p3 - p1)).normalise();
 }
 
+void GridHeightField::sample(unsigned count,
+				const double* xs, const double* ys,
+					double* zs, Vector* normals, Outside outside) const
+{
+	double nan = std::numeric_limits<double>::quiet_NaN();
+	if(_xsamples < 2 || _ysamples < 2) {
+		for(unsigned k = 0; k < count; k++) {
+			if(zs) {
+				zs[k] = nan;
+			}
+			if(normals) {
+				normals[k] = Vector(nan, nan, nan);
+			}
+		}
+		return;
+	}
+
+	const FloatArray::value_type *elevs = &_elevs->front();
+	double ox = origin().x(), oy = origin().y();
+	double inv_dx = 1.0 / _xstep, inv_dy = 1.0 / _ystep;
+	double last_i = _xsamples - 2, last_j = _ysamples - 2;
+	unsigned row = _xsamples;
+
+	unsigned cell[SampleBlock];
+	double u[SampleBlock], v[SampleBlock];
+	bool out[SampleBlock];
+	for(unsigned first = 0; first < count; first += SampleBlock) {
+		unsigned n = min(SampleBlock, count - first);
+		const double *x = xs + first, *y = ys + first;
+
+		// locating the cells, the comparisons also catch not-a-number
+		for(unsigned k = 0; k < n; k++) {
+			double fx = (x[k] - ox) * inv_dx;
+			double fy = (y[k] - oy) * inv_dy;
+			out[k] = !(fx >= 0.0 && fx <= last_i + 1.0 &&
+						fy >= 0.0 && fy <= last_j + 1.0);
+			fx = fx > 0.0 ? fx : 0.0;
+			fx = fx < last_i + 1.0 ? fx : last_i + 1.0;
+			fy = fy > 0.0 ? fy : 0.0;
+			fy = fy < last_j + 1.0 ? fy : last_j + 1.0;
+			// the far borders belong to the last cells
+			double ci = min(floor(fx), last_i);
+			double cj = min(floor(fy), last_j);
+			cell[k] = static_cast<unsigned>(cj) * row +
+							static_cast<unsigned>(ci);
+			u[k] = fx - ci;
+			v[k] = fy - cj;
+		}
+
+		// interpolating in the triangles, split as in point()
+		for(unsigned k = 0; k < n; k++) {
+			const FloatArray::value_type *z = elevs + cell[k];
+			double z00 = z[0], z10 = z[1];
+			double z01 = z[row], z11 = z[row + 1];
+			bool upper = v[k] > u[k];
+			double du = upper ? z11 - z01 : z10 - z00;
+			double dv = upper ? z01 - z00 : z11 - z10;
+			if(zs) {
+				zs[first + k] = z00 + du * u[k] + dv * v[k];
+			}
+			if(normals) {
+				normals[first + k] =
+					Vector(-du * inv_dx, -dv * inv_dy, 1.0).normalise();
+			}
+		}
+
+		// clamped points are kept unless asked otherwise
+		for(unsigned k = 0; k < n; k++) {
+			if(!out[k] || (outside == ClampOutside &&
+						x[k] == x[k] && y[k] == y[k])) {
+				continue;
+			}
+			if(zs) {
+				zs[first + k] = nan;
+			}
+			if(normals) {
+				normals[first + k] = Vector(nan, nan, nan);
+			}
+		}
+	}
+}
+
 Point GridHeightField::point(unsigned i, unsigned j) const
 {
 	if(i >= _xsamples || j >= _ysamples) {
@@ -268,26 +627,480 @@ void GridHeightField::setPoint(unsigned i, unsigned j, double val)
 
 	(*_elevs)[j * _xsamples + i] = val;
 
-	if(val < _min_elev) {
-		_min_elev = val;
-		dirtyBound();
+	written(i, j, i, j);
+}
+
+void GridHeightField::written(unsigned i0, unsigned j0,
+						unsigned i1, unsigned j1)
+{
+	bool current = !_pyramid.empty() && _pyramid_revision == revision();
+	bool normals_current = _normals.valid() &&
+						_normals_revision == revision();
+
+	modified();
+
+	// only the normals around the points are wrong now
+	if(normals_current) {
+		unsigned a0 = i0 > 0 ? i0 - 1 : 0, a1 = min(i1 + 1, _xsamples - 1);
+		unsigned b0 = j0 > 0 ? j0 - 1 : 0, b1 = min(j1 + 1, _ysamples - 1);
+		if(_dirty_i0 > _dirty_i1) {
+			_dirty_i0 = a0;
+			_dirty_j0 = b0;
+			_dirty_i1 = a1;
+			_dirty_j1 = b1;
+		} else {
+			_dirty_i0 = min(_dirty_i0, a0);
+			_dirty_j0 = min(_dirty_j0, b0);
+			_dirty_i1 = max(_dirty_i1, a1);
+			_dirty_j1 = max(_dirty_j1, b1);
+		}
+		_normals_revision = revision();
 	}
-	if(val > _max_elev) {
-		_max_elev = val;
+
+	if(current) {
+		// the points are corners of the cells around them
+		updatePyramid(i0 > 0 ? i0 - 1 : 0, j0 > 0 ? j0 - 1 : 0,
+				min(i1, _xsamples - 2), min(j1, _ysamples - 2));
+		_pyramid_revision = revision();
+		// the bounds may shrink too
+		const Level& top = _pyramid.back();
+		if(top.lo[0] != _min_elev || top.hi[0] != _max_elev) {
+			_min_elev = top.lo[0];
+			_max_elev = top.hi[0];
+			dirtyBound();
+		}
+		return;
+	}
+
+	bool grown = false;
+	for(unsigned j = j0; j <= j1; j++) {
+		for(unsigned i = i0; i <= i1; i++) {
+			double val = point(j * _xsamples + i);
+			if(val < _min_elev) {
+				_min_elev = val;
+				grown = true;
+			}
+			if(val > _max_elev) {
+				_max_elev = val;
+				grown = true;
+			}
+		}
+	}
+	if(grown) {
 		dirtyBound();
 	}
 }
 
-Vector GridHeightField::normal(unsigned i, unsigned j) const
+bool GridHeightField::elevationRange(double x0, double y0,
+				double x1, double y1, double& lo, double& hi) const
 {
-	double za, zb;
-	unsigned o, a, b, n1, n2;
-	double d1, d2, nx, ny, nz;
+	const std::vector<Level>& levels = pyramid();
+	if(levels.empty()) {
+		return false;
+	}
+
+	if(x1 < x0) {
+		std::swap(x0, x1);
+	}
+	if(y1 < y0) {
+		std::swap(y0, y1);
+	}
+	if(x1 < origin().x() || x0 > origin().x() + sizeX() ||
+				y1 < origin().y() || y0 > origin().y() + sizeY()) {
+		return false;
+	}
+
+	// the cells touched by the rectangle
+	double last_a = _xsamples - 2;
+	double last_b = _ysamples - 2;
+	unsigned a0 = static_cast<unsigned>(
+			clamp(floor((x0 - origin().x()) / _xstep), 0.0, last_a));
+	unsigned a1 = static_cast<unsigned>(
+			clamp(floor((x1 - origin().x()) / _xstep), 0.0, last_a));
+	unsigned b0 = static_cast<unsigned>(
+			clamp(floor((y0 - origin().y()) / _ystep), 0.0, last_b));
+	unsigned b1 = static_cast<unsigned>(
+			clamp(floor((y1 - origin().y()) / _ystep), 0.0, last_b));
+
+	lo =  std::numeric_limits<double>::max();
+	hi = -std::numeric_limits<double>::max();
+	rangeNode(levels.size() - 1, 0, 0, a0, b0, a1, b1, lo, hi);
+
+	return true;
+}
+
+bool GridHeightField::intersect(const Point& start, const Vector& dir,
+							Point& hit) const
+{
+	const std::vector<Level>& levels = pyramid();
+	if(levels.empty()) {
+		return false;
+	}
 
+	double o[3] = { start.x(), start.y(), start.z() };
+	double d[3] = { dir.x(), dir.y(), dir.z() };
+	double t;
+	if(!intersectNode(levels.size() - 1, 0, 0, o, d, 0.0,
+				std::numeric_limits<double>::max(), t)) {
+		return false;
+	}
+
+	hit = Point(o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2]);
+	return true;
+}
+
+const std::vector<GridHeightField::Level>& GridHeightField::pyramid() const
+{
+	// several threads may pick a terrain, which has no lock of its own
+	_pyramid_mutex.lock();
+	if(_pyramid.empty() || _pyramid_revision != revision()) {
+		buildPyramid();
+	}
+	_pyramid_mutex.unlock();
+
+	return _pyramid;
+}
+
+void GridHeightField::buildPyramid() const
+{
+	_pyramid.clear();
+	_pyramid_revision = revision();
+	if(_xsamples < 2 || _ysamples < 2) {
+		return;
+	}
+
+	// the cells
+	_pyramid.push_back(Level());
+	Level& cells = _pyramid.back();
+	cells.nx = _xsamples - 1;
+	cells.ny = _ysamples - 1;
+	cells.lo.resize(cells.nx * cells.ny);
+	cells.hi.resize(cells.nx * cells.ny);
+	for(unsigned b = 0; b < cells.ny; b++) {
+		for(unsigned a = 0; a < cells.nx; a++) {
+			unsigned o = b * _xsamples + a;
+			float z00 = point(o), z10 = point(o + 1);
+			float z01 = point(o + _xsamples), z11 = point(o + _xsamples + 1);
+			cells.lo[b * cells.nx + a] = min(min(z00, z10), min(z01, z11));
+			cells.hi[b * cells.nx + a] = max(max(z00, z10), max(z01, z11));
+		}
+	}
+
+	// each node above covers 2x2 nodes below, the top one everything
+	while(_pyramid.back().nx > 1 || _pyramid.back().ny > 1) {
+		Level up;
+		const Level& below = _pyramid.back();
+		up.nx = (below.nx + 1) / 2;
+		up.ny = (below.ny + 1) / 2;
+		up.lo.assign(up.nx * up.ny, std::numeric_limits<float>::max());
+		up.hi.assign(up.nx * up.ny, -std::numeric_limits<float>::max());
+		for(unsigned b = 0; b < below.ny; b++) {
+			for(unsigned a = 0; a < below.nx; a++) {
+				unsigned n = (b / 2) * up.nx + a / 2;
+				up.lo[n] = min(up.lo[n], below.lo[b * below.nx + a]);
+				up.hi[n] = max(up.hi[n], below.hi[b * below.nx + a]);
+			}
+		}
+		_pyramid.push_back(up);
+	}
+}
+
+void GridHeightField::updatePyramid(unsigned a0, unsigned b0,
+						unsigned a1, unsigned b1)
+{
+	Level& cells = _pyramid[0];
+	for(unsigned b = b0; b <= b1; b++) {
+		for(unsigned a = a0; a <= a1; a++) {
+			unsigned o = b * _xsamples + a;
+			float z00 = point(o), z10 = point(o + 1);
+			float z01 = point(o + _xsamples), z11 = point(o + _xsamples + 1);
+			cells.lo[b * cells.nx + a] = min(min(z00, z10), min(z01, z11));
+			cells.hi[b * cells.nx + a] = max(max(z00, z10), max(z01, z11));
+		}
+	}
+
+	for(unsigned k = 1; k < _pyramid.size(); k++) {
+		const Level& below = _pyramid[k-1];
+		Level& up = _pyramid[k];
+		a0 /= 2; b0 /= 2; a1 /= 2; b1 /= 2;
+		for(unsigned b = b0; b <= b1; b++) {
+			for(unsigned a = a0; a <= a1; a++) {
+				float lo = std::numeric_limits<float>::max();
+				float hi = -std::numeric_limits<float>::max();
+				for(unsigned cb = 2*b; cb < min(2*b + 2, below.ny); cb++) {
+					for(unsigned ca = 2*a; ca < min(2*a + 2, below.nx); ca++) {
+						lo = min(lo, below.lo[cb * below.nx + ca]);
+						hi = max(hi, below.hi[cb * below.nx + ca]);
+					}
+				}
+				up.lo[b * up.nx + a] = lo;
+				up.hi[b * up.nx + a] = hi;
+			}
+		}
+	}
+}
+
+bool GridHeightField::clipNode(unsigned k, unsigned a, unsigned b,
+				const double o[3], const double d[3],
+					double& tmin, double& tmax) const
+{
+	const Level& level = _pyramid[k];
+	unsigned n = b * level.nx + a;
+	double box_min[3], box_max[3];
+	box_min[0] = origin().x() + (a << k) * _xstep;
+	box_max[0] = origin().x() + min((a + 1) << k, _xsamples - 1) * _xstep;
+	box_min[1] = origin().y() + (b << k) * _ystep;
+	box_max[1] = origin().y() + min((b + 1) << k, _ysamples - 1) * _ystep;
+	box_min[2] = level.lo[n];
+	box_max[2] = level.hi[n];
+
+	// the slabs of the box
+	for(unsigned c = 0; c < 3; c++) {
+		if(d[c] == 0.0) {
+			if(o[c] < box_min[c] || o[c] > box_max[c]) {
+				return false;
+			}
+			continue;
+		}
+		double t0 = (box_min[c] - o[c]) / d[c];
+		double t1 = (box_max[c] - o[c]) / d[c];
+		if(t0 > t1) {
+			std::swap(t0, t1);
+		}
+		tmin = max(tmin, t0);
+		tmax = min(tmax, t1);
+		if(tmin > tmax) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// intersection of a ray and a triangle, after Moller and Trumbore
+static bool intersectTriangle(const double o[3], const double d[3],
+				const double p0[3], const double p1[3],
+					const double p2[3], double& t)
+{
+	double e1[3], e2[3], p[3], q[3], s[3];
+	for(unsigned c = 0; c < 3; c++) {
+		e1[c] = p1[c] - p0[c];
+		e2[c] = p2[c] - p0[c];
+		s[c] = o[c] - p0[c];
+	}
+	p[0] = d[1] * e2[2] - d[2] * e2[1];
+	p[1] = d[2] * e2[0] - d[0] * e2[2];
+	p[2] = d[0] * e2[1] - d[1] * e2[0];
+	double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+	if(det == 0.0) {
+		return false;
+	}
+	double u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / det;
+	if(u < 0.0 || u > 1.0) {
+		return false;
+	}
+	q[0] = s[1] * e1[2] - s[2] * e1[1];
+	q[1] = s[2] * e1[0] - s[0] * e1[2];
+	q[2] = s[0] * e1[1] - s[1] * e1[0];
+	double v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+	if(v < 0.0 || u + v > 1.0) {
+		return false;
+	}
+	t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+	return true;
+}
+
+bool GridHeightField::intersectNode(unsigned k, unsigned a, unsigned b,
+				const double o[3], const double d[3],
+					double tmin, double tmax, double& t) const
+{
+	if(!clipNode(k, a, b, o, d, tmin, tmax)) {
+		return false;
+	}
+
+	if(k == 0) {
+		// the two triangles of the cell, split as in point()
+		double x = origin().x() + a * _xstep;
+		double y = origin().y() + b * _ystep;
+		unsigned i = b * _xsamples + a;
+		double p00[3] = { x, y, point(i) };
+		double p10[3] = { x + _xstep, y, point(i + 1) };
+		double p01[3] = { x, y + _ystep, point(i + _xsamples) };
+		double p11[3] = { x + _xstep, y + _ystep, point(i + _xsamples + 1) };
+		bool found = false;
+		double th;
+		if(intersectTriangle(o, d, p00, p11, p01, th) &&
+						th >= tmin && th <= tmax) {
+			t = th;
+			tmax = th;
+			found = true;
+		}
+		if(intersectTriangle(o, d, p00, p10, p11, th) &&
+						th >= tmin && th <= tmax) {
+			t = th;
+			found = true;
+		}
+		return found;
+	}
+
+	// visiting the nodes below in the order the ray enters them, the
+	// first one hit has the nearest point
+	const Level& below = _pyramid[k-1];
+	unsigned count = 0;
+	unsigned child[4][2];
+	double entry[4];
+	for(unsigned cb = 2*b; cb < min(2*b + 2, below.ny); cb++) {
+		for(unsigned ca = 2*a; ca < min(2*a + 2, below.nx); ca++) {
+			double t0 = tmin, t1 = tmax;
+			if(!clipNode(k-1, ca, cb, o, d, t0, t1)) {
+				continue;
+			}
+			unsigned c = count++;
+			while(c > 0 && entry[c-1] > t0) {
+				entry[c] = entry[c-1];
+				child[c][0] = child[c-1][0];
+				child[c][1] = child[c-1][1];
+				c--;
+			}
+			entry[c] = t0;
+			child[c][0] = ca;
+			child[c][1] = cb;
+		}
+	}
+	for(unsigned c = 0; c < count; c++) {
+		if(intersectNode(k-1, child[c][0], child[c][1],
+							o, d, tmin, tmax, t)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void GridHeightField::rangeNode(unsigned k, unsigned a, unsigned b,
+				unsigned a0, unsigned b0, unsigned a1, unsigned b1,
+					double& lo, double& hi) const
+{
+	// the cells covered by the node
+	unsigned first_a = a << k;
+	unsigned last_a = min(((a + 1) << k) - 1, _xsamples - 2);
+	unsigned first_b = b << k;
+	unsigned last_b = min(((b + 1) << k) - 1, _ysamples - 2);
+	if(first_a > a1 || last_a < a0 || first_b > b1 || last_b < b0) {
+		return;
+	}
+
+	const Level& level = _pyramid[k];
+	if(k == 0 || (first_a >= a0 && last_a <= a1 &&
+					first_b >= b0 && last_b <= b1)) {
+		lo = min<double>(lo, level.lo[b * level.nx + a]);
+		hi = max<double>(hi, level.hi[b * level.nx + a]);
+		return;
+	}
+
+	const Level& below = _pyramid[k-1];
+	for(unsigned cb = 2*b; cb < min(2*b + 2, below.ny); cb++) {
+		for(unsigned ca = 2*a; ca < min(2*a + 2, below.nx); ca++) {
+			rangeNode(k-1, ca, cb, a0, b0, a1, b1, lo, hi);
+		}
+	}
+}
+
+Vector GridHeightField::normal(unsigned i, unsigned j) const
+{
 	if(i >= _xsamples || j >= _ysamples) {
 		throw std::out_of_range("invalid grid coordinates");
 	}
 
+	updateNormals();
+
+	const osg::Vec3& n = (*_normals)[j * _xsamples + i];
+	return Vector(n.x(), n.y(), n.z());
+}
+
+osg::Vec3Array* GridHeightField::normals() const
+{
+	updateNormals();
+
+	return _normals.get();
+}
+
+void GridHeightField::updateNormals() const
+{
+	unsigned n = _xsamples * _ysamples;
+	if(!_normals.valid() || _normals->size() != n ||
+					_normals_revision != revision()) {
+		// everything changed
+		if(!_normals.valid()) {
+			_normals = new osg::Vec3Array;
+		}
+		_normals->resize(n);
+		_normals_revision = revision();
+		computeNormals(0, 0, _xsamples - 1, _ysamples - 1);
+	} else if(_dirty_i0 <= _dirty_i1 && _dirty_j0 <= _dirty_j1) {
+		computeNormals(_dirty_i0, _dirty_j0, _dirty_i1, _dirty_j1);
+	}
+
+	// nothing is dirty now
+	_dirty_i0 = _dirty_j0 = 1;
+	_dirty_i1 = _dirty_j1 = 0;
+}
+
+void GridHeightField::computeNormals(unsigned i0, unsigned j0,
+						unsigned i1, unsigned j1) const
+{
+	if(_xsamples < 2 || _ysamples < 2) {
+		for(unsigned j = j0; j <= j1; j++) {
+			for(unsigned i = i0; i <= i1; i++) {
+				(*_normals)[j * _xsamples + i] = osg::Vec3(0.0, 0.0, 1.0);
+			}
+		}
+		return;
+	}
+
+	const FloatArray::value_type *z = &_elevs->front();
+	osg::Vec3 *normals = &_normals->front();
+	unsigned n1 = _xsamples;
+	double d1 = _xstep, d2 = _ystep, nz = 6.0 * d1 * d2;
+	for(unsigned j = j0; j <= j1; j++) {
+		// the borders have fewer triangles around their points
+		if(j == 0 || j == _ysamples - 1) {
+			for(unsigned i = i0; i <= i1; i++) {
+				Vector v = vertexNormal(i, j);
+				normals[j * n1 + i] = osg::Vec3(v.x(), v.y(), v.z());
+			}
+			continue;
+		}
+		if(i0 == 0) {
+			Vector v = vertexNormal(0, j);
+			normals[j * n1] = osg::Vec3(v.x(), v.y(), v.z());
+		}
+		if(i1 == _xsamples - 1) {
+			Vector v = vertexNormal(i1, j);
+			normals[j * n1 + i1] = osg::Vec3(v.x(), v.y(), v.z());
+		}
+
+		// the six triangles around an inner point, summed up
+		unsigned first = max(i0, 1u), last = min(i1, _xsamples - 2);
+		for(unsigned i = first; i <= last; i++) {
+			unsigned o = j * n1 + i;
+			double zw = z[o - 1], ze = z[o + 1];
+			double zs = z[o - n1], zn = z[o + n1];
+			double zsw = z[o - n1 - 1], zne = z[o + n1 + 1];
+			double nx = d2 * (2.0 * (zw - ze) + zn - zne + zsw - zs);
+			double ny = d1 * (2.0 * (zs - zn) + ze - zne + zsw - zw);
+			double len = sqrt(nx * nx + ny * ny + nz * nz);
+			normals[o] = osg::Vec3(nx / len, ny / len, nz / len);
+		}
+	}
+}
+
+Vector GridHeightField::vertexNormal(unsigned i, unsigned j) const
+{
+	double za, zb;
+	unsigned o, a, b, n1, n2;
+	double d1, d2, nx, ny, nz;
+
 	d1 = _xstep;
 	d2 = _ystep;
 	n1 = _xsamples;
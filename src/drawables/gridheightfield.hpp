@@ -31,6 +31,11 @@
  * \brief This file declares the GridHeightField class.
  */
 
+#include <ctime>
+#include <vector>
+
+#include <OpenThreads/Mutex>
+
 #include <heightfield.hpp>
 
 using osg::FloatArray;
@@ -78,15 +83,71 @@ public:
 	/*!
 	 * \brief Loads the heightfield from a data file.
 	 * \param filename The name of the data file.
+	 * \param decimation Only every decimation-th sample is kept.
+	 * \param column The first column of the window read.
+	 * \param line The first line of the window read, from the north.
+	 * \param columns The width of the window, zero to the edge.
+	 * \param lines The height of the window, zero to the edge.
 	 */
-	GridHeightField(const std::string& filename);
+	GridHeightField(const std::string& filename, unsigned decimation = 1,
+				unsigned column = 0, unsigned line = 0,
+					unsigned columns = 0, unsigned lines = 0);
 
 	/*!
 	 * \brief Loads the heightfield from a data file.
+	 *
+	 * A window of the raster is read a strip at a time, decimated by
+	 * GDAL as it reads, so only the samples that are kept are ever in
+	 * memory and the overviews of the file are used. Large elevation
+	 * models should be decimated, or read a window at a time, to keep
+	 * the grid to a size that can be drawn. A file written by save() is
+	 * read as it is, without decimation. Any other file is read by
+	 * GDAL, and the result is written in the native format to the cache
+	 * directory, where it is found the next time unless the file has
+	 * been modified since. The height field is left as it was if the
+	 * file can't be read.
 	 * \param filename The name of the data file.
+	 * \param decimation Only every decimation-th sample is kept.
+	 * \param column The first column of the window read.
+	 * \param line The first line of the window read, from the north.
+	 * \param columns The width of the window, zero to the edge.
+	 * \param lines The height of the window, zero to the edge.
+	 * \return True if succeeded, false otherwise.
+	 */
+	bool load(const std::string& filename, unsigned decimation = 1,
+				unsigned column = 0, unsigned line = 0,
+					unsigned columns = 0, unsigned lines = 0);
+
+	/*!
+	 * \brief Writes the height field to a file in the native format.
+	 *
+	 * The file holds the elevations, the normals and the pyramid of
+	 * extreme elevations just as they are kept in memory, so reading it
+	 * takes a single read for each array and no computing. It is
+	 * written under another name and renamed once complete, so a reader
+	 * never finds only a part of it.
+	 * \param filename The name of the file.
+	 * \param source What the height field was read from, checked when
+	 * the file is read back as a cached conversion.
 	 * \return True if succeeded, false otherwise.
 	 */
-	bool load(const std::string& filename);
+	bool save(const std::string& filename,
+			const std::string& source = std::string()) const;
+
+	/*!
+	 * \brief The directory where the files read by GDAL are cached.
+	 *
+	 * The least recently used conversions are removed when they take
+	 * more than a gigabyte.
+	 * \return The directory, empty if there is no cache.
+	 */
+	static const std::string& cacheDirectory();
+
+	/*!
+	 * \brief Sets the directory where the files read by GDAL are cached.
+	 * \param dir The directory, empty for no cache.
+	 */
+	static void setCacheDirectory(const std::string& dir);
 
 	//! Size of the height field on the x direction
 	double sizeX() const;
@@ -120,6 +181,17 @@ public:
 	 */
 	Vector normal(double x, double y) const;
 
+	/*!
+	 * \brief Samples the height field at many points at once.
+	 *
+	 * The points are located and interpolated a block at a time, in
+	 * loops without branches the compiler can vectorise.
+	 * \sa HeightField::sample
+	 */
+	void sample(unsigned count, const double* xs, const double* ys,
+				double* zs, Vector* normals = 0,
+					Outside outside = ClampOutside) const;
+
 	//! A point on the grid
 	/*!
 	 * \param i The point's index in the x direction
@@ -127,8 +199,10 @@ public:
 	 */
 	Point point(unsigned i, unsigned j) const;
 
-	//! Calculates the normal vector at a grid point
+	//! The normal vector at a grid point
 	/*!
+	 * The normals are kept in a buffer, and only the ones around the
+	 * points changed by setPoint() are computed again.
 	 * \param i The point's index in the x direction
 	 * \param j The point's index in the y direction
 	 */
@@ -142,20 +216,150 @@ public:
 	 */
 	void setPoint(unsigned i, unsigned j, double val);
 
+	/*!
+	 * \brief The extreme elevations of the surface over a rectangle.
+	 *
+	 * The bounds cover every grid cell the rectangle touches.
+	 * \param x0 The smallest x coordinate of the rectangle
+	 * \param y0 The smallest y coordinate of the rectangle
+	 * \param x1 The largest x coordinate of the rectangle
+	 * \param y1 The largest y coordinate of the rectangle
+	 * \param lo Receives the minimum elevation
+	 * \param hi Receives the maximum elevation
+	 * \return False if the rectangle misses the height field.
+	 */
+	bool elevationRange(double x0, double y0, double x1, double y1,
+						double& lo, double& hi) const;
+
+	/*!
+	 * \brief Finds the first point where a ray hits the height field.
+	 * \param start The origin of the ray
+	 * \param dir The direction of the ray
+	 * \param hit Receives the point hit
+	 * \return False if the ray misses the height field.
+	 */
+	bool intersect(const Point& start, const Vector& dir, Point& hit) const;
+
 protected:
 	//! Destructor
 	virtual ~GridHeightField();
 
+	//! The array of elevations, stored row after row
+	/*!
+	 * Writing to it bypasses setPoint(), so the writer must either call
+	 * written() for the points it changed, or call modified() and keep
+	 * the elevation bounds up to date itself.
+	 */
+	FloatArray* elevations();
+
+	//! Takes the points of a rectangle written to elevations()
+	/*!
+	 * Like setPoint() does for a single point, only the normals and the
+	 * nodes of the pyramid around the rectangle are computed again.
+	 * \param i0 The first point's index in the x direction
+	 * \param j0 The first point's index in the y direction
+	 * \param i1 The last point's index in the x direction
+	 * \param j1 The last point's index in the y direction
+	 */
+	void written(unsigned i0, unsigned j0, unsigned i1, unsigned j1);
+
+	//! The normals of the points, stored row after row
+	/*!
+	 * The array is kept and brought up to date in place, only around
+	 * the points changed, so it can be read without computing it all.
+	 */
+	osg::Vec3Array* normals() const;
+
+	//! Reads a file written by save()
+	/*!
+	 * \param filename The name of the file.
+	 * \param source What the file must have been saved from, empty
+	 * for anything.
+	 * \return False if the file is not in the native format, is not of
+	 * the source or is damaged.
+	 */
+	bool readNative(const std::string& filename,
+			const std::string& source = std::string());
+
+	//! Creates the cache directory and its parents, false on failure
+	static bool createCacheDirectory();
+
 private:
+	// points sampled together
+	static const unsigned SampleBlock = 64;
+
+	// one level of the pyramid of extreme elevations
+	struct Level {
+		// number of nodes in each direction
+		unsigned nx, ny;
+		// extreme elevations of the nodes, row after row
+		std::vector<float> lo, hi;
+	};
+
 	// beware, don't check bounds
 	FloatArray::value_type point(unsigned i) const;
 
+	// what a cached conversion is of: the file, when it was modified
+	// and the samples kept
+	static std::string cacheSource(const std::string& filename,
+					time_t mtime, unsigned decimation,
+						unsigned column, unsigned line,
+							unsigned columns, unsigned lines);
+	// the name of the cached conversion of a source
+	static std::string cacheFile(const std::string& source);
+
+	// computes the normals again if the elevations were changed
+	// other than by setPoint(), or just the dirty ones
+	void updateNormals() const;
+	// computes the normals of a rectangle of points
+	void computeNormals(unsigned i0, unsigned j0,
+					unsigned i1, unsigned j1) const;
+	// average normal of the triangles around a point
+	Vector vertexNormal(unsigned i, unsigned j) const;
+
+	// the pyramid, built again if the elevations were changed
+	// other than by setPoint(); the readers of a Dynamic field must
+	// hold its lock, so it is not changed meanwhile
+	const std::vector<Level>& pyramid() const;
+	// builds the whole pyramid
+	void buildPyramid() const;
+	// updates the nodes of some cells and all the nodes above them
+	void updatePyramid(unsigned a0, unsigned b0, unsigned a1, unsigned b1);
+	// finds the nearest hit of a ray inside a node
+	bool intersectNode(unsigned k, unsigned a, unsigned b,
+				const double o[3], const double d[3],
+					double tmin, double tmax, double& t) const;
+	// gathers the extreme elevations of some cells inside a node
+	void rangeNode(unsigned k, unsigned a, unsigned b,
+				unsigned a0, unsigned b0, unsigned a1, unsigned b1,
+					double& lo, double& hi) const;
+	// the box of a node clips the parameters of a ray
+	bool clipNode(unsigned k, unsigned a, unsigned b,
+				const double o[3], const double d[3],
+					double& tmin, double& tmax) const;
+
+	// directory of the converted files
+	static std::string _cache_directory;
+
 	// array of elevations
 	osg::ref_ptr<FloatArray> _elevs;
 	// number of samples
 	unsigned _xsamples, _ysamples;
 	// spacing between samples
 	double _xstep, _ystep;
+	// extreme elevations of the cells, of blocks of 2x2 cells and so
+	// on up to the whole grid
+	mutable std::vector<Level> _pyramid;
+	// revision the pyramid was built for
+	mutable unsigned long _pyramid_revision;
+	// lets a single reader at a time build the pyramid
+	mutable OpenThreads::Mutex _pyramid_mutex;
+	// normals of the points
+	mutable osg::ref_ptr<osg::Vec3Array> _normals;
+	// revision the normals were computed for
+	mutable unsigned long _normals_revision;
+	// rectangle of points whose normals must be computed again
+	mutable unsigned _dirty_i0, _dirty_j0, _dirty_i1, _dirty_j1;
 };
 
 inline GridHeightField::~GridHeightField()
@@ -192,6 +396,21 @@ inline unsigned GridHeightField::numSamplesY() const
 	return _ysamples;
 }
 
+inline const std::string& GridHeightField::cacheDirectory()
+{
+	return _cache_directory;
+}
+
+inline void GridHeightField::setCacheDirectory(const std::string& dir)
+{
+	_cache_directory = dir;
+}
+
+inline FloatArray* GridHeightField::elevations()
+{
+	return _elevs.get();
+}
+
 inline FloatArray::value_type GridHeightField::point(unsigned i) const
 {
 	return (*_elevs)[i];
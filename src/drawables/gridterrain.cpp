@@ -24,22 +24,683 @@
 #endif
 
 #include <cassert>
+#include <ctime>
+#include <cstring>
+#include <limits>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
 
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <utime.h>
+
+#include <osg/TexGen>
+#include <osg/BufferObject>
 #include <osg/Texture2D>
 #include <osg/TexEnvCombine>
-#include <osgDB/ReadFile>
+#include <osgUtil/CullVisitor>
 
 #include <math.hpp>
+#include <cachefile.hpp>
+#include <imagecache.hpp>
+#include <gridmesh.hpp>
+#include <gridfilter.hpp>
 #include <gridterrain.hpp>
  
 using Orbis::Math::sqr;
+using Orbis::Math::max;
+using Orbis::Math::min;
 using Orbis::Math::clamp;
 using Orbis::Math::interpolate;
+using Orbis::Util::Spline;
+using Orbis::Util::GridFilter;
+using Orbis::Util::gridTriangles;
+using Orbis::Drawable::GridTerrain;
+
+// the largest number of quanta a packed coordinate can hold
+static const unsigned MaxQuanta = 32767;
+
+// version of the generators and the filters, written into every recipe
+// so that results computed by older code are not read back
+static const double RecipeVersion = 1.0;
+// largest size of the cached results of the recipes, in bytes
+static const double RecipeCacheSize = 512.0 * 1024.0 * 1024.0;
+// longest recipe kept, a longer one is given up
+static const unsigned RecipeLength = 1024 * 1024;
+
+// a point of a chunk, in cells from its first grid point
+typedef std::pair<unsigned, unsigned> Knot;
+
+// positions 0, stride, 2*stride... along a chunk side of n cells,
+// always ending at n
+static void positions(unsigned n, unsigned stride,
+					std::vector<unsigned>& pos)
+{
+	pos.clear();
+	for(unsigned p = 0; p < n; p += stride) {
+		pos.push_back(p);
+	}
+	pos.push_back(n);
+}
+
+// adds a counter-clockwise triangle
+static void triangle(std::vector<Knot>& knots,
+				const Knot& a, const Knot& b, const Knot& c)
+{
+	long area = (static_cast<long>(b.first) - static_cast<long>(a.first)) *
+			(static_cast<long>(c.second) - static_cast<long>(a.second)) -
+		(static_cast<long>(b.second) - static_cast<long>(a.second)) *
+			(static_cast<long>(c.first) - static_cast<long>(a.first));
+	knots.push_back(a);
+	if(area > 0) {
+		knots.push_back(b);
+		knots.push_back(c);
+	} else {
+		knots.push_back(c);
+		knots.push_back(b);
+	}
+}
+
+// fills the strip between an edge of a chunk and the parallel side of
+// its interior, so that edges of any stride meet the interior's
+static void stitch(std::vector<Knot>& knots, const std::vector<Knot>& outer,
+				const std::vector<Knot>& inner, bool along_x)
+{
+	unsigned a = 0, b = 0;
+	while(a + 1 < outer.size() || b + 1 < inner.size()) {
+		bool advance_outer = b + 1 == inner.size();
+		if(!advance_outer && a + 1 < outer.size()) {
+			unsigned next_outer = along_x ?
+					outer[a+1].first : outer[a+1].second;
+			unsigned next_inner = along_x ?
+					inner[b+1].first : inner[b+1].second;
+			advance_outer = next_outer <= next_inner;
+		}
+		if(advance_outer) {
+			triangle(knots, outer[a], outer[a+1], inner[b]);
+			a++;
+		} else {
+			triangle(knots, outer[a], inner[b+1], inner[b]);
+			b++;
+		}
+	}
+}
+
+// mixes a seed and two integers into 32 random bits
+static unsigned scramble(unsigned long seed, unsigned i, unsigned j)
+{
+	unsigned h = static_cast<unsigned>(seed) * 0x9e3779b1u;
+	h = (h ^ (h >> 16) ^ i) * 0x85ebca6bu;
+	h = (h ^ (h >> 13) ^ j) * 0xc2b2ae35u;
+	h = (h ^ (h >> 16)) * 0x2c1b3c6du;
+	return h ^ (h >> 15);
+}
+
+// a seed for a generator called without one, different at each call
+static unsigned long freshSeed()
+{
+	static unsigned calls = 0;
+	unsigned long seed = scramble(time(0), calls++, 5);
+	return seed != 0 ? seed : 1;
+}
+
+// a random number between -1 and 1 given by a seed and two integers, so
+// that a generator gives the same terrain whatever the number of threads
+static double uniform(unsigned long seed, unsigned i, unsigned j)
+{
+	return (scramble(seed, i, j) & 0xffffffu) / 8388607.5 - 1.0;
+}
+
+/*
+ * A generator that changes the elevations row after row. Each share of
+ * the work keeps the extreme elevations of its rows, so that they are
+ * found while the rows are still in the cache.
+ */
+class RowJob : public Orbis::Util::WorkCrew::Job {
+public:
+	RowJob(float *z, unsigned nx, unsigned ny, unsigned shares)
+		: _z(z), _nx(nx), _ny(ny), _lo(shares), _hi(shares)
+	{
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned first = _ny * index / count;
+		unsigned last = _ny * (index + 1) / count;
+		float lo = std::numeric_limits<float>::max();
+		float hi = -lo;
+		for(unsigned j = first; j < last; j++) {
+			float *row = _z + j * _nx;
+			generate(j, row);
+			for(unsigned i = 0; i < _nx; i++) {
+				lo = min(lo, row[i]);
+				hi = max(hi, row[i]);
+			}
+		}
+		_lo[index] = lo;
+		_hi[index] = hi;
+	}
+
+	// the extreme elevations of the whole grid
+	double lowest() const
+	{
+		return *std::min_element(_lo.begin(), _lo.end());
+	}
+
+	double highest() const
+	{
+		return *std::max_element(_hi.begin(), _hi.end());
+	}
+
+protected:
+	// changes the elevations of a row
+	virtual void generate(unsigned j, float *row) = 0;
+
+	float *_z;
+	unsigned _nx, _ny;
+
+private:
+	std::vector<float> _lo, _hi;
+};
+
+/*
+ * Raises the samples on one side of each fault and lowers the others.
+ * Along a row a fault is a single crossing, so the faults are counted
+ * with a difference array and each row costs faults + samples instead
+ * of faults * samples.
+ */
+class FaultJob : public RowJob {
+public:
+	FaultJob(float *z, unsigned nx, unsigned ny, unsigned shares,
+				double x0, double y0, double dx, double dy,
+					unsigned iters, unsigned long seed)
+		: RowJob(z, nx, ny, shares), _x0(x0), _y0(y0), _dx(dx), _dy(dy),
+			_a(iters), _b(iters), _c(iters)
+	{
+		// the faults cross a circle around the centre of the grid
+		double cx = x0 + 0.5 * (nx - 1) * dx;
+		double cy = y0 + 0.5 * (ny - 1) * dy;
+		double d = 0.5 * sqrt(sqr((nx - 1) * dx) + sqr((ny - 1) * dy));
+		for(unsigned f = 0; f < iters; f++) {
+			double v = Orbis::Math::Pi * uniform(seed, f, 0);
+			_a[f] = sin(v);
+			_b[f] = cos(v);
+			_c[f] = _a[f] * cx + _b[f] * cy + d * uniform(seed, f, 1);
+		}
+	}
+
+protected:
+	void generate(unsigned j, float *row)
+	{
+		// how many faults start or stop raising the row at each sample
+		std::vector<int> ups(_nx + 1, 0);
+		double y = _y0 + j * _dy;
+		for(unsigned f = 0; f < _a.size(); f++) {
+			// a sample is raised when a*x + b*y - c > 0
+			double t = _c[f] - _b[f] * y;
+			double n = _nx, first = 0.0, last = 0.0;
+			if(_a[f] == 0.0) {
+				last = t < 0.0 ? n : 0.0;
+			} else {
+				// the sample where the fault crosses the row
+				double q = (t / _a[f] - _x0) / _dx;
+				if(_a[f] > 0.0) {
+					first = clamp(floor(q) + 1.0, 0.0, n);
+					last = n;
+				} else {
+					last = clamp(ceil(q), 0.0, n);
+				}
+			}
+			ups[static_cast<unsigned>(first)]++;
+			ups[static_cast<unsigned>(last)]--;
+		}
+		int raised = 0, faults = _a.size();
+		for(unsigned i = 0; i < _nx; i++) {
+			raised += ups[i];
+			row[i] += 0.7f * (2 * raised - faults);
+		}
+	}
+
+private:
+	double _x0, _y0, _dx, _dy;
+	// the faults, a*x + b*y = c
+	std::vector<double> _a, _b, _c;
+};
+
+/*
+ * One pass of the diamond-square algorithm over a grid of square blocks
+ * of 2^n+1 samples on a side, side by side. The squares are averaged
+ * across the borders of the blocks, so they join seamlessly. All the
+ * samples written by a pass depend only on the ones written by the
+ * previous passes, so its rows can be split among threads.
+ */
+class DiamondSquareJob : public Orbis::Util::WorkCrew::Job {
+public:
+	DiamondSquareJob(std::vector<float>& h, unsigned width,
+					unsigned height, unsigned long seed)
+		: _h(h), _width(width), _height(height), _seed(seed), _step(0),
+			_diamonds(true), _scale(0.0)
+	{
+	}
+
+	// the next pass, either the diamonds or the squares of a step
+	void setPass(unsigned step, bool diamonds, double scale)
+	{
+		_step = step;
+		_diamonds = diamonds;
+		_scale = scale;
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned half = _step / 2;
+		unsigned n = _width - 1, m = _height - 1;
+		// the diamond centres are at odd multiples of half, the
+		// square ones alternate between odd and even
+		unsigned rows = _diamonds ? m / _step : m / half + 1;
+		unsigned first = rows * index / count;
+		unsigned last = rows * (index + 1) / count;
+		for(unsigned r = first; r < last; r++) {
+			unsigned y = _diamonds ? half + r * _step : r * half;
+			unsigned x = (_diamonds || r % 2 == 0) ? half : 0;
+			for(; x <= n; x += _step) {
+				float sum = 0.0f;
+				unsigned k = 0;
+				if(_diamonds) {
+					sum = at(x - half, y - half) + at(x + half, y - half) +
+						at(x - half, y + half) + at(x + half, y + half);
+					k = 4;
+				} else {
+					if(x >= half) { sum += at(x - half, y); k++; }
+					if(x + half <= n) { sum += at(x + half, y); k++; }
+					if(y >= half) { sum += at(x, y - half); k++; }
+					if(y + half <= m) { sum += at(x, y + half); k++; }
+				}
+				at(x, y) = sum / k + _scale * uniform(_seed, x, y);
+			}
+		}
+	}
+
+private:
+	float& at(unsigned x, unsigned y)
+	{
+		return _h[y * _width + x];
+	}
+
+	std::vector<float>& _h;
+	unsigned _width, _height;
+	unsigned long _seed;
+	unsigned _step;
+	bool _diamonds;
+	double _scale;
+};
+
+// adds the lower left corner of a larger grid to the elevations
+class AddJob : public RowJob {
+public:
+	AddJob(float *z, unsigned nx, unsigned ny, unsigned shares,
+				const std::vector<float>& h, unsigned size)
+		: RowJob(z, nx, ny, shares), _h(h), _size(size)
+	{
+	}
+
+protected:
+	void generate(unsigned j, float *row)
+	{
+		const float *src = &_h[j * _size];
+		for(unsigned i = 0; i < _nx; i++) {
+			row[i] += src[i];
+		}
+	}
+
+private:
+	const std::vector<float>& _h;
+	unsigned _size;
+};
+
+/*
+ * Sums octaves of gradient noise. The gradients sit at the integer
+ * points, picked by a permutation of 256 numbers shuffled by the seed.
+ * Along a row they are looked up once for each unit square, and the
+ * samples inside the square are then a plain loop of arithmetic.
+ */
+class NoiseJob : public RowJob {
+public:
+	NoiseJob(float *z, unsigned nx, unsigned ny, unsigned shares,
+			double dx, double dy, double amplitude, double wavelength,
+			unsigned octaves, double persistence, unsigned long seed)
+		: RowJob(z, nx, ny, shares), _dx(dx), _dy(dy),
+			_amplitude(amplitude), _wavelength(wavelength),
+			_octaves(octaves), _persistence(persistence), _seed(seed)
+	{
+		for(unsigned k = 0; k < 256; k++) {
+			_perm[k] = k;
+		}
+		for(unsigned k = 255; k > 0; k--) {
+			std::swap(_perm[k], _perm[scramble(seed, k, 2) % (k + 1)]);
+		}
+		for(unsigned k = 0; k < 256; k++) {
+			_perm[k + 256] = _perm[k];
+		}
+	}
+
+protected:
+	void generate(unsigned j, float *row)
+	{
+		double amplitude = _amplitude;
+		double frequency = 1.0 / _wavelength;
+		for(unsigned o = 0; o < _octaves; o++) {
+			// each octave is shifted, so that they don't all have
+			// a zero at the origin
+			double sx = 128.0 * (uniform(_seed, o, 3) + 1.0);
+			double sy = 128.0 * (uniform(_seed, o, 4) + 1.0);
+			// what only depends on the row
+			double y = j * _dy * frequency + sy;
+			double fy = floor(y);
+			unsigned yi = static_cast<unsigned>(fy) & 255;
+			y -= fy;
+			double v = fade(y);
+			double step = _dx * frequency;
+			unsigned i = 0;
+			while(i < _nx) {
+				// the gradients at the corners of the square
+				double fx = floor(i * step + sx);
+				unsigned xi = static_cast<unsigned>(fx) & 255;
+				unsigned a = _perm[xi] + yi, b = _perm[xi + 1] + yi;
+				unsigned ha = _perm[a] & 7, hb = _perm[b] & 7;
+				unsigned hc = _perm[a + 1] & 7, hd = _perm[b + 1] & 7;
+				double ax = GradX[ha], ay = GradY[ha] * y;
+				double bx = GradX[hb], by = GradY[hb] * y;
+				double cx = GradX[hc], cy = GradY[hc] * (y - 1.0);
+				double dx = GradX[hd], dy = GradY[hd] * (y - 1.0);
+
+				// the samples inside it
+				unsigned end = static_cast<unsigned>(
+					max(ceil((fx + 1.0 - sx) / step), i + 1.0));
+				end = min(end, _nx);
+				for(; i < end; i++) {
+					double x = i * step + sx - fx;
+					double u = fade(x);
+					double s = ax * x + ay;
+					s += u * (bx * (x - 1.0) + by - s);
+					double t = cx * x + cy;
+					t += u * (dx * (x - 1.0) + dy - t);
+					row[i] += amplitude * (s + v * (t - s));
+				}
+			}
+			amplitude *= _persistence;
+			frequency *= 2.0;
+		}
+	}
+
+private:
+	// the smooth step between the integer points
+	static double fade(double t)
+	{
+		return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);
+	}
+
+	// the eight gradients
+	static const double GradX[8], GradY[8];
+
+	double _dx, _dy;
+	double _amplitude, _wavelength;
+	unsigned _octaves;
+	double _persistence;
+	unsigned long _seed;
+	unsigned _perm[512];
+};
+
+const double NoiseJob::GradX[8] =
+			{ 1.0, -1.0, 1.0, -1.0, 1.0, -1.0, 0.0, 0.0 };
+const double NoiseJob::GradY[8] =
+			{ 1.0, 1.0, -1.0, -1.0, 0.0, 0.0, 1.0, -1.0 };
+
+/*
+ * Stamps a cross-section along a polyline. Each sample takes the profile
+ * at its distance from the nearest segment, and only the rows and
+ * columns within the radius of a segment are visited, so the rows of the
+ * box around the path are split among the threads.
+ */
+class StampJob : public Orbis::Util::WorkCrew::Job {
+public:
+	StampJob(float *z, unsigned nx, double x0, double y0,
+			double dx, double dy, unsigned i0, unsigned j0,
+				unsigned i1, unsigned j1,
+			const std::vector<Point>& path, double radius,
+			double height, GridTerrain::StampShape shape,
+					GridTerrain::StampMode mode)
+		: _z(z), _nx(nx), _x0(x0), _y0(y0), _dx(dx), _dy(dy),
+			_i0(i0), _j0(j0), _i1(i1), _j1(j1), _path(path),
+			_radius(radius), _height(height), _shape(shape), _mode(mode)
+	{
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned rows = _j1 - _j0 + 1;
+		unsigned first = _j0 + rows * index / count;
+		unsigned last = _j0 + rows * (index + 1) / count;
+		double r2 = sqr(_radius);
+		// the nearest squared distance to the path and the base
+		// elevation there, for each column of the box
+		std::vector<double> near(_i1 - _i0 + 1), base(_i1 - _i0 + 1);
+		for(unsigned j = first; j < last; j++) {
+			double y = _y0 + j * _dy;
+			std::fill(near.begin(), near.end(), r2);
+			unsigned segments = max<unsigned>(_path.size(), 2) - 1;
+			for(unsigned s = 0; s < segments; s++) {
+				const Point& a = _path[s];
+				const Point& b = _path[min<unsigned>(s + 1,
+							_path.size() - 1)];
+				if(y < min(a.y(), b.y()) - _radius ||
+						y > max(a.y(), b.y()) + _radius) {
+					continue;
+				}
+				double ex = b.x() - a.x(), ey = b.y() - a.y();
+				double e2 = sqr(ex) + sqr(ey);
+				int lo = static_cast<int>(ceil((min(a.x(), b.x()) -
+							_radius - _x0) / _dx));
+				int hi = static_cast<int>(floor((max(a.x(), b.x()) +
+							_radius - _x0) / _dx));
+				lo = max(lo, static_cast<int>(_i0));
+				hi = min(hi, static_cast<int>(_i1));
+				for(int i = lo; i <= hi; i++) {
+					double px = _x0 + i * _dx - a.x(), py = y - a.y();
+					double t = e2 > 0.0 ?
+						clamp((px * ex + py * ey) / e2, 0.0, 1.0) : 0.0;
+					double d2 = sqr(px - t * ex) + sqr(py - t * ey);
+					if(d2 < near[i - _i0]) {
+						near[i - _i0] = d2;
+						base[i - _i0] = a.z() + t * (b.z() - a.z());
+					}
+				}
+			}
+			float *row = _z + j * _nx;
+			for(unsigned i = _i0; i <= _i1; i++) {
+				double d2 = near[i - _i0];
+				if(d2 >= r2) {
+					continue;
+				}
+				double h = _height * profile(d2 / r2);
+				switch(_mode) {
+					case GridTerrain::Lower:
+						row[i] = min<double>(row[i], base[i - _i0] + h);
+						break;
+					case GridTerrain::Raise:
+						row[i] = max<double>(row[i], base[i - _i0] + h);
+						break;
+					default:
+						row[i] += h;
+				}
+			}
+		}
+	}
+
+private:
+	// the cross-section at a squared distance, over the squared radius
+	double profile(double d2) const
+	{
+		switch(_shape) {
+			case GridTerrain::Gaussian:
+				return (exp(-4.5 * d2) - exp(-4.5)) / (1.0 - exp(-4.5));
+			case GridTerrain::Plateau: {
+				double t = clamp(2.0 * sqrt(d2) - 1.0, 0.0, 1.0);
+				return 1.0 - t * t * (3.0 - 2.0 * t);
+			}
+			default:
+				return 1.0 - d2;
+		}
+	}
+
+	float *_z;
+	unsigned _nx;
+	double _x0, _y0, _dx, _dy;
+	// the box around the path
+	unsigned _i0, _j0, _i1, _j1;
+	const std::vector<Point>& _path;
+	double _radius, _height;
+	GridTerrain::StampShape _shape;
+	GridTerrain::StampMode _mode;
+};
+
+// the weight of a patch texture over the ones under it
+static const float SplatBlend = 0.2f;
+
+// a patch texture and the texels of the splat inside the patch
+struct SplatLayer {
+	osg::ref_ptr<const osg::Image> image;
+	double minx, maxx, miny, maxy;
+	// the runs of texels, row after row
+	std::vector<Orbis::Util::Span> spans;
+	// the first run of each row, and one past the last row
+	std::vector<unsigned> rows;
+};
+
+// the colour of an image at texture coordinates, filtered bilinearly
+static void texel(const osg::Image& img, double s, double t, float *rgb)
+{
+	unsigned n = osg::Image::computeNumComponents(img.getPixelFormat());
+	double x = clamp(s * img.s() - 0.5, 0.0, img.s() - 1.0);
+	double y = clamp(t * img.t() - 0.5, 0.0, img.t() - 1.0);
+	int i = static_cast<int>(x), j = static_cast<int>(y);
+	int i1 = min(i + 1, img.s() - 1), j1 = min(j + 1, img.t() - 1);
+	float u = x - i, v = y - j;
+	const unsigned char *p00 = img.data(i, j), *p10 = img.data(i1, j);
+	const unsigned char *p01 = img.data(i, j1), *p11 = img.data(i1, j1);
+	for(unsigned c = 0; c < 3; c++) {
+		// grey images have a single channel
+		unsigned k = n < 3 ? 0 : c;
+		rgb[c] = ((1.0f - v) * ((1.0f - u) * p00[k] + u * p10[k]) +
+				v * ((1.0f - u) * p01[k] + u * p11[k])) / 255.0f;
+	}
+}
+
+/*
+ * Composites the patch textures, in order, into the rows of the splat.
+ * Each layer blends its texture over the ones under it inside its patch
+ * and black outside, so every layer darkens the terrain around it, as
+ * the texture units of old did. The coverage is then the same all over,
+ * and goes to the alpha channel; the colour is summed premultiplied by
+ * it, each layer weighted by the ones above, and stored divided by it.
+ */
+class SplatJob : public Orbis::Util::WorkCrew::Job {
+public:
+	SplatJob(const std::vector<SplatLayer>& layers, osg::Image& splat,
+				double x0, double y0, double dx, double dy)
+		: _layers(layers), _splat(splat), _x0(x0), _y0(y0),
+			_dx(dx), _dy(dy), _weights(layers.size()), _alpha(1.0f)
+	{
+		for(unsigned l = layers.size(); l-- > 0; ) {
+			_weights[l] = SplatBlend * _alpha;
+			_alpha *= 1.0f - SplatBlend;
+		}
+		_alpha = 1.0f - _alpha;
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned w = _splat.s();
+		unsigned first = _splat.t() * index / count;
+		unsigned last = _splat.t() * (index + 1) / count;
+		std::vector<float> colour(3 * w);
+		for(unsigned j = first; j < last; j++) {
+			std::fill(colour.begin(), colour.end(), 0.0f);
+			double y = j * _dy + _y0;
+			for(unsigned l = 0; l < _layers.size(); l++) {
+				const SplatLayer& layer = _layers[l];
+				double t = interpolate(y, layer.miny, layer.maxy);
+				for(unsigned k = layer.rows[j]; k < layer.rows[j+1]; k++) {
+					const Orbis::Util::Span& span = layer.spans[k];
+					for(unsigned i = span.first; i < span.last; i++) {
+						double s = interpolate(i * _dx + _x0,
+									layer.minx, layer.maxx);
+						float rgb[3];
+						texel(*layer.image, s, t, rgb);
+						for(unsigned c = 0; c < 3; c++) {
+							colour[3*i+c] += _weights[l] * rgb[c];
+						}
+					}
+				}
+			}
+			unsigned char *out = _splat.data(0, j);
+			for(unsigned i = 0; i < w; i++) {
+				for(unsigned c = 0; c < 3; c++) {
+					out[4*i+c] = static_cast<unsigned char>(
+						255.0f * colour[3*i+c] / _alpha + 0.5f);
+				}
+				out[4*i+3] = static_cast<unsigned char>(
+								255.0f * _alpha + 0.5f);
+			}
+		}
+	}
+
+private:
+	const std::vector<SplatLayer>& _layers;
+	osg::Image& _splat;
+	double _x0, _y0, _dx, _dy;
+	// the share of each layer in the final colour
+	std::vector<float> _weights;
+	// the coverage of all the layers together
+	float _alpha;
+};
+
+// extends a recipe with a line of an operation and its parameters, in
+// full precision
+static void describe(std::string& recipe, const char* op,
+					const double* params, unsigned count)
+{
+	std::ostringstream line;
+	line << std::setprecision(17) << op;
+	for(unsigned k = 0; k < count; k++) {
+		line << ' ' << params[k];
+	}
+	line << '\n';
+	recipe += line.str();
+}
+
+// the sdbm hash of a string, to go with FNV-1a in the name of a file
+static unsigned sdbm(const std::string& s)
+{
+	unsigned value = 0;
+	for(unsigned k = 0; k < s.size(); k++) {
+		unsigned char c = s[k];
+		value = c + (value << 6) + (value << 16) - value;
+	}
+
+	return value;
+}
 
 namespace Orbis {
 
 	namespace Drawable {
 
+GridTerrain::Buffers::Buffers()
+	: vertices(0), indices(0), vertices_serial(0), indices_serial(0)
+{
+}
+
 GridTerrain::UpdateCallback::UpdateCallback()
 	: osg::Drawable::UpdateCallback(), _init(false)
 {
@@ -54,197 +715,1194 @@ void GridTerrain::UpdateCallback::dirtyLists()
 void GridTerrain::UpdateCallback::update(osg::NodeVisitor* nv,
 			 							osg::Drawable* drawable)
 {
+	Orbis::Drawable::GridTerrain *hf =
+		   dynamic_cast<Orbis::Drawable::GridTerrain*>(drawable);
+	assert(hf);
+
+	// the elevations drawn are final, for now
+	hf->saveRecipe();
+
+	// the arrays are kept, only the changed points are written again
 	if(_init) {
+		hf->updateArrays();
 		return;
 	}
 	_init = true;
 
-	Orbis::Drawable::GridTerrain *hf =
-		   dynamic_cast<Orbis::Drawable::GridTerrain*>(drawable);
-	assert(hf);
+	// the grid is drawn from its own arrays, packed from the elevations
+	// and the normals the height field keeps up to date
+	hf->buildChunks();
+	hf->_arrays_revision = hf->revision();
+	hf->_changed_i0 = hf->_changed_j0 = 1;
+	hf->_changed_i1 = hf->_changed_j1 = 0;
 
-	// creating geometry's vertex arrays
-	osg::Vec2Array *tex = new osg::Vec2Array;
-	osg::Vec3Array *verts = new osg::Vec3Array;
-	osg::Vec3Array *norms = new osg::Vec3Array;
-	osg::Vec3Array *colors = new osg::Vec3Array;
-	colors->push_back(osg::Vec3(0.7, 0.7, 0.5));
-	for(unsigned j = 0; j < hf->numSamplesY(); j++) {
-		for(unsigned i = 0; i < hf->numSamplesX(); i++) {
-			Point p = hf->point(i, j);
-			Vector n = hf->normal(i, j);
-			double s = static_cast<double>(i) / (hf->numSamplesX() - 1);
-			double t = static_cast<double>(j) / (hf->numSamplesY() - 1);
-			tex->push_back(osg::Vec2(s, t));
-			verts->push_back(osg::Vec3(p.x(), p.y(), p.z()));
-			norms->push_back(osg::Vec3(n.x(), n.y(), n.z()));
-		}
-	}
-	hf->setVertexArray(verts);
-	hf->setNormalArray(norms);
-	hf->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
-	hf->setColorArray(colors);
-	hf->setColorBinding(osg::Geometry::BIND_OVERALL);
-	hf->setTexCoordArray(0, tex);
-
-	// now specifying indices
-	for(unsigned j = 0; j < hf->numSamplesY() - 1; j++) {
-		osg::VectorUInt *indices = new osg::VectorUInt;
-		for(unsigned i = 0; i < hf->numSamplesX(); i++) {
-			indices->push_back((j+1) * hf->numSamplesX() + i);
-			indices->push_back(j     * hf->numSamplesX() + i);
-		}
-		hf->addPrimitiveSet(new osg::DrawElementsUInt(
-						    osg::PrimitiveSet::TRIANGLE_STRIP,
-					    		indices->begin(), indices->end()));
-	}
-
-	// if the terrain doesn't have any patches, we're done
-	if(hf->patches() == hf->patchesEnd()) {
-		return;
-	}
-
-	// the magic of multitexturing
-	unsigned u = 1;
-	for(PatchListIterator it = hf->patches();
-				 			it != hf->patchesEnd(); u++, it++) {
-		// no texture, no deal
-		osg::Image *img = osgDB::readImageFile(it->attribute("texture"));
-		if(!img) {
-			continue;
-		}
+	// the texture coordinates are generated from the vertices, the
+	// splat has its own
+	hf->setTexturePlanes(0, hf->origin().x(), hf->origin().y(),
+				(hf->numSamplesX() - 1) * hf->stepX(),
+				(hf->numSamplesY() - 1) * hf->stepY());
+	// the normals are scaled with the packed vertices
+	osg::StateSet *ss = hf->getOrCreateStateSet();
+	ss->setMode(GL_NORMALIZE, osg::StateAttribute::ON);
 
-		// gathering coordinates
-		osg::Vec2Array *mtex = new osg::Vec2Array;
-		for(unsigned j = 0; j < hf->numSamplesY(); j++) {
-			for(unsigned i = 0; i < hf->numSamplesX(); i++) {
-				Point p = hf->point(i, j);
-				if(it->contains(p)) {
-					double x = interpolate(p.x(), it->minX(), it->maxX());
-					double y = interpolate(p.y(), it->minY(), it->maxY());
-					mtex->push_back(osg::Vec2(x, y));
-				} else {
-					mtex->push_back(osg::Vec2(-1.0, -1.0));
-				}
-			}
-		}
-
-		osg::StateSet *ss = hf->getOrCreateStateSet();
+	// the arrays are kept in buffer objects, sent again only where
+	// they change
+	hf->setUseDisplayList(false);
 
-		// setting up new texture
-		hf->setTexCoordArray(u, mtex);
-		osg::Texture2D *tex = new osg::Texture2D;
-		tex->setImage(img);
-		tex->setBorderColor(osg::Vec4(0.0, 0.0, 0.0, 1.0));
-		tex->setInternalFormatMode(osg::Texture2D::USE_ARB_COMPRESSION);
-		tex->setWrap(osg::Texture2D::WRAP_S, osg::Texture2D::CLAMP_TO_BORDER);
-		tex->setWrap(osg::Texture2D::WRAP_T, osg::Texture2D::CLAMP_TO_BORDER);
-		ss->setTextureAttributeAndModes(u, tex, osg::StateAttribute::ON);
+	// the textures of the patches are baked into one
+	hf->bakePatches();
+}
 
-		// making a nice blend of the two textures
-		osg::TexEnvCombine *tex_env = new osg::TexEnvCombine;
-		tex_env->setCombine_RGB(osg::TexEnvCombine::INTERPOLATE);
-		tex_env->setSource0_RGB(osg::TexEnvCombine::TEXTURE);
-		tex_env->setOperand0_RGB(osg::TexEnvCombine::SRC_COLOR);
-		tex_env->setSource1_RGB(osg::TexEnvCombine::PREVIOUS);
-		tex_env->setOperand1_RGB(osg::TexEnvCombine::SRC_COLOR);
-		tex_env->setSource2_RGB(osg::TexEnvCombine::CONSTANT);
-		tex_env->setOperand2_RGB(osg::TexEnvCombine::SRC_COLOR);
-		tex_env->setConstantColor(osg::Vec4(0.2, 0.2, 0.2, 0.0));
-		ss->setTextureAttributeAndModes(u, tex_env, osg::StateAttribute::ON);
+// I use this callback to choose the level of detail of each chunk
+bool GridTerrain::CullCallback::cull(osg::NodeVisitor* nv,
+				osg::Drawable* drawable, osg::State*) const
+{
+	GridTerrain *terrain = dynamic_cast<GridTerrain*>(drawable);
+	osgUtil::CullVisitor *cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+	if(!terrain || !cv || terrain->_chunks.empty() ||
+					terrain->lodError() <= 0.0) {
+		return false;
+	}
 
+	osg::RefMatrix *projection = cv->getProjectionMatrix();
+	osg::Viewport *viewport = cv->getViewport();
+	if(!projection || !viewport) {
+		return false;
 	}
+	// how many pixels an angle of one radian spans at the screen centre
+	double pixels = 0.5 * viewport->height() * (*projection)(1, 1);
+	terrain->selectLevels(cv->getEyeLocal(), pixels);
+
+	return false;
 }
 
 GridTerrain::GridTerrain()
-	: Terrain(), GridHeightField()
+	: Terrain(), GridHeightField(), _lod_error(0.0), _splat_size(1024),
+		_chunks_x(0), _chunks_y(0), _quanta(1), _zoff(0.0),
+		_packed_serial(0), _tris_serial(0), _packed_j0(1), _packed_j1(0),
+		_tex_units(0), _arrays_revision(0), _changed_i0(1), _changed_j0(1),
+		_changed_i1(0), _changed_j1(0), _cache_results(false),
+		_recipe_pending(false)
 {
 	setUpdateCallback(new GridTerrain::UpdateCallback);
+	setCullCallback(new GridTerrain::CullCallback);
+	startRecipe("empty", 0, 0);
 }
 
 GridTerrain::GridTerrain(const GridTerrain& src,
 					const osg::CopyOp& copyOp)
-	: Terrain(src, copyOp), GridHeightField(src, copyOp)
+	: Terrain(src, copyOp), GridHeightField(src, copyOp),
+		_lod_error(src._lod_error), _splat_size(src._splat_size),
+		_chunks_x(0), _chunks_y(0), _quanta(1), _zoff(0.0),
+		_packed_serial(0), _tris_serial(0), _packed_j0(1), _packed_j1(0),
+		_tex_units(0), _arrays_revision(0), _changed_i0(1), _changed_j0(1),
+		_changed_i1(0), _changed_j1(0), _cache_results(src._cache_results),
+		_recipe(src._recipe), _recipe_valid(src._recipe_valid &&
+					src._recipe_revision == src.revision()),
+		_recipe_revision(revision()), _recipe_pending(false)
 {
 	setUpdateCallback(new GridTerrain::UpdateCallback);
+	setCullCallback(new GridTerrain::CullCallback);
+	_crew.resize(src._crew.size());
 }
 
 GridTerrain::GridTerrain(const Point& origin, double xstep, double ystep,
 					unsigned xsize, unsigned ysize)
-	: Terrain(), GridHeightField(origin, xstep, ystep, xsize, ysize)
+	: Terrain(), GridHeightField(origin, xstep, ystep, xsize, ysize),
+		_lod_error(0.0), _splat_size(1024), _chunks_x(0), _chunks_y(0),
+		_quanta(1), _zoff(0.0), _packed_serial(0), _tris_serial(0),
+		_packed_j0(1), _packed_j1(0), _tex_units(0), _arrays_revision(0),
+		_changed_i0(1), _changed_j0(1), _changed_i1(0), _changed_j1(0),
+		_cache_results(false), _recipe_pending(false)
 {
 	setUpdateCallback(new GridTerrain::UpdateCallback);
+	setCullCallback(new GridTerrain::CullCallback);
+	double params[] = { origin.x(), origin.y(), origin.z(), xstep, ystep,
+			static_cast<double>(xsize), static_cast<double>(ysize) };
+	startRecipe("grid", params, 7);
 }
 
-GridTerrain::GridTerrain(const std::string& filename)
-:	Terrain(), GridHeightField(filename)
+GridTerrain::GridTerrain(const std::string& filename, unsigned decimation,
+				unsigned column, unsigned line,
+					unsigned columns, unsigned lines)
+:	Terrain(),
+		GridHeightField(filename, decimation, column, line, columns, lines),
+		_lod_error(0.0), _splat_size(1024), _chunks_x(0), _chunks_y(0),
+		_quanta(1), _zoff(0.0), _packed_serial(0), _tris_serial(0),
+		_packed_j0(1), _packed_j1(0), _tex_units(0), _arrays_revision(0),
+		_changed_i0(1), _changed_j0(1), _changed_i1(0), _changed_j1(0),
+		_cache_results(false), _recipe_pending(false)
 {
 	setUpdateCallback(new GridTerrain::UpdateCallback);
+	setCullCallback(new GridTerrain::CullCallback);
+	// the same file, unless it has been modified since
+	struct stat st;
+	double mtime = stat(filename.c_str(), &st) == 0 ? st.st_mtime : 0;
+	double params[] = { mtime, static_cast<double>(decimation),
+			static_cast<double>(column), static_cast<double>(line),
+			static_cast<double>(columns), static_cast<double>(lines) };
+	startRecipe(filename.c_str(), params, 6);
 }
 
-void GridTerrain::faultLineGeneration(unsigned iters)
-{
-	srand(time(0));
-	double d = sqrt(sqr(sizeX()) + sqr(sizeY()));
-	for(unsigned i = 0; i < iters; i++) {
-		double v = rand();
-		double a = sin(v);
-		double b = cos(v);
-		double c = (rand() / (double)RAND_MAX) * d - d/2;
-		for(unsigned j = 0; j < numSamplesX(); j++) {
-			for(unsigned k = 0; k < numSamplesY(); k++) {
-				Point p = point(j, k);
-				if(a*p.x() + b*p.y() - c > 0.0) {
-					setPoint(j, k, p.z()+0.7);
-				} else {
-					setPoint(j, k, p.z()-0.7);
-				}
+GridTerrain::~GridTerrain()
+{
+	// a result that was never drawn is kept all the same
+	saveRecipe();
+}
+
+void GridTerrain::setPoint(unsigned i, unsigned j, double val)
+{
+	saveRecipe();
+	bool current = _arrays_revision == revision();
+	_recipe_valid = _recipe_valid && _recipe_revision == revision();
+
+	GridHeightField::setPoint(i, j, val);
+
+	if(_recipe_valid) {
+		double params[] = { static_cast<double>(i),
+						static_cast<double>(j), val };
+		describe(_recipe, "setPoint", params, 3);
+		_recipe_valid = _recipe.size() <= RecipeLength;
+		_recipe_revision = revision();
+	}
+
+	// only the arrays around the point are wrong now
+	changed(current, i, j, i, j);
+}
+
+void GridTerrain::stamp(const Point& centre, double radius, double height,
+					StampShape shape, StampMode mode)
+{
+	double params[] = { centre.x(), centre.y(), centre.z(), radius,
+			height, static_cast<double>(shape),
+					static_cast<double>(mode) };
+	bool recorded = record("stamp", params, 7);
+
+	carve(std::vector<Point>(1, centre), radius, height, shape, mode);
+
+	if(recorded) {
+		_recipe_revision = revision();
+	}
+}
+
+void GridTerrain::sweep(const Spline& path, double radius, double height,
+					StampShape shape, StampMode mode)
+{
+	if(path.size() == 0) {
+		return;
+	}
+
+	std::vector<double> params;
+	params.push_back(radius);
+	params.push_back(height);
+	params.push_back(static_cast<double>(shape));
+	params.push_back(static_cast<double>(mode));
+	params.push_back(static_cast<double>(path.subDivs()));
+	for(unsigned k = 0; k < path.size(); k++) {
+		params.push_back(path[k].x());
+		params.push_back(path[k].y());
+		params.push_back(path[k].z());
+	}
+	bool recorded = record("sweep", &params[0], params.size());
+
+	// the spline evaluates itself in a buffer of its own
+	Spline curve(path);
+	std::vector<Point> points;
+	if(path.size() < 2 || path.subDivs() < 1) {
+		for(unsigned k = 0; k < path.size(); k++) {
+			points.push_back(path[k]);
+		}
+	} else {
+		for(int k = 0; k <= path.subDivs(); k++) {
+			points.push_back(curve.pointOnSpline(k));
+		}
+		// the base elevation goes along the length of the path
+		std::vector<double> length(points.size(), 0.0);
+		for(unsigned k = 1; k < points.size(); k++) {
+			length[k] = length[k-1] + sqrt(
+					sqr(points[k].x() - points[k-1].x()) +
+					sqr(points[k].y() - points[k-1].y()));
+		}
+		double z0 = path[0].z(), z1 = path[path.size() - 1].z();
+		for(unsigned k = 0; k < points.size(); k++) {
+			double t = length.back() > 0.0 ?
+					length[k] / length.back() : 0.0;
+			points[k] = Point(points[k].x(), points[k].y(),
+							z0 + t * (z1 - z0));
+		}
+	}
+
+	carve(points, radius, height, shape, mode);
+
+	if(recorded) {
+		_recipe_revision = revision();
+	}
+}
+
+void GridTerrain::carve(const std::vector<Point>& path, double radius,
+				double height, StampShape shape, StampMode mode)
+{
+	if(numSamplesX() == 0 || numSamplesY() == 0 || path.empty() ||
+								radius <= 0.0) {
+		return;
+	}
+
+	// the box of points within the radius of the path
+	double x0 = path[0].x(), x1 = x0, y0 = path[0].y(), y1 = y0;
+	for(unsigned k = 1; k < path.size(); k++) {
+		x0 = min(x0, path[k].x());
+		x1 = max(x1, path[k].x());
+		y0 = min(y0, path[k].y());
+		y1 = max(y1, path[k].y());
+	}
+	double i0 = max(ceil((x0 - radius - origin().x()) / stepX()), 0.0);
+	double j0 = max(ceil((y0 - radius - origin().y()) / stepY()), 0.0);
+	double i1 = min(floor((x1 + radius - origin().x()) / stepX()),
+						numSamplesX() - 1.0);
+	double j1 = min(floor((y1 + radius - origin().y()) / stepY()),
+						numSamplesY() - 1.0);
+	if(i0 > i1 || j0 > j1) {
+		return;
+	}
+	unsigned a0 = static_cast<unsigned>(i0);
+	unsigned b0 = static_cast<unsigned>(j0);
+	unsigned a1 = static_cast<unsigned>(i1);
+	unsigned b1 = static_cast<unsigned>(j1);
+
+	bool current = _arrays_revision == revision();
+	StampJob job(&elevations()->front(), numSamplesX(),
+			origin().x(), origin().y(), stepX(), stepY(),
+			a0, b0, a1, b1, path, radius, height, shape, mode);
+	_crew.run(job);
+	written(a0, b0, a1, b1);
+	changed(current, a0, b0, a1, b1);
+}
+
+void GridTerrain::changed(bool current, unsigned i0, unsigned j0,
+						unsigned i1, unsigned j1)
+{
+	if(!current) {
+		return;
+	}
+
+	if(_changed_i0 > _changed_i1) {
+		_changed_i0 = i0;
+		_changed_j0 = j0;
+		_changed_i1 = i1;
+		_changed_j1 = j1;
+	} else {
+		_changed_i0 = min(_changed_i0, i0);
+		_changed_j0 = min(_changed_j0, j0);
+		_changed_i1 = max(_changed_i1, i1);
+		_changed_j1 = max(_changed_j1, j1);
+	}
+	_arrays_revision = revision();
+}
+
+void GridTerrain::faultLineGeneration(unsigned iters, unsigned long seed)
+{
+	if(numSamplesX() == 0 || numSamplesY() == 0) {
+		return;
+	}
+
+	if(seed == 0) {
+		seed = freshSeed();
+	}
+	double params[] = { static_cast<double>(iters),
+						static_cast<double>(seed) };
+	if(recall("faultLineGeneration", params, 2)) {
+		return;
+	}
+
+	FaultJob job(&elevations()->front(), numSamplesX(), numSamplesY(),
+			_crew.size(), origin().x(), origin().y(), stepX(), stepY(),
+								iters, seed);
+	_crew.run(job);
+	rewritten(job.lowest(), job.highest());
+}
+
+void GridTerrain::diamondSquareGeneration(double amplitude,
+					double roughness, unsigned long seed)
+{
+	if(numSamplesX() == 0 || numSamplesY() == 0) {
+		return;
+	}
+
+	if(seed == 0) {
+		seed = freshSeed();
+	}
+	double params[] = { amplitude, roughness, static_cast<double>(seed) };
+	if(recall("diamondSquareGeneration", params, 3)) {
+		return;
+	}
+
+	// square blocks of 2^k+1 samples as wide as the shorter side, side
+	// by side along the longer one
+	unsigned n = 2;
+	while(n + 1 < min(numSamplesX(), numSamplesY())) {
+		n *= 2;
+	}
+	unsigned width = max((numSamplesX() + n - 2) / n, 1u) * n + 1;
+	unsigned height = max((numSamplesY() + n - 2) / n, 1u) * n + 1;
+
+	// the corners of the blocks
+	std::vector<float> h(width * height);
+	for(unsigned y = 0; y < height; y += n) {
+		for(unsigned x = 0; x < width; x += n) {
+			h[y * width + x] = amplitude * uniform(seed, x, y);
+		}
+	}
+
+	DiamondSquareJob pass(h, width, height, seed);
+	double scale = amplitude;
+	double decay = pow(2.0, -roughness);
+	for(unsigned step = n; step > 1; step /= 2) {
+		scale *= decay;
+		pass.setPass(step, true, scale);
+		_crew.run(pass);
+		pass.setPass(step, false, scale);
+		_crew.run(pass);
+	}
+
+	AddJob job(&elevations()->front(), numSamplesX(), numSamplesY(),
+						_crew.size(), h, width);
+	_crew.run(job);
+	rewritten(job.lowest(), job.highest());
+}
+
+void GridTerrain::noiseGeneration(double amplitude, double wavelength,
+			unsigned octaves, double persistence, unsigned long seed)
+{
+	if(numSamplesX() == 0 || numSamplesY() == 0 || wavelength <= 0.0) {
+		return;
+	}
+
+	if(seed == 0) {
+		seed = freshSeed();
+	}
+	double params[] = { amplitude, wavelength,
+			static_cast<double>(octaves), persistence,
+						static_cast<double>(seed) };
+	if(recall("noiseGeneration", params, 5)) {
+		return;
+	}
+
+	NoiseJob job(&elevations()->front(), numSamplesX(), numSamplesY(),
+			_crew.size(), stepX(), stepY(), amplitude, wavelength,
+						octaves, persistence, seed);
+	_crew.run(job);
+	rewritten(job.lowest(), job.highest());
+}
+
+void GridTerrain::bakePatches()
+{
+	if(patches() == patchesEnd() || numSamplesX() < 2 ||
+							numSamplesY() < 2 || _splat_size == 0) {
+		return;
+	}
+
+	// the patches with a texture, each one a layer darkening the terrain
+	// outside it, and the density of the finest one drawn
+	std::vector<SplatLayer> layers;
+	std::vector<PatchListIterator> sources;
+	double bx0 = std::numeric_limits<double>::max(), bx1 = -bx0;
+	double by0 = bx0, by1 = -bx0;
+	double density = 0.0;
+	for(PatchListIterator it = patches(); it != patchesEnd(); it++) {
+		osg::ref_ptr<osg::Image> img =
+			Orbis::Util::ImageCache::instance()->image(
+						it->attribute("texture"));
+		if(!img.valid()) {
+			continue;
+		}
+
+		SplatLayer layer;
+		layer.image = img.get();
+		layer.minx = it->minX();
+		layer.maxx = it->maxX();
+		layer.miny = it->minY();
+		layer.maxy = it->maxY();
+		layers.push_back(layer);
+		sources.push_back(it);
+		if(img->getDataType() != GL_UNSIGNED_BYTE ||
+				layer.maxx <= layer.minx || layer.maxy <= layer.miny) {
+			// nothing drawn inside it
+			sources.back() = patchesEnd();
+			continue;
+		}
+		bx0 = min(bx0, layer.minx);
+		bx1 = max(bx1, layer.maxx);
+		by0 = min(by0, layer.miny);
+		by1 = max(by1, layer.maxy);
+		density = max(density, img->s() / (layer.maxx - layer.minx),
+						img->t() / (layer.maxy - layer.miny));
+	}
+
+	if(layers.empty()) {
+		return;
+	}
+
+	// the splat covers only the patches over the terrain, or all of it
+	// if none of them is drawn there
+	bx0 = max(bx0, origin().x());
+	bx1 = min(bx1, origin().x() + (numSamplesX() - 1) * stepX());
+	by0 = max(by0, origin().y());
+	by1 = min(by1, origin().y() + (numSamplesY() - 1) * stepY());
+	bool drawn = bx0 < bx1 && by0 < by1;
+	if(!drawn) {
+		bx0 = origin().x();
+		bx1 = origin().x() + (numSamplesX() - 1) * stepX();
+		by0 = origin().y();
+		by1 = origin().y() + (numSamplesY() - 1) * stepY();
+		sources.assign(sources.size(), patchesEnd());
+	}
+
+	// with square texels as fine as the finest patch texture, unless
+	// the splat would be too large, and a texel all around with only
+	// the darkening of the layers, that the clamping spreads over the
+	// rest of the terrain
+	unsigned inner = drawn ? max(_splat_size, 3u) - 2 : 1;
+	double d = max(bx1 - bx0, by1 - by0) / inner;
+	if(density > 0.0) {
+		d = max(d, 1.0 / density);
+	}
+	unsigned w = min(static_cast<unsigned>(ceil((bx1 - bx0) / d)), inner);
+	unsigned h = min(static_cast<unsigned>(ceil((by1 - by0) / d)), inner);
+	w += 2;
+	h += 2;
+	double ox = bx0 - d, oy = by0 - d;
+	double x0 = ox + 0.5 * d, y0 = oy + 0.5 * d;
+
+	// the texels inside each patch
+	for(unsigned l = 0; l < layers.size(); l++) {
+		SplatLayer& layer = layers[l];
+		if(sources[l] != patchesEnd()) {
+			sources[l]->rasterize(x0, y0, d, d, w, h, layer.spans);
+		}
+		layer.rows.assign(h + 1, 0);
+		for(unsigned k = 0; k < layer.spans.size(); k++) {
+			layer.rows[layer.spans[k].row + 1]++;
+		}
+		for(unsigned j = 0; j < h; j++) {
+			layer.rows[j+1] += layer.rows[j];
+		}
+	}
+
+	// the baking runs in the update traversal, so it has its own crew
+	osg::Image *splat = new osg::Image;
+	splat->allocateImage(w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+	Orbis::Util::WorkCrew crew;
+	crew.resize(_crew.size());
+	SplatJob job(layers, *splat, x0, y0, d, d);
+	crew.run(job);
+
+	// the coordinates of the splat are generated from the vertices
+	setTexturePlanes(1, ox, oy, w * d, h * d);
+	osg::StateSet *ss = getOrCreateStateSet();
+	osg::Texture2D *tex = new osg::Texture2D;
+	tex->setImage(splat);
+	tex->setWrap(osg::Texture2D::WRAP_S, osg::Texture2D::CLAMP_TO_EDGE);
+	tex->setWrap(osg::Texture2D::WRAP_T, osg::Texture2D::CLAMP_TO_EDGE);
+	ss->setTextureAttributeAndModes(1, tex, osg::StateAttribute::ON);
+
+	// the splat covers the base texture as much as its alpha says, which
+	// darkens it by the layers everywhere
+	osg::TexEnvCombine *tex_env = new osg::TexEnvCombine;
+	tex_env->setCombine_RGB(osg::TexEnvCombine::INTERPOLATE);
+	tex_env->setSource0_RGB(osg::TexEnvCombine::TEXTURE);
+	tex_env->setOperand0_RGB(osg::TexEnvCombine::SRC_COLOR);
+	tex_env->setSource1_RGB(osg::TexEnvCombine::PREVIOUS);
+	tex_env->setOperand1_RGB(osg::TexEnvCombine::SRC_COLOR);
+	tex_env->setSource2_RGB(osg::TexEnvCombine::TEXTURE);
+	tex_env->setOperand2_RGB(osg::TexEnvCombine::SRC_ALPHA);
+	ss->setTextureAttributeAndModes(1, tex_env, osg::StateAttribute::ON);
+}
+
+void GridTerrain::rewritten(double lo, double hi)
+{
+	_min_elev = lo;
+	_max_elev = hi;
+
+	modified();
+	dirtyBound();
+
+	// the operation was recorded by recall(), and its result is saved
+	// once the recipe stops changing, not at every step
+	if(_recipe_valid) {
+		_recipe_revision = revision();
+		_recipe_pending = _cache_results && !cacheDirectory().empty();
+	}
+}
+
+void GridTerrain::startRecipe(const char* source, const double* params,
+									unsigned count)
+{
+	_recipe.clear();
+	describe(_recipe, "version", &RecipeVersion, 1);
+	describe(_recipe, source, params, count);
+	_recipe_valid = _recipe.size() <= RecipeLength;
+	_recipe_revision = revision();
+	_recipe_pending = false;
+}
+
+bool GridTerrain::record(const char* op, const double* params,
+								unsigned count)
+{
+	// the result of the last generator or filter is final
+	saveRecipe();
+
+	// the recipe only holds if every change since was recorded
+	_recipe_valid = _recipe_valid && _recipe_revision == revision();
+	if(_recipe_valid) {
+		describe(_recipe, op, params, count);
+		_recipe_valid = _recipe.size() <= RecipeLength;
+	}
+
+	return _recipe_valid;
+}
+
+bool GridTerrain::recall(const char* op, const double* params,
+								unsigned count)
+{
+	// the result of the last generator or filter was just a step
+	_recipe_pending = false;
+
+	if(!record(op, params, count) || !_cache_results ||
+			cacheDirectory().empty() ||
+					!readNative(recipeFile(), _recipe)) {
+		return false;
+	}
+	_recipe_revision = revision();
+	// the file is the last one removed from the cache
+	utime(recipeFile().c_str(), 0);
+
+	return true;
+}
+
+void GridTerrain::saveRecipe()
+{
+	// only elevations the recipe still describes are saved
+	bool pending = _recipe_pending && _recipe_valid &&
+				_recipe_revision == revision() && _cache_results;
+	_recipe_pending = false;
+	if(!pending || cacheDirectory().empty() || !createCacheDirectory()) {
+		return;
+	}
+
+	save(recipeFile(), _recipe);
+	Util::trimDirectory(cacheDirectory(), "terrain-", RecipeCacheSize);
+}
+
+std::string GridTerrain::recipeFile() const
+{
+	std::ostringstream name;
+	name << cacheDirectory() << "/terrain-" << std::hex
+		<< std::setfill('0') << std::setw(8) << Util::hash(_recipe)
+				<< std::setw(8) << sdbm(_recipe) << ".hf";
+
+	return name.str();
+}
+
+void GridTerrain::updateArrays()
+{
+	unsigned nx = numSamplesX();
+	unsigned ny = numSamplesY();
+	if(_chunks.empty()) {
+		return;
+	}
+
+	if(_arrays_revision != revision()) {
+		// a generator or a filter changed every point
+		_arrays_revision = revision();
+		_changed_i0 = _changed_j0 = 1;
+		_changed_i1 = _changed_j1 = 0;
+		for(unsigned c = 0; c < _chunks.size(); c++) {
+			measure(_chunks[c]);
+		}
+		packAll();
+		dirtyBound();
+		return;
+	}
+	if(_changed_i0 > _changed_i1 || _changed_j0 > _changed_j1) {
+		return;
+	}
+
+	// the normals around the changed points were changed too
+	unsigned i0 = _changed_i0 > 0 ? _changed_i0 - 1 : 0;
+	unsigned j0 = _changed_j0 > 0 ? _changed_j0 - 1 : 0;
+	unsigned i1 = min(_changed_i1 + 1, nx - 1);
+	unsigned j1 = min(_changed_j1 + 1, ny - 1);
+	_changed_i0 = _changed_j0 = 1;
+	_changed_i1 = _changed_j1 = 0;
+
+	// the chunks holding the changed points are measured again, and
+	// their rows packed again, or the whole grid if the heights no
+	// longer fit the quanta
+	for(unsigned c = 0; c < _chunks.size(); c++) {
+		Chunk& chunk = _chunks[c];
+		if(chunk.i0 <= i1 && i0 <= chunk.i0 + chunk.ni &&
+				chunk.j0 <= j1 && j0 <= chunk.j0 + chunk.nj) {
+			measure(chunk);
+		}
+	}
+	if(pack(j0, j1)) {
+		_packed_j0 = j0;
+		_packed_j1 = j1;
+		_packed_serial++;
+	} else {
+		packAll();
+	}
+
+	dirtyBound();
+}
+
+bool GridTerrain::pack(unsigned j0, unsigned j1)
+{
+	const FloatArray& z = *elevations();
+	const osg::Vec3Array& n = *normals();
+	unsigned nx = numSamplesX();
+	int cx = numSamplesX() / 2, cy = numSamplesY() / 2;
+	double quantum = stepX() / _quanta;
+	double ry = stepY() / stepX();
+	bool fit = true;
+
+	for(unsigned j = j0; j <= j1; j++) {
+		for(unsigned i = 0; i < nx; i++) {
+			unsigned p = j * nx + i, k = 3 * p;
+			double h = floor((z[p] - _zoff) / quantum + 0.5);
+			if(std::abs(h) > MaxQuanta) {
+				h = clamp<double>(h, -1.0 * MaxQuanta, MaxQuanta);
+				fit = false;
+			}
+			_packed_verts[k] = static_cast<GLshort>(
+					(static_cast<int>(i) - cx) * static_cast<int>(_quanta));
+			_packed_verts[k+1] = static_cast<GLshort>(
+					(static_cast<int>(j) - cy) * static_cast<int>(_quanta));
+			_packed_verts[k+2] = static_cast<GLshort>(h);
+
+			// the matrix of the grid scales y by ry more than x and z,
+			// GL divides the normals by it again
+			osg::Vec3 m(n[p].x(), n[p].y() * ry, n[p].z());
+			m.normalize();
+			for(unsigned c = 0; c < 3; c++) {
+				_packed_normals[k+c] =
+					static_cast<GLbyte>(floor(127.0 * m[c] + 0.5));
 			}
 		}
 	}
+
+	return fit;
+}
+
+void GridTerrain::packAll()
+{
+	unsigned nx = numSamplesX();
+	unsigned ny = numSamplesY();
+
+	// the farthest point from the centre and the range of the heights
+	// bound the quanta, in powers of two
+	unsigned side = max(nx / 2, ny / 2, 1u);
+	double lo = std::numeric_limits<double>::max();
+	double hi = -std::numeric_limits<double>::max();
+	for(unsigned c = 0; c < _chunks.size(); c++) {
+		lo = min<double>(lo, _chunks[c].bbox.zMin());
+		hi = max<double>(hi, _chunks[c].bbox.zMax());
+	}
+	double range = max(hi - lo, 0.0);
+	_zoff = 0.5 * (lo + hi);
+	_quanta = 1;
+	while(2 * _quanta * side <= MaxQuanta &&
+			range * 2 * _quanta < (2 * MaxQuanta - 1) * stepX()) {
+		_quanta *= 2;
+	}
+
+	_packed_verts.resize(3 * nx * ny);
+	_packed_normals.resize(3 * nx * ny);
+	pack(0, ny - 1);
+	_packed_j0 = 0;
+	_packed_j1 = ny - 1;
+	_packed_serial++;
+}
+
+void GridTerrain::setTexturePlanes(unsigned unit, double x0, double y0,
+							double sx, double sy)
+{
+	double planes[2][4] = { { 1.0 / sx, 0.0, 0.0, -x0 / sx },
+						{ 0.0, 1.0 / sy, 0.0, -y0 / sy } };
+	std::copy(&planes[0][0], &planes[0][0] + 8, &_tex_planes[unit][0][0]);
+	_tex_units = max(_tex_units, unit + 1);
+
+	osg::TexGen *tex_gen = new osg::TexGen;
+	tex_gen->setMode(osg::TexGen::OBJECT_LINEAR);
+	tex_gen->setPlane(osg::TexGen::S, osg::Plane(planes[0][0],
+				planes[0][1], planes[0][2], planes[0][3]));
+	tex_gen->setPlane(osg::TexGen::T, osg::Plane(planes[1][0],
+				planes[1][1], planes[1][2], planes[1][3]));
+	getOrCreateStateSet()->setTextureAttributeAndModes(unit, tex_gen,
+						osg::StateAttribute::ON);
+}
+
+void GridTerrain::drawImplementation(osg::State& state) const
+{
+	if(_tris.empty()) {
+		return;
+	}
+
+	state.disableColorPointer();
+	state.disableTexCoordPointersAboveAndIncluding(0);
+	glColor3f(0.7f, 0.7f, 0.5f);
+
+	// from the quanta of the grid to the terrain's coordinates
+	double quantum = stepX() / _quanta;
+	double t[3] = { origin().x() + (numSamplesX() / 2) * stepX(),
+				origin().y() + (numSamplesY() / 2) * stepY(), _zoff };
+	double sc[3] = { quantum, quantum * stepY() / stepX(), quantum };
+	glPushMatrix();
+	glTranslated(t[0], t[1], t[2]);
+	glScaled(sc[0], sc[1], sc[2]);
+
+	// the object planes are applied to the vertices as they are given,
+	// so they are moved to the grid too
+	for(unsigned unit = 0; unit < _tex_units; unit++) {
+		state.setActiveTextureUnit(unit);
+		for(unsigned k = 0; k < 2; k++) {
+			const double *p = _tex_planes[unit][k];
+			GLdouble plane[4] = { p[0] * sc[0], p[1] * sc[1],
+					p[2] * sc[2],
+					p[0] * t[0] + p[1] * t[1] + p[2] * t[2] + p[3] };
+			glTexGendv(k == 0 ? GL_S : GL_T, GL_OBJECT_PLANE, plane);
+		}
+	}
+
+	const osg::BufferObject::Extensions *ext =
+		osg::BufferObject::getExtensions(state.getContextID(), true);
+	if(ext && ext->isBufferObjectSupported()) {
+		drawBuffers(state);
+	} else {
+		state.setVertexPointer(3, GL_SHORT, 0, &_packed_verts[0]);
+		state.setNormalPointer(GL_BYTE, 0, &_packed_normals[0]);
+		glDrawElements(GL_TRIANGLES, _tris.size(), GL_UNSIGNED_INT,
+								&_tris[0]);
+	}
+	glPopMatrix();
+
+	// the planes are left as the texture generators set them
+	for(unsigned unit = 0; unit < _tex_units; unit++) {
+		state.setActiveTextureUnit(unit);
+		glTexGendv(GL_S, GL_OBJECT_PLANE, _tex_planes[unit][0]);
+		glTexGendv(GL_T, GL_OBJECT_PLANE, _tex_planes[unit][1]);
+	}
+}
+
+void GridTerrain::drawBuffers(osg::State& state) const
+{
+	const osg::BufferObject::Extensions *ext =
+		osg::BufferObject::getExtensions(state.getContextID(), false);
+	Buffers& buffers = _buffers[state.getContextID()];
+
+	// the buffers of the other drawables are unbound, so that the state
+	// doesn't take ours for them
+	state.unbindVertexBufferObject();
+	state.unbindElementBufferObject();
+	state.dirtyAllVertexArrays();
+
+	// the vertices, then the normals
+	GLsizeiptrARB normals = _packed_verts.size() * sizeof(GLshort);
+	GLsizeiptrARB size = normals + _packed_normals.size() * sizeof(GLbyte);
+	if(buffers.vertices == 0) {
+		ext->glGenBuffers(1, &buffers.vertices);
+	}
+	ext->glBindBuffer(GL_ARRAY_BUFFER_ARB, buffers.vertices);
+	bool some_rows = _packed_j0 > 0 || _packed_j1 + 1 < numSamplesY();
+	if(buffers.vertices_serial + 1 == _packed_serial && some_rows) {
+		// only the rows packed since the last frame
+		unsigned nx = numSamplesX();
+		unsigned first = 3 * _packed_j0 * nx;
+		unsigned count = 3 * (_packed_j1 - _packed_j0 + 1) * nx;
+		ext->glBufferSubData(GL_ARRAY_BUFFER_ARB,
+				first * sizeof(GLshort), count * sizeof(GLshort),
+				&_packed_verts[first]);
+		ext->glBufferSubData(GL_ARRAY_BUFFER_ARB,
+				normals + first * sizeof(GLbyte), count * sizeof(GLbyte),
+				&_packed_normals[first]);
+	} else if(buffers.vertices_serial != _packed_serial) {
+		ext->glBufferData(GL_ARRAY_BUFFER_ARB, size, 0,
+							GL_STATIC_DRAW_ARB);
+		ext->glBufferSubData(GL_ARRAY_BUFFER_ARB, 0, normals,
+						&_packed_verts[0]);
+		ext->glBufferSubData(GL_ARRAY_BUFFER_ARB, normals,
+					size - normals, &_packed_normals[0]);
+	}
+	buffers.vertices_serial = _packed_serial;
+
+	// the triangles change with the levels of detail
+	if(buffers.indices == 0) {
+		ext->glGenBuffers(1, &buffers.indices);
+	}
+	ext->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, buffers.indices);
+	if(buffers.indices_serial != _tris_serial) {
+		ext->glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB,
+				_tris.size() * sizeof(GLuint), &_tris[0],
+						GL_STATIC_DRAW_ARB);
+		buffers.indices_serial = _tris_serial;
+	}
+
+	state.setVertexPointer(3, GL_SHORT, 0, 0);
+	state.setNormalPointer(GL_BYTE, 0,
+			reinterpret_cast<const GLvoid*>(normals));
+	glDrawElements(GL_TRIANGLES, _tris.size(), GL_UNSIGNED_INT, 0);
+
+	// and the state is told the pointers are no longer the arrays'
+	ext->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
+	ext->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+	state.dirtyAllVertexArrays();
+}
+
+void GridTerrain::releaseGLObjects(osg::State* state) const
+{
+	osg::Geometry::releaseGLObjects(state);
+
+	for(unsigned id = 0; id < _buffers.size(); id++) {
+		if(state && state->getContextID() != id) {
+			continue;
+		}
+		Buffers& buffers = _buffers[id];
+		if(buffers.vertices != 0) {
+			osg::BufferObject::deleteBufferObject(id, buffers.vertices);
+		}
+		if(buffers.indices != 0) {
+			osg::BufferObject::deleteBufferObject(id, buffers.indices);
+		}
+		buffers = Buffers();
+	}
 }
 
 void GridTerrain::smooth(double k)
 {
-	Point p, p1;
-	unsigned i, j;
+	if(numSamplesX() == 0 || numSamplesY() == 0) {
+		return;
+	}
+
+	double params[] = { k };
+	if(recall("smooth", params, 1)) {
+		return;
+	}
+
+	GridFilter filter(&elevations()->front(), numSamplesX(), numSamplesY(),
+									_crew);
+	filter.sweep(clamp(k, 0.0, 1.0));
+	float lo, hi;
+	filter.range(lo, hi);
+	rewritten(lo, hi);
+}
+
+void GridTerrain::boxFilter(double radius)
+{
+	if(numSamplesX() == 0 || numSamplesY() == 0) {
+		return;
+	}
+
+	double params[] = { radius };
+	if(recall("boxFilter", params, 1)) {
+		return;
+	}
+
+	GridFilter filter(&elevations()->front(), numSamplesX(), numSamplesY(),
+									_crew);
+	filter.box(static_cast<unsigned>(max(radius / stepX() + 0.5, 0.0)),
+			static_cast<unsigned>(max(radius / stepY() + 0.5, 0.0)));
+	float lo, hi;
+	filter.range(lo, hi);
+	rewritten(lo, hi);
+}
+
+void GridTerrain::gaussianFilter(double sigma)
+{
+	if(numSamplesX() == 0 || numSamplesY() == 0) {
+		return;
+	}
+
+	double params[] = { sigma };
+	if(recall("gaussianFilter", params, 1)) {
+		return;
+	}
+
+	GridFilter filter(&elevations()->front(), numSamplesX(), numSamplesY(),
+									_crew);
+	filter.gaussian(sigma / stepX(), sigma / stepY());
+	float lo, hi;
+	filter.range(lo, hi);
+	rewritten(lo, hi);
+}
+
+void GridTerrain::bilateralFilter(double sigma, double range)
+{
+	if(numSamplesX() == 0 || numSamplesY() == 0) {
+		return;
+	}
+
+	double params[] = { sigma, range };
+	if(recall("bilateralFilter", params, 2)) {
+		return;
+	}
+
+	GridFilter filter(&elevations()->front(), numSamplesX(), numSamplesY(),
+									_crew);
+	filter.bilateral(sigma / stepX(), sigma / stepY(), range);
+	float lo, hi;
+	filter.range(lo, hi);
+	rewritten(lo, hi);
+}
+
+void GridTerrain::setLODError(double pixels)
+{
+	pixels = max(pixels, 0.0);
+	// switching between chunks and full resolution strips
+	if((pixels > 0.0) != (_lod_error > 0.0)) {
+		UpdateCallback *cb =
+			dynamic_cast<UpdateCallback*>(getUpdateCallback());
+		if(cb) {
+			cb->dirtyLists();
+		}
+	}
+	_lod_error = pixels;
+}
+
+void GridTerrain::buildChunks()
+{
+	unsigned nx = numSamplesX();
+	unsigned ny = numSamplesY();
+
+	// the last chunk of each row and column takes the remaining cells
+	_chunks_x = max((nx - 1) / ChunkSize, 1u);
+	_chunks_y = max((ny - 1) / ChunkSize, 1u);
+	_chunks.clear();
+	_tris.clear();
+	_tris_serial++;
+	if(nx < 2 || ny < 2) {
+		return;
+	}
+	_chunks.resize(_chunks_x * _chunks_y);
+
+	for(unsigned b = 0; b < _chunks_y; b++) {
+		for(unsigned a = 0; a < _chunks_x; a++) {
+			Chunk& chunk = _chunks[b * _chunks_x + a];
+			chunk.i0 = a * ChunkSize;
+			chunk.j0 = b * ChunkSize;
+			chunk.ni = a + 1 < _chunks_x ? ChunkSize : nx - 1 - chunk.i0;
+			chunk.nj = b + 1 < _chunks_y ? ChunkSize : ny - 1 - chunk.j0;
+
+			measure(chunk);
+
+			chunk.level = 0;
+			for(unsigned e = 0; e < 4; e++) {
+				chunk.edges[e] = 1;
+			}
+			chunk.first = _tris.size();
+			if(lodError() > 0.0) {
+				triangulate(chunk, _tris);
+			}
+			chunk.count = _tris.size() - chunk.first;
+		}
+	}
+	// at full resolution the grid is a single list of triangles, in
+	// the order the vertex cache likes best
+	if(lodError() <= 0.0) {
+		gridTriangles(nx, ny, _tris);
+	}
+	packAll();
+}
+
+void GridTerrain::measure(Chunk& chunk)
+{
+	const FloatArray& z = *elevations();
+
+	std::vector<unsigned> px, py;
+
+	chunk.bbox.init();
+	for(unsigned y = 0; y <= chunk.nj; y++) {
+		for(unsigned x = 0; x <= chunk.ni; x++) {
+			chunk.bbox.expandBy(
+				origin().x() + (chunk.i0 + x) * stepX(),
+				origin().y() + (chunk.j0 + y) * stepY(),
+				z[vertex(chunk, x, y)]);
+		}
+	}
+
+	// each level doubles the stride while at least one point
+	// is left inside the chunk
+	chunk.error.assign(1, 0.0);
+	unsigned smallest = min(chunk.ni, chunk.nj);
+	for(unsigned stride = 2; 2 * stride <= smallest; stride *= 2) {
+		positions(chunk.ni, stride, px);
+		positions(chunk.nj, stride, py);
+		// the error of a level is the largest distance between
+		// the grid and the coarser surface
+		double err = chunk.error.back();
+		unsigned u = 0, v = 0;
+		for(unsigned y = 0; y <= chunk.nj; y++) {
+			v = min<unsigned>(y / stride, py.size() - 2);
+			double t = static_cast<double>(y - py[v]) /
+						(py[v+1] - py[v]);
+			for(unsigned x = 0; x <= chunk.ni; x++) {
+				u = min<unsigned>(x / stride, px.size() - 2);
+				double s = static_cast<double>(x - px[u]) /
+						(px[u+1] - px[u]);
+				double coarse =
+					(1.0 - t) * ((1.0 - s) *
+						z[vertex(chunk, px[u], py[v])] +
+						s * z[vertex(chunk, px[u+1], py[v])]) +
+					t * ((1.0 - s) *
+						z[vertex(chunk, px[u], py[v+1])] +
+						s * z[vertex(chunk, px[u+1], py[v+1])]);
+				err = max(err, std::abs(z[vertex(chunk, x, y)] -
+										coarse));
+			}
+		}
+		chunk.error.push_back(err);
+	}
+}
+
+void GridTerrain::selectLevels(const osg::Vec3& eye, double pixels_per_radian)
+{
+	std::vector<unsigned> levels(_chunks.size());
+	for(unsigned c = 0; c < _chunks.size(); c++) {
+		const Chunk& chunk = _chunks[c];
+		// distance from the camera to the nearest point of the chunk
+		double dx = max<double>(chunk.bbox.xMin() - eye.x(), 0.0,
+							eye.x() - chunk.bbox.xMax());
+		double dy = max<double>(chunk.bbox.yMin() - eye.y(), 0.0,
+							eye.y() - chunk.bbox.yMax());
+		double dz = max<double>(chunk.bbox.zMin() - eye.z(), 0.0,
+							eye.z() - chunk.bbox.zMax());
+		double dist = sqrt(sqr(dx) + sqr(dy) + sqr(dz));
 
-	k = clamp(k, 0.0, 1.0);
-	for(i = 0; i < numSamplesY(); i++) {
-		for(j = 1; j < numSamplesX(); j++) {
-			p =  point(j, i);
-			p1 = point(j-1, i);
-			setPoint(j, i, p.z()*(1-k)+p1.z()*k);
+		// the coarsest level that looks right from there
+		unsigned level = chunk.error.size() - 1;
+		while(level > 0 &&
+			chunk.error[level] * pixels_per_radian > _lod_error * dist) {
+			level--;
 		}
+		levels[c] = level;
 	}
-	for(i = 1; i < numSamplesY(); i++) {
-		for(j = 0; j < numSamplesX(); j++) {
-			p =  point(j, i);
-			p1 = point(j, i-1);
-			setPoint(j, i, p.z()*(1-k)+p1.z()*k);
+
+	// the edges shared by two chunks follow the coarsest of them
+	std::vector<bool> changed(_chunks.size(), false);
+	bool any = false;
+	for(unsigned b = 0; b < _chunks_y; b++) {
+		for(unsigned a = 0; a < _chunks_x; a++) {
+			unsigned c = b * _chunks_x + a;
+			unsigned edges[4];
+			edges[0] = b > 0 ? levels[c - _chunks_x] : 0;
+			edges[1] = a + 1 < _chunks_x ? levels[c + 1] : 0;
+			edges[2] = b + 1 < _chunks_y ? levels[c + _chunks_x] : 0;
+			edges[3] = a > 0 ? levels[c - 1] : 0;
+
+			// the chunks built for full resolution have no triangles
+			// of their own yet
+			Chunk& chunk = _chunks[c];
+			bool same = chunk.level == levels[c] && chunk.count > 0;
+			for(unsigned e = 0; e < 4; e++) {
+				edges[e] = 1u << max(edges[e], levels[c]);
+				same = same && chunk.edges[e] == edges[e];
+			}
+			if(same) {
+				continue;
+			}
+
+			chunk.level = levels[c];
+			for(unsigned e = 0; e < 4; e++) {
+				chunk.edges[e] = edges[e];
+			}
+			changed[c] = any = true;
 		}
 	}
-	for(i = 0; i < numSamplesY(); i++) {
-		for(j = numSamplesX()-2; j > 0; j--) {
-			p =  point(j, i);
-			p1 = point(j+1, i);
-			setPoint(j, i, p.z()*(1-k)+p1.z()*k);
+	if(!any) {
+		return;
+	}
+
+	// the triangles of all the chunks are drawn at once, the ones of
+	// the unchanged chunks are copied
+	std::vector<GLuint> tris;
+	tris.reserve(_tris.size());
+	for(unsigned c = 0; c < _chunks.size(); c++) {
+		Chunk& chunk = _chunks[c];
+		unsigned first = tris.size();
+		if(changed[c]) {
+			triangulate(chunk, tris);
+		} else {
+			tris.insert(tris.end(), _tris.begin() + chunk.first,
+					_tris.begin() + chunk.first + chunk.count);
 		}
-		p =  point(0, i);
-		p1 = point(1, i);
-		setPoint(0, i, p.z()*(1-k)+p1.z()*k);
+		chunk.first = first;
+		chunk.count = tris.size() - first;
 	}
-	for(i = numSamplesY()-2; i > 0; i--) {
-		for(j = 0; j < numSamplesX(); j++) {
-			p =  point(j, i);
-			p1 = point(j, i+1);
-			setPoint(j, i, p.z()*(1-k)+p1.z()*k);
+	_tris.swap(tris);
+	_tris_serial++;
+}
+
+void GridTerrain::triangulate(const Chunk& chunk,
+					std::vector<GLuint>& tris) const
+{
+	std::vector<Knot> knots;
+	unsigned stride = 1u << chunk.level;
+
+	if(chunk.ni < 2 || chunk.nj < 2) {
+		// too thin to have an interior, only at full resolution
+		for(unsigned y = 0; y < chunk.nj; y++) {
+			for(unsigned x = 0; x < chunk.ni; x++) {
+				triangle(knots, Knot(x, y), Knot(x+1, y+1), Knot(x, y+1));
+				triangle(knots, Knot(x, y), Knot(x+1, y), Knot(x+1, y+1));
+			}
+		}
+	} else {
+		std::vector<unsigned> px, py;
+		positions(chunk.ni, stride, px);
+		positions(chunk.nj, stride, py);
+		unsigned lx = px.size() - 2;
+		unsigned ly = py.size() - 2;
+
+		// the interior, at the chunk's own stride
+		for(unsigned v = 1; v < ly; v++) {
+			for(unsigned u = 1; u < lx; u++) {
+				Knot k00(px[u], py[v]), k11(px[u+1], py[v+1]);
+				triangle(knots, k00, k11, Knot(px[u], py[v+1]));
+				triangle(knots, k00, Knot(px[u+1], py[v]), k11);
+			}
+		}
+
+		// the border, stitched to the neighbours' edges
+		std::vector<unsigned> edge;
+		std::vector<Knot> outer, inner;
+		for(unsigned e = 0; e < 4; e++) {
+			bool along_x = e % 2 == 0;
+			positions(along_x ? chunk.ni : chunk.nj, chunk.edges[e], edge);
+			outer.clear();
+			inner.clear();
+			for(unsigned k = 0; k < edge.size(); k++) {
+				switch(e) {
+					case 0: outer.push_back(Knot(edge[k], 0)); break;
+					case 1: outer.push_back(Knot(chunk.ni, edge[k])); break;
+					case 2: outer.push_back(Knot(edge[k], chunk.nj)); break;
+					case 3: outer.push_back(Knot(0, edge[k])); break;
+				}
+			}
+			const std::vector<unsigned>& side = along_x ? px : py;
+			for(unsigned k = 1; k <= (along_x ? lx : ly); k++) {
+				switch(e) {
+					case 0: inner.push_back(Knot(side[k], py[1])); break;
+					case 1: inner.push_back(Knot(px[lx], side[k])); break;
+					case 2: inner.push_back(Knot(side[k], py[ly])); break;
+					case 3: inner.push_back(Knot(px[1], side[k])); break;
+				}
+			}
+			stitch(knots, outer, inner, along_x);
 		}
 	}
-	for(j = 0; j < numSamplesX(); j++) {
-		p =  point(j, 0);
-		p1 = point(j, 1);
-		setPoint(j, 0, p.z()*(1-k)+p1.z()*k);
+
+	std::vector<Knot>::const_iterator it;
+	for(it = knots.begin(); it != knots.end(); it++) {
+		tris.push_back(vertex(chunk, it->first, it->second));
 	}
 }
 
@@ -28,6 +28,12 @@
 #pragma interface
 #endif
 
+#include <vector>
+
+#include <osg/buffered_value>
+
+#include <spline.hpp>
+#include <workcrew.hpp>
 #include <terrain.hpp>
 #include <gridheightfield.hpp>
 
@@ -46,6 +52,32 @@ public:
 	// OpenSceneGraph stuff
 	META_Object(Orbis, GridTerrain);
 
+	/*!
+	 * \brief The cross-sections of the stamps, d being the distance
+	 * to the centre divided by the radius.
+	 */
+	enum StampShape {
+		//! 1 - d^2
+		Paraboloid,
+		//! A Gaussian with a third of the radius as deviation, lowered
+		//! to reach zero at the radius
+		Gaussian,
+		//! Flat up to half the radius, then a smooth step down to zero
+		Plateau
+	};
+
+	/*!
+	 * \brief How the stamps are combined with the terrain.
+	 */
+	enum StampMode {
+		//! The terrain is lowered to the stamp, never raised
+		Lower,
+		//! The terrain is raised to the stamp, never lowered
+		Raise,
+		//! The stamp is added to the terrain
+		Add
+	};
+
 	//! Default constructor.
 	GridTerrain();
 
@@ -67,14 +99,108 @@ public:
 	/*!
 	 * \brief Loads the heightfield from a data file.
 	 * \param filename The name of the data file.
+	 * \param decimation Only every decimation-th sample is kept.
+	 * \param column The first column of the window read.
+	 * \param line The first line of the window read, from the north.
+	 * \param columns The width of the window, zero to the edge.
+	 * \param lines The height of the window, zero to the edge.
+	 */
+	GridTerrain(const std::string& filename, unsigned decimation = 1,
+				unsigned column = 0, unsigned line = 0,
+					unsigned columns = 0, unsigned lines = 0);
+
+	//! Sets a point on the grid
+	/*!
+	 * Only the vertices and the normals around the changed points are
+	 * written again to the arrays being drawn.
+	 * \param i The point's index in the x direction
+	 * \param j The point's index in the y direction
+	 * \param val The new vertex elevation
 	 */
-	GridTerrain(const std::string& filename);
+	void setPoint(unsigned i, unsigned j, double val);
+
+	/*!
+	 * \brief Number of threads generating and filtering terrains.
+	 * \return The number of threads, the calling one included.
+	 */
+	unsigned generatorThreads() const;
+
+	/*!
+	 * \brief Sets the number of threads generating and filtering terrains.
+	 * \param n The new number of threads, the calling one included.
+	 */
+	void setGeneratorThreads(unsigned n);
+
+	/*!
+	 * \brief Are the results of the generators and filters cached?
+	 * \return True if they are, false by default.
+	 */
+	bool cachesResults() const;
+
+	/*!
+	 * \brief Sets whether the results of the generators and filters
+	 * are cached.
+	 *
+	 * The elevations are known by their recipe: how the grid was made,
+	 * followed by every generator, filter and setPoint() call since,
+	 * with its parameters. With the cache on, the result of a generator
+	 * or filter is saved under a hash of its recipe in the cache
+	 * directory of GridHeightField once the recipe stops changing: when
+	 * the terrain is drawn, edited point by point or with stamps, or
+	 * destroyed. It is read from there instead of being computed when
+	 * the same recipe comes again, the whole recipe being kept in the
+	 * file and checked. The generators give the same terrain
+	 * for the same seed, so a scenario that runs again unchanged reads
+	 * its terrain back. The least recently used results are removed
+	 * when they take too much space. The recipe is lost, and nothing
+	 * more is cached, if the elevations are changed otherwise or the
+	 * recipe grows longer than a megabyte.
+	 * \param on Whether the results are cached.
+	 */
+	void setCacheResults(bool on);
 
 	//! Generates a random terrain using the fault line algorithm.
 	/*!
+	 * Each fault raises the terrain on one side of a random line and
+	 * lowers it on the other. The same seed always gives the same terrain.
 	 * \param iters Number of iterations.
+	 * \param seed The seed of the random faults, zero for a new one at
+	 * each call.
 	 */
-	void faultLineGeneration(unsigned iters);
+	void faultLineGeneration(unsigned iters, unsigned long seed = 0);
+
+	/*!
+	 * \brief Adds a random terrain made by the diamond-square algorithm.
+	 *
+	 * The terrain is made of square blocks side by side, joined
+	 * seamlessly. The random displacements start at amplitude and are
+	 * scaled by 2^-roughness at each halving of the grid spacing. The
+	 * same seed always gives the same terrain.
+	 * \param amplitude The largest displacement, at the coarsest level.
+	 * \param roughness How fast the displacements shrink, usually
+	 * between 0 (rough) and 1 (smooth).
+	 * \param seed The seed of the random displacements, zero for a new
+	 * one at each call.
+	 */
+	void diamondSquareGeneration(double amplitude, double roughness,
+							unsigned long seed = 0);
+
+	/*!
+	 * \brief Adds fractal noise to the terrain.
+	 *
+	 * The noise is a sum of octaves of gradient noise, each one with
+	 * half the wavelength of the previous. The same seed always gives
+	 * the same terrain.
+	 * \param amplitude The amplitude of the first octave.
+	 * \param wavelength The wavelength of the first octave.
+	 * \param octaves The number of octaves.
+	 * \param persistence The ratio between the amplitudes of an octave
+	 * and the previous one.
+	 * \param seed The seed of the noise, zero for a new one at each call.
+	 */
+	void noiseGeneration(double amplitude, double wavelength,
+				unsigned octaves, double persistence = 0.5,
+						unsigned long seed = 0);
 
 	//! Smooths the terrain.
 	/*!
@@ -83,6 +209,97 @@ public:
 	 */
 	void smooth(double k);
 
+	/*!
+	 * \brief Averages the terrain over a box around each sample.
+	 * \param radius The half side of the box.
+	 */
+	void boxFilter(double radius);
+
+	/*!
+	 * \brief Convolves the terrain with a Gaussian.
+	 * \param sigma The standard deviation of the Gaussian.
+	 */
+	void gaussianFilter(double sigma);
+
+	/*!
+	 * \brief Smooths the terrain but keeps its cliffs and ridges.
+	 * \param sigma The standard deviation of the distance weights.
+	 * \param range The standard deviation of the elevation weights,
+	 * much larger steps are kept.
+	 */
+	void bilateralFilter(double sigma, double range);
+
+	/*!
+	 * \brief Stamps a shape on the terrain.
+	 *
+	 * The shape is height times the cross-section over the centre's
+	 * elevation, only the points nearer than radius are changed.
+	 * \param centre The centre of the stamp, its z the base elevation.
+	 * \param radius The radius of the stamp.
+	 * \param height The height of the shape at the centre, negative
+	 * for a hollow.
+	 * \param shape The cross-section of the stamp.
+	 * \param mode How the stamp is combined with the terrain.
+	 */
+	void stamp(const Point& centre, double radius, double height,
+				StampShape shape, StampMode mode);
+
+	/*!
+	 * \brief Sweeps a stamp along a path.
+	 *
+	 * The path is sampled at subDivs() + 1 points, and each point of
+	 * the terrain takes the cross-section at its distance from the
+	 * path. The base elevation goes from the z of the first control
+	 * point to the one of the last along the path. Both carve channels,
+	 * roads and ridges in a single pass over the points near the path.
+	 * \param path The path, whose control points give the base elevation.
+	 * \param radius The half width of the sweep.
+	 * \param height The height of the shape along the path.
+	 * \param shape The cross-section of the sweep.
+	 * \param mode How the sweep is combined with the terrain.
+	 */
+	void sweep(const Orbis::Util::Spline& path, double radius,
+			double height, StampShape shape, StampMode mode);
+
+	/*!
+	 * \brief The screen-space error allowed when drawing the terrain.
+	 * \return The error in pixels, zero if always at full resolution.
+	 * \sa setLODError
+	 */
+	double lodError() const;
+
+	/*!
+	 * \brief Sets the screen-space error allowed when drawing the terrain.
+	 *
+	 * When it is positive the grid is drawn in square chunks, each one
+	 * at the coarsest level of detail whose elevation error, seen from
+	 * the camera, stays under this many pixels.
+	 * \param pixels The error in pixels, zero for full resolution.
+	 */
+	void setLODError(double pixels);
+
+	/*!
+	 * \brief The largest side of the texture the patches are baked into.
+	 * \return The size in texels.
+	 * \sa setSplatSize
+	 */
+	unsigned splatSize() const;
+
+	/*!
+	 * \brief Sets the largest side of the texture the patches are
+	 * baked into.
+	 *
+	 * The textures of all the patches are composited, each one masked
+	 * by its boundary, into a single texture laid over the part of the
+	 * terrain they cover, so drawing it needs a single texture unit
+	 * however many patches there are. Each patch also darkens the rest
+	 * of the terrain a little, as it always has. The texels are as fine
+	 * as those of the finest patch texture, unless that would make the
+	 * splat larger than this.
+	 * \param texels The size in texels.
+	 */
+	void setSplatSize(unsigned texels);
+
 	/*!
 	 * \brief I use this callback to do the vertex list creation
 	 * just before drawing
@@ -99,20 +316,220 @@ public:
 		void dirtyLists();
 
 		/*!
-		 * \brief Creates the vertex lists.
+		 * \brief Creates the vertex lists, or updates the vertices
+		 * changed since the last update.
 		 */
 		virtual void update(osg::NodeVisitor*, osg::Drawable*);
 
 		private: bool _init;
 	};
 
+	/*!
+	 * \brief I use this callback to choose the level of detail of
+	 * each chunk from the camera.
+	 */
+	struct CullCallback : public osg::Drawable::CullCallback {
+		/*!
+		 * \brief Updates the chunks, never culls the terrain.
+		 */
+		virtual bool cull(osg::NodeVisitor*, osg::Drawable*,
+							osg::State*) const;
+	};
+
+	/*!
+	 * \brief Draws the whole grid from its packed arrays.
+	 *
+	 * The vertices are kept in 16-bit integers from the centre of the
+	 * grid, and the normals in bytes, so each point takes 9 bytes
+	 * instead of 24. A single matrix takes them back to the terrain's
+	 * coordinates, and the planes of the generated texture coordinates
+	 * are moved with it. The triangles of all the chunks are drawn at
+	 * once. The arrays are kept in buffer objects when the graphics
+	 * context has them, and only the rows of points changed since the
+	 * last frame are sent again; grids of more than 65535 points a
+	 * side don't fit the 16 bits.
+	 * \param state The current rendering state.
+	 */
+	virtual void drawImplementation(osg::State& state) const;
+
+	/*!
+	 * \brief Frees the buffer objects of a graphics context.
+	 * \param state The state of the context, or null for all of them.
+	 */
+	virtual void releaseGLObjects(osg::State* state = 0) const;
+
 protected:
-	//! Destructor.
+	//! Destructor, saves a result of the recipe not yet saved.
 	virtual ~GridTerrain();
+
+private:
+	// a square piece of the grid drawn at a single level of detail
+	struct Chunk {
+		// first grid point and size, in cells
+		unsigned i0, j0, ni, nj;
+		// elevation error of each level
+		std::vector<double> error;
+		// bounding box
+		osg::BoundingBox bbox;
+		// level and strides of the south, east, north and west edges
+		// the chunk is triangulated with
+		unsigned level, edges[4];
+		// where its triangles start in the indices of the terrain, and
+		// how many indices they take
+		unsigned first, count;
+	};
+
+	// the buffer objects of a graphics context
+	struct Buffers {
+		Buffers();
+
+		// the packed vertices, then the normals, and the indices
+		GLuint vertices, indices;
+		// the serials of the arrays they hold
+		unsigned long vertices_serial, indices_serial;
+	};
+
+	// number of cells on the side of a chunk
+	static const unsigned ChunkSize = 32;
+
+	// splits the grid into chunks, all at full resolution
+	void buildChunks();
+	// computes the bounding box and the level errors of a chunk
+	void measure(Chunk& chunk);
+	// chooses the chunk levels for the given camera
+	void selectLevels(const osg::Vec3& eye, double pixels_per_radian);
+	// appends the triangles of a chunk at its level, stitched to its
+	// neighbours
+	void triangulate(const Chunk& chunk, std::vector<GLuint>& tris) const;
+	// index of the grid point at a point of a chunk
+	unsigned vertex(const Chunk& chunk, unsigned x, unsigned y) const;
+	// packs the vertices and normals of some rows of points, false if
+	// their heights had to be clamped to fit in the quanta
+	bool pack(unsigned j0, unsigned j1);
+	// chooses the finest quanta that fit the whole grid and packs it
+	void packAll();
+	// draws the triangles from the buffer objects of the context
+	void drawBuffers(osg::State& state) const;
+	// generates the coordinates of a texture unit over a rectangle
+	void setTexturePlanes(unsigned unit, double x0, double y0,
+							double sx, double sy);
+
+	// composites the textures of the patches into one
+	void bakePatches();
+
+	// takes the extreme elevations found by a generator or a filter
+	void rewritten(double lo, double hi);
+	// stamps a shape along a polyline, whose points give the base
+	// elevation
+	void carve(const std::vector<Point>& path, double radius,
+			double height, StampShape shape, StampMode mode);
+	// takes a rectangle of points changed, if the arrays were current
+	void changed(bool current, unsigned i0, unsigned j0,
+					unsigned i1, unsigned j1);
+	// packs the rows with changed points again
+	void updateArrays();
+
+	// starts the recipe of the elevations with how the grid was made
+	void startRecipe(const char* source, const double* params,
+								unsigned count);
+	// extends the recipe with an operation, if the recipe holds
+	bool record(const char* op, const double* params, unsigned count);
+	// extends the recipe with an operation, and reads its result from
+	// the cache if it is there
+	bool recall(const char* op, const double* params, unsigned count);
+	// the name of the cached result of the recipe
+	std::string recipeFile() const;
+	// saves the result of the last generator or filter, if it is still
+	// what the recipe describes, and trims the cache
+	void saveRecipe();
+
+	// threads running the generators and the filters
+	Orbis::Util::WorkCrew _crew;
+	// screen-space error allowed
+	double _lod_error;
+	// largest side of the texture the patches are baked into
+	unsigned _splat_size;
+	// chunks, row after row
+	std::vector<Chunk> _chunks;
+	// number of chunks in each direction
+	unsigned _chunks_x, _chunks_y;
+	// the vertices, x and y from the centre of the grid and z from
+	// _zoff, in quanta, row after row
+	std::vector<GLshort> _packed_verts;
+	// the normals, scaled as the vertices are, in 127ths
+	std::vector<GLbyte> _packed_normals;
+	// the triangles of the chunks, one chunk after another, or of the
+	// whole grid at full resolution
+	std::vector<GLuint> _tris;
+	// number of quanta of the packed vertices in a step along x, and
+	// the elevation their heights are relative to
+	unsigned _quanta;
+	double _zoff;
+	// serials of the packed arrays and of the triangles, and the rows
+	// of points packed again by the last change of the arrays
+	unsigned long _packed_serial, _tris_serial;
+	unsigned _packed_j0, _packed_j1;
+	// buffer objects of each graphics context
+	mutable osg::buffered_object<Buffers> _buffers;
+	// number of texture units with generated coordinates, and their
+	// s and t planes in the terrain's coordinates
+	unsigned _tex_units;
+	double _tex_planes[2][2][4];
+	// revision the packed arrays were written for
+	unsigned long _arrays_revision;
+	// points changed by setPoint() and the stamps since then, none
+	// if i0 > i1
+	unsigned _changed_i0, _changed_j0, _changed_i1, _changed_j1;
+	// whether the results of the generators and filters are cached
+	bool _cache_results;
+	// everything that made the elevations, an operation a line
+	std::string _recipe;
+	// does the recipe hold, and for which revision?
+	bool _recipe_valid;
+	unsigned long _recipe_revision;
+	// is the result of the last generator or filter waiting to be saved?
+	bool _recipe_pending;
 };
 
-inline GridTerrain::~GridTerrain()
+inline unsigned GridTerrain::generatorThreads() const
+{
+	return _crew.size();
+}
+
+inline void GridTerrain::setGeneratorThreads(unsigned n)
+{
+	_crew.resize(n);
+}
+
+inline bool GridTerrain::cachesResults() const
+{
+	return _cache_results;
+}
+
+inline void GridTerrain::setCacheResults(bool on)
+{
+	_cache_results = on;
+}
+
+inline double GridTerrain::lodError() const
+{
+	return _lod_error;
+}
+
+inline unsigned GridTerrain::splatSize() const
+{
+	return _splat_size;
+}
+
+inline void GridTerrain::setSplatSize(unsigned texels)
+{
+	_splat_size = texels;
+}
+
+inline unsigned GridTerrain::vertex(const Chunk& chunk,
+						unsigned x, unsigned y) const
 {
+	return (chunk.j0 + y) * numSamplesX() + chunk.i0 + x;
 }
 
 } } // namespace declarations
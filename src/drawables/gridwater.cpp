@@ -0,0 +1,242 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifdef __GNUG__
+#pragma implementation
+#endif
+
+#include <cassert>
+
+#include <osg/Material>
+#include <osg/BlendFunc>
+#include <osg/PolygonOffset>
+
+#include <math.hpp>
+#include <gridmesh.hpp>
+#include <gridwater.hpp>
+
+using Orbis::Math::min;
+using Orbis::Math::max;
+using Orbis::Util::gridTriangles;
+
+namespace Orbis {
+
+	namespace Drawable {
+
+void GridWater::locate(const Point& p, unsigned *i, unsigned *j) const
+{
+	double x = floor((p.x() - origin().x()) / stepX());
+	double y = floor((p.y() - origin().y()) / stepY());
+
+	*i = static_cast<unsigned>(x);
+	*j = static_cast<unsigned>(y);
+}
+
+GridWater::GridWater(const Point& origin, double stepX, double stepY,
+					unsigned samplesX, unsigned samplesY)
+	: GridHeightField(origin, stepX, stepY, samplesX, samplesY),
+				_bed_field(0), _bed_revision(0), _fresh(false)
+{
+	osg::StateSet *stateSet = getOrCreateStateSet();
+
+	// the water material
+	osg::Material *mat = new osg::Material;
+	osg::Vec4 amb_colour = osg::Vec4(0.2, 0.2, 0.2, 0.75);
+	osg::Vec4 dif_colour = osg::Vec4(0.0, 0.3, 0.7, 0.75);
+	osg::Vec4 spc_colour = osg::Vec4(0.8, 0.8, 0.8, 0.75);
+	mat->setShininess(osg::Material::FRONT_AND_BACK, 100.0);
+	mat->setAmbient(osg::Material::FRONT_AND_BACK, amb_colour);
+	mat->setDiffuse(osg::Material::FRONT_AND_BACK, dif_colour);
+	mat->setSpecular(osg::Material::FRONT_AND_BACK, spc_colour);
+	stateSet->setAttribute(mat);
+
+	// activating blending in this drawable, so the water is transparent
+	stateSet->setMode(GL_BLEND, osg::StateAttribute::ON);
+	stateSet->setMode(GL_LIGHTING, osg::StateAttribute::ON);
+	stateSet->setMode(GL_DEPTH_TEST, osg::StateAttribute::ON);
+	stateSet->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+	osg::BlendFunc *bf = new osg::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	stateSet->setAttribute(bf);
+
+	// using polygon offsets to avoid z-fighting with the terrain
+	stateSet->setMode(GL_POLYGON_OFFSET_FILL, osg::StateAttribute::ON);
+	osg::PolygonOffset *po = new osg::PolygonOffset(3.0, 3.0);
+	stateSet->setAttribute(po);
+
+	// the arrays change every step
+	setUseDisplayList(false);
+	setUseVertexBufferObjects(true);
+	setUpdateCallback(new GridWater::UpdateCallback);
+}
+
+void GridWater::setSolverThreads(unsigned n)
+{
+	Locker lock(this);
+
+	_crew.resize(n);
+}
+
+bool GridWater::resampleBottom()
+{
+	if(bottom() == _bed_field && bottom()->revision() == _bed_revision &&
+						_bed.size() == numSamplesX() * numSamplesY()) {
+		return false;
+	}
+	_bed_field = bottom();
+	_bed_revision = bottom()->revision();
+
+	// a grid coarser than its bottom samples it as finely as the bottom
+	unsigned sx = 1, sy = 1;
+	const GridHeightField *grid =
+			dynamic_cast<const GridHeightField*>(bottom());
+	if(grid) {
+		sx = max(1, static_cast<int>(ceil(stepX() / grid->stepX())));
+		sy = max(1, static_cast<int>(ceil(stepY() / grid->stepY())));
+	}
+
+	// the water may be a bit larger than its bottom, the samples
+	// outside it are clamped to its border
+	unsigned nx = numSamplesX();
+	unsigned n = nx * sx;
+	std::vector<double> xs(n), ys(n), zs(n);
+	for(unsigned i = 0; i < nx; i++) {
+		for(unsigned a = 0; a < sx; a++) {
+			xs[i * sx + a] = origin().x() +
+						(i + (a + 0.5) / sx - 0.5) * stepX();
+		}
+	}
+	_bed.assign(nx * numSamplesY(), 0.0);
+	_bed_min.assign(nx * numSamplesY(), std::numeric_limits<double>::max());
+	for(unsigned j = 0; j < numSamplesY(); j++) {
+		double *sum = &_bed[j * nx];
+		double *low = &_bed_min[j * nx];
+		for(unsigned b = 0; b < sy; b++) {
+			double y = origin().y() + (j + (b + 0.5) / sy - 0.5) * stepY();
+			std::fill(ys.begin(), ys.end(), y);
+			bottom()->sample(n, &xs[0], &ys[0], &zs[0]);
+			for(unsigned i = 0; i < nx; i++) {
+				for(unsigned a = 0; a < sx; a++) {
+					sum[i] += zs[i * sx + a];
+					low[i] = min(low[i], zs[i * sx + a]);
+				}
+			}
+		}
+		for(unsigned i = 0; i < nx; i++) {
+			sum[i] /= sx * sy;
+		}
+	}
+
+	return true;
+}
+
+void GridWater::fillArrays()
+{
+	unsigned n = numSamplesX() * numSamplesY();
+	if(!_next_verts || _next_verts->size() != n) {
+		_next_verts = new osg::Vec3Array(n);
+		_next_norms = new osg::Vec3Array(n);
+	}
+	osg::Vec3Array& verts = *_next_verts;
+	osg::Vec3Array& norms = *_next_norms;
+	for(unsigned j = 0; j < numSamplesY(); j++) {
+		for(unsigned i = 0; i < numSamplesX(); i++) {
+			Point p = point(i, j);
+			Vector v = normal(i, j);
+			// dry ground is drawn by the terrain, so the water sinks
+			// below it, as its bottom may be coarser than the terrain
+			double z = p.z();
+			if(_bed.size() == n && z <= bed(i, j)) {
+				z = _bed_min[j * numSamplesX() + i];
+			}
+			verts[j * numSamplesX() + i] = osg::Vec3(p.x(), p.y(), z);
+			norms[j * numSamplesX() + i] = osg::Vec3(v.x(), v.y(), v.z());
+		}
+	}
+	_fresh = true;
+}
+
+void GridWater::swapArrays()
+{
+	Locker lock(this);
+
+	if(!_fresh) {
+		return;
+	}
+	// the arrays drawn until now will be filled in the next step
+	osg::ref_ptr<osg::Vec3Array> verts =
+			static_cast<osg::Vec3Array*>(getVertexArray());
+	osg::ref_ptr<osg::Vec3Array> norms =
+			static_cast<osg::Vec3Array*>(getNormalArray());
+	setVertexArray(_next_verts.get());
+	setNormalArray(_next_norms.get());
+	_next_verts = verts;
+	_next_norms = norms;
+	_fresh = false;
+
+	dirtyDisplayList();
+	dirtyBound();
+}
+
+GridWater::UpdateCallback::UpdateCallback()
+	: osg::Drawable::UpdateCallback(), _init(false)
+{
+}
+
+void GridWater::UpdateCallback::update(osg::NodeVisitor* nv,
+							osg::Drawable* drawable)
+{
+	GridWater *water = dynamic_cast<GridWater*>(drawable);
+	assert(water);
+
+	if(!_init) {
+		_init = true;
+
+		unsigned nx = water->numSamplesX();
+		unsigned ny = water->numSamplesY();
+
+		// texture coordinates never change
+		osg::Vec2Array *tex = new osg::Vec2Array;
+		for(unsigned j = 0; j < ny; j++) {
+			for(unsigned i = 0; i < nx; i++) {
+				tex->push_back(osg::Vec2(
+					static_cast<float>(i) / (nx - 1),
+					static_cast<float>(j) / (ny - 1)));
+			}
+		}
+		water->setTexCoordArray(0, tex);
+		water->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+
+		// neither do the indices
+		osg::PrimitiveSet *tris = gridTriangles(nx, ny);
+		if(tris) {
+			water->addPrimitiveSet(tris);
+		}
+
+		// the simulation may not have run yet
+		Locker lock(water);
+		if(!water->_fresh) {
+			water->fillArrays();
+		}
+	}
+	water->swapArrays();
+}
+
+} } // namespace declarations
@@ -0,0 +1,204 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifndef __ORBIS_GRIDWATER_HPP__
+#define __ORBIS_GRIDWATER_HPP__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+#include <workcrew.hpp>
+#include <waterbase.hpp>
+#include <gridheightfield.hpp>
+
+namespace Orbis {
+
+	namespace Drawable {
+
+/*!
+ * \brief Base class of the water layers simulated on a regular grid.
+ *
+ * The grid need not match the bottom's. Each grid point takes the mean
+ * elevation of the bottom over its cell, so a coarse water layer holds
+ * as much water as the terrain beneath it would.
+ *
+ * The surface is drawn from vertex and normal arrays, filled by the
+ * simulation after each step and handed to the geometry by an update
+ * callback, as a single triangle strip.
+ */
+class GridWater : public WaterBase, public GridHeightField {
+public:
+	//! Constructor.
+	GridWater();
+
+	/*!
+	 * \brief Copy constructor.
+	 * \param water The original water.
+	 * \param copyOp Tells how the copy must be done.
+	 */
+	GridWater(const GridWater& water,
+			const osg::CopyOp& copyOp = osg::CopyOp::SHALLOW_COPY);
+
+	/*!
+	 * \brief This is the most-used constructor.
+	 * \param origin The lower-left origin of the height field.
+	 * \param xstep Spacing between samples in the x direction.
+	 * \param ystep Spacing between samples in the y direction.
+	 * \param xsize Number of samples in the x direction.
+	 * \param ysize Number of samples in the y direction.
+	 */
+	GridWater(const Orbis::Util::Point& origin,
+					double xstep, double ystep,
+						unsigned xsize, unsigned ysize);
+
+	/*!
+	 * \brief Number of threads solving the water.
+	 * \return The number of threads, the timer's one included.
+	 */
+	unsigned solverThreads() const;
+
+	/*!
+	 * \brief Sets the number of threads solving the water.
+	 * \param n The new number of threads, the timer's one included.
+	 */
+	void setSolverThreads(unsigned n);
+
+	/*!
+	 * \brief This callback hands the arrays filled by the simulation
+	 * to the geometry, and creates the static ones on the first frame.
+	 */
+	struct UpdateCallback : public osg::Drawable::UpdateCallback {
+		/*!
+		 * \brief Default constructor.
+		 */
+		UpdateCallback();
+
+		/*!
+		 * \brief Swaps in the newest arrays.
+		 */
+		virtual void update(osg::NodeVisitor*, osg::Drawable*);
+
+		private: bool _init;
+	};
+
+protected:
+	//! Destructor.
+	virtual ~GridWater();
+
+	/*!
+	 * \brief Locates a point in the grid.
+	 * \param p The point.
+	 * \param i Where the index in the x direction is stored.
+	 * \param j Where the index in the y direction is stored.
+	 */
+	void locate(const Orbis::Util::Point& p, unsigned *i, unsigned *j) const;
+
+	/*!
+	 * \brief Samples the bottom over the grid cells, if it has changed.
+	 * \return True if the bottom was sampled again.
+	 */
+	bool resampleBottom();
+
+	/*!
+	 * \brief Mean elevation of the bottom in the cell of a grid point.
+	 * \param i The point's index in the x direction.
+	 * \param j The point's index in the y direction.
+	 */
+	double bed(unsigned i, unsigned j) const;
+
+	/*!
+	 * \brief Mean elevations of the bottom, stored row after row.
+	 */
+	const DoubleVector& beds() const;
+
+	/*!
+	 * \brief Fills the arrays to be drawn with the current surface.
+	 *
+	 * Must be called with the water locked, usually at the end of a step.
+	 */
+	void fillArrays();
+
+	/*!
+	 * \brief The threads that share the work of a step.
+	 */
+	Orbis::Util::WorkCrew& crew();
+
+private:
+	friend struct UpdateCallback;
+
+	// the threads solving the water
+	Orbis::Util::WorkCrew _crew;
+	// mean and lowest elevations of the bottom in the cell of each grid point
+	DoubleVector _bed, _bed_min;
+	// which bottom, and which revision of it, was sampled
+	const HeightField *_bed_field;
+	unsigned long _bed_revision;
+	// arrays filled by the simulation and waiting to be drawn
+	osg::ref_ptr<osg::Vec3Array> _next_verts, _next_norms;
+	// are the waiting arrays newer than the drawn ones?
+	bool _fresh;
+
+	// draws the waiting arrays, if they are fresh
+	void swapArrays();
+};
+
+inline GridWater::GridWater()
+	: GridHeightField(), _bed_field(0), _bed_revision(0), _fresh(false)
+{
+	setUpdateCallback(new GridWater::UpdateCallback);
+}
+
+inline GridWater::GridWater(const GridWater& water,
+						const osg::CopyOp& copyOp)
+	: GridHeightField(water, copyOp), _bed_field(0), _bed_revision(0),
+		_fresh(false)
+{
+	setUpdateCallback(new GridWater::UpdateCallback);
+}
+
+inline GridWater::~GridWater()
+{
+}
+
+inline unsigned GridWater::solverThreads() const
+{
+	return _crew.size();
+}
+
+inline double GridWater::bed(unsigned i, unsigned j) const
+{
+	return _bed[j * numSamplesX() + i];
+}
+
+inline const DoubleVector& GridWater::beds() const
+{
+	return _bed;
+}
+
+inline Orbis::Util::WorkCrew& GridWater::crew()
+{
+	return _crew;
+}
+
+} } // namespace declarations
+
+#endif  // __ORBIS_GRIDWATER_HPP__
@@ -28,9 +28,14 @@
  */
 
 #include <limits>
+#include <vector>
+#include <algorithm>
+
+#include <OpenThreads/Mutex>
 
 #include <point.hpp>
 #include <vector.hpp>
+#include <dynamic.hpp>
 
 #include <drawable.hpp>
 
@@ -53,6 +58,14 @@ namespace Orbis {
  */
 class HeightField : public virtual Drawable {
 public:
+	//! What sampling does at points outside the height field
+	enum Outside {
+		//! The nearest point of the height field is sampled
+		ClampOutside,
+		//! The elevation and the normal are not-a-number
+		NaNOutside
+	};
+
 	//! Default constructor
 	HeightField();
 
@@ -103,6 +116,22 @@ public:
 	 */
 	virtual Vector normal(double x, double y) const = 0;
 
+	/*!
+	 * \brief Samples the height field at many points at once.
+	 *
+	 * Unlike point() and normal() it never throws, points outside the
+	 * height field are handled as asked.
+	 * \param count The number of points
+	 * \param xs The x coordinates of the points
+	 * \param ys The y coordinates of the points
+	 * \param zs Receives the elevations, may be zero
+	 * \param normals Receives the normal vectors, may be zero
+	 * \param outside What to do with points outside the height field
+	 */
+	virtual void sample(unsigned count, const double* xs, const double* ys,
+				double* zs, Vector* normals = 0,
+					Outside outside = ClampOutside) const;
+
 	//! The minimum height field elevation
 	double minimumElevation() const;
 
@@ -112,28 +141,57 @@ public:
 	//! Computes the bounding box of the height field
 	virtual osg::BoundingBox computeBound() const;
 
+	/*!
+	 * \brief A number which changes every time the height field is
+	 * modified, so that cached samplings of it may be checked.
+	 * \return The current revision.
+	 */
+	unsigned long revision() const;
+
+	/*!
+	 * \brief Registers an object that must be woken up whenever this
+	 * height field is modified.
+	 * \param d The dependent object.
+	 */
+	void addDependent(Dynamic* d) const;
+
+	/*!
+	 * \brief Stops waking up an object when this height field changes.
+	 * \param d The dependent object.
+	 */
+	void removeDependent(Dynamic* d) const;
+
 protected:
 	//! Destructor
 	virtual ~HeightField();
 
+	//! Must be called on changes, wakes up all the dependent objects
+	void modified();
+
 	//! Extreme elevations
 	double _min_elev, _max_elev;
 
 private:
 	//! Height field origin
 	Point _origin;
+	//! Modifications counter
+	unsigned long _revision;
+	//! Objects which depend on this height field
+	mutable std::vector<Dynamic*> _dependents;
+	//! Guards the dependents, added and removed from other threads
+	mutable OpenThreads::Mutex _dependents_mutex;
 };
 
 // pretty useless constructor, for osg's sake
 inline HeightField::HeightField()
-	: Drawable()
+	: Drawable(), _revision(0)
 {
 	_min_elev =   std::numeric_limits<double>::max();
 	_max_elev =  -std::numeric_limits<double>::max();
 }
 
 inline HeightField::HeightField(const Point& origin)
-	: Drawable(), _origin(origin)
+	: Drawable(), _origin(origin), _revision(0)
 {
 	_min_elev =   std::numeric_limits<double>::max();
 	_max_elev =  -std::numeric_limits<double>::max();
@@ -143,7 +201,7 @@ inline HeightField::HeightField(const HeightField& src,
 					const osg::CopyOp& copyOp)
 	: Drawable(src, copyOp),
 		_min_elev(src._min_elev), _max_elev(src._max_elev),
-		_origin(src._origin)
+		_origin(src._origin), _revision(0)
 {
 	_min_elev =   std::numeric_limits<double>::max();
 	_max_elev =  -std::numeric_limits<double>::max();
@@ -161,6 +219,39 @@ inline Point HeightField::origin() const
 inline void HeightField::setOrigin(const Point& org)
 {
 	_origin = org;
+	modified();
+}
+
+inline void HeightField::sample(unsigned count,
+				const double* xs, const double* ys,
+					double* zs, Vector* normals, Outside outside) const
+{
+	double x0 = origin().x(), x1 = x0 + sizeX();
+	double y0 = origin().y(), y1 = y0 + sizeY();
+	for(unsigned k = 0; k < count; k++) {
+		double x = xs[k], y = ys[k];
+		if(!(x >= x0 && x <= x1 && y >= y0 && y <= y1)) {
+			// not-a-number coordinates can't be clamped either
+			if(outside == NaNOutside || x != x || y != y) {
+				double nan = std::numeric_limits<double>::quiet_NaN();
+				if(zs) {
+					zs[k] = nan;
+				}
+				if(normals) {
+					normals[k] = Vector(nan, nan, nan);
+				}
+				continue;
+			}
+			x = std::min(std::max(x, x0), x1);
+			y = std::min(std::max(y, y0), y1);
+		}
+		if(zs) {
+			zs[k] = point(x, y).z();
+		}
+		if(normals) {
+			normals[k] = normal(x, y);
+		}
+	}
 }
 
 inline double HeightField::minimumElevation() const
@@ -187,6 +278,43 @@ inline osg::BoundingBox HeightField::computeBound() const
 	return bbox;
 }
 
+inline void HeightField::addDependent(Dynamic* d) const
+{
+	if(d) {
+		_dependents_mutex.lock();
+		_dependents.push_back(d);
+		_dependents_mutex.unlock();
+	}
+}
+
+inline void HeightField::removeDependent(Dynamic* d) const
+{
+	_dependents_mutex.lock();
+	_dependents.erase(std::remove(_dependents.begin(),
+						_dependents.end(), d), _dependents.end());
+	_dependents_mutex.unlock();
+}
+
+inline unsigned long HeightField::revision() const
+{
+	return _revision;
+}
+
+inline void HeightField::modified()
+{
+	_revision++;
+
+	// the lock is held while waking, so no dependent is removed, and
+	// destroyed, meanwhile; they must not add or remove themselves
+	// while holding their own lock
+	_dependents_mutex.lock();
+	std::vector<Dynamic*>::const_iterator it;
+	for(it = _dependents.begin(); it != _dependents.end(); it++) {
+		(*it)->wake();
+	}
+	_dependents_mutex.unlock();
+}
+
 } } // namespaces declaration
 
 #endif  // __ORBIS_HEIGHTFIELD_HPP__
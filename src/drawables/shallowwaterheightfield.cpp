@@ -0,0 +1,371 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifdef __GNUG__
+#pragma implementation
+#endif
+
+#include <algorithm>
+#include <iostream>
+
+#include <math.hpp>
+#include <shallowwaterheightfield.hpp>
+
+using std::abs;
+using std::sqrt;
+using Orbis::Math::min;
+using Orbis::Math::max;
+
+// gravity
+static const double Gravity = 10.0;
+// time, in seconds, too short to be carried over to the next step
+static const double LagEpsilon = 1.0e-9;
+
+/*
+ * Flux across the face between a left and a right cell, the first
+ * velocity component being normal to the face. The states are rebuilt
+ * at the higher of the two bottoms, and the momentum flux of each side
+ * is corrected by the pressure of its own depth, so that still water
+ * gives no net flux. fl is the flux leaving the left cell and fr the one
+ * entering the right cell.
+ */
+static void flux(double hl, double ul, double vl, double bl,
+			double hr, double ur, double vr, double br,
+				double *fl, double *fr)
+{
+	double b = max(bl, br);
+	double hls = max(0.0, hl + bl - b);
+	double hrs = max(0.0, hr + br - b);
+	// fastest wave leaving the face
+	double a = max(abs(ul) + sqrt(Gravity * hls),
+				abs(ur) + sqrt(Gravity * hrs));
+
+	double mass = 0.5 * (hls * ul + hrs * ur) - 0.5 * a * (hrs - hls);
+	double mom_n = 0.5 * (hls * ul * ul + 0.5 * Gravity * hls * hls +
+				hrs * ur * ur + 0.5 * Gravity * hrs * hrs) -
+					0.5 * a * (hrs * ur - hls * ul);
+	double mom_t = 0.5 * (hls * ul * vl + hrs * ur * vr) -
+					0.5 * a * (hrs * vr - hls * vl);
+
+	fl[0] = fr[0] = mass;
+	fl[1] = mom_n + 0.5 * Gravity * (hl * hl - hls * hls);
+	fr[1] = mom_n + 0.5 * Gravity * (hr * hr - hrs * hrs);
+	fl[2] = fr[2] = mom_t;
+}
+
+namespace Orbis {
+
+	namespace Drawable {
+
+const double ShallowWaterHeightField::DryDepth = 1.0e-4;
+const double ShallowWaterHeightField::Courant = 0.45;
+const double ShallowWaterHeightField::MaxLag = 1.0;
+
+ShallowWaterHeightField::ShallowWaterHeightField(const Point& origin,
+							double stepX, double stepY,
+								unsigned samplesX, unsigned samplesY)
+	: GridWater(origin, stepX, stepY, samplesX, samplesY),
+		_tiles_x(0), _tiles_y(0), _speed_x(0.0), _speed_y(0.0),
+			_dt(0.0), _lag(0.0), _lag_reported(false),
+				_activity(Orbis::Math::Omega)
+{
+}
+
+void ShallowWaterHeightField::evolve(unsigned long time)
+{
+	// time step in seconds
+	double tstep = time / 1000.0;
+
+	Locker lock(this);
+
+	// no bottom, no simulation
+	if(!bottom()) {
+		_activity = 0.0;
+		return;
+	}
+	bool moved = resampleBottom();
+	unsigned n = numSamplesX() * numSamplesY();
+	if(_h.size() != n) {
+		// first run, all dry
+		_h.assign(n, 0.0);
+		_hu.assign(n, 0.0);
+		_hv.assign(n, 0.0);
+		_next_h.assign(n, 0.0);
+		_next_hu.assign(n, 0.0);
+		_next_hv.assign(n, 0.0);
+		_tiles_x = (numSamplesX() + TileSize - 1) / TileSize;
+		_tiles_y = (numSamplesY() + TileSize - 1) / TileSize;
+		_wet.assign(_tiles_x * _tiles_y, 0);
+		_active.assign(_tiles_x * _tiles_y, 0);
+		moved = true;
+	}
+	_activity = moved ? Orbis::Math::Omega : 0.0;
+
+	pour(tstep);
+
+	// as many substeps as the fastest wave allows, catching up with the
+	// time left from the previous steps
+	_shares.resize(crew().size());
+	StepJob update(this, false), commit(this, true);
+	double span = tstep + _lag;
+	double elapsed = 0.0;
+	for(unsigned k = 0; k < MaxSubsteps && elapsed < span; k++) {
+		_dt = span - elapsed;
+		double rate = _speed_x / stepX() + _speed_y / stepY();
+		if(rate * _dt > Courant) {
+			_dt = Courant / rate;
+		}
+		spreadWetTiles();
+		crew().run(update);
+		crew().run(commit);
+		elapsed += _dt;
+
+		// gathering the results of all threads
+		_speed_x = _speed_y = 0.0;
+		for(unsigned t = 0; t < _shares.size(); t++) {
+			_speed_x = max(_speed_x, _shares[t].speed_x);
+			_speed_y = max(_speed_y, _shares[t].speed_y);
+			_activity = max(_activity, _shares[t].activity);
+		}
+	}
+
+	// the time not simulated is carried over, and keeps the water awake
+	_lag = span - elapsed > LagEpsilon ? span - elapsed : 0.0;
+	if(_lag > 0.0) {
+		_activity = Orbis::Math::Omega;
+	}
+	if(_lag > MaxLag && !_lag_reported) {
+		std::cerr << "ShallowWaterHeightField: " << _lag
+			<< " s behind, the waves are too fast for the grid"
+						<< std::endl;
+	}
+	_lag_reported = _lag > MaxLag;
+
+	raiseSurface();
+	// the drawing thread only has to swap the new arrays in
+	fillArrays();
+}
+
+void ShallowWaterHeightField::pour(double tstep)
+{
+	SourceIterator it;
+	for(it = sources(); it != sourcesEnd(); it++) {
+		unsigned i, j;
+		Point p = it->position();
+		locate(p, &i, &j);
+		if(i + 1 >= numSamplesX() || j + 1 >= numSamplesY()) {
+			continue;
+		}
+		// a flowing source keeps the water awake
+		double vol = it->strength() * tstep;
+		_activity = max(_activity, abs(vol));
+
+		// the water is shared among the four nearest cells
+		double fx = (p.x() - point(i, j).x()) / stepX();
+		double fy = (p.y() - point(i, j).y()) / stepY();
+		double w[4] = {
+			(1.0 - fx) * (1.0 - fy), fx * (1.0 - fy),
+			(1.0 - fx) * fy, fx * fy
+		};
+		unsigned c[4] = {
+			j * numSamplesX() + i, j * numSamplesX() + i + 1,
+			(j+1) * numSamplesX() + i, (j+1) * numSamplesX() + i + 1
+		};
+		for(unsigned k = 0; k < 4; k++) {
+			double &h = _h[c[k]];
+			// a sink can't take more than there is
+			h = max(0.0, h + w[k] * vol / (stepX() * stepY()));
+			_wet[(c[k] / numSamplesX() / TileSize) * _tiles_x +
+					(c[k] % numSamplesX()) / TileSize] = 1;
+			double wave = sqrt(Gravity * h);
+			_speed_x = max(_speed_x, abs(velocity(h, _hu[c[k]])) + wave);
+			_speed_y = max(_speed_y, abs(velocity(h, _hv[c[k]])) + wave);
+		}
+	}
+}
+
+/*
+ * Water crosses at most one cell in a substep, so a ring of one tile
+ * around the wet ones is enough.
+ */
+void ShallowWaterHeightField::spreadWetTiles()
+{
+	_active.assign(_tiles_x * _tiles_y, 0);
+	for(unsigned ty = 0; ty < _tiles_y; ty++) {
+		for(unsigned tx = 0; tx < _tiles_x; tx++) {
+			if(!_wet[ty * _tiles_x + tx]) {
+				continue;
+			}
+			unsigned x1 = min(tx + 2, _tiles_x);
+			unsigned y1 = min(ty + 2, _tiles_y);
+			for(unsigned y = ty > 0 ? ty - 1 : 0; y < y1; y++) {
+				for(unsigned x = tx > 0 ? tx - 1 : 0; x < x1; x++) {
+					_active[y * _tiles_x + x] = 1;
+				}
+			}
+		}
+	}
+}
+
+void ShallowWaterHeightField::StepJob::work(unsigned index, unsigned count)
+{
+	// each thread takes a contiguous run of rows of tiles
+	unsigned first = _water->_tiles_y * index / count;
+	unsigned last = _water->_tiles_y * (index + 1) / count;
+
+	Share &s = _water->_shares[index];
+	if(!_commit) {
+		s.speed_x = s.speed_y = s.activity = 0.0;
+	}
+	for(unsigned ty = first; ty < last; ty++) {
+		for(unsigned tx = 0; tx < _water->_tiles_x; tx++) {
+			if(!_water->_active[ty * _water->_tiles_x + tx]) {
+				continue;
+			}
+			if(_commit) {
+				_water->commitTile(tx, ty);
+			} else {
+				_water->updateTile(tx, ty, s);
+			}
+		}
+	}
+}
+
+void ShallowWaterHeightField::updateTile(unsigned tx, unsigned ty, Share& s)
+{
+	const unsigned nx = numSamplesX();
+	const unsigned ny = numSamplesY();
+	const DoubleVector& b = beds();
+	const double kx = _dt / stepX();
+	const double ky = _dt / stepY();
+
+	unsigned i1 = min((tx + 1) * TileSize, nx);
+	unsigned j1 = min((ty + 1) * TileSize, ny);
+	bool wet = false;
+	for(unsigned j = ty * TileSize; j < j1; j++) {
+		for(unsigned i = tx * TileSize; i < i1; i++) {
+			unsigned c = j * nx + i;
+			double h = _h[c];
+			double u = velocity(h, _hu[c]);
+			double v = velocity(h, _hv[c]);
+			double fe[3], fw[3], fn[3], fs[3], dummy[3];
+
+			// east and west faces, beyond the borders the cell
+			// is mirrored
+			if(i + 1 < nx) {
+				unsigned e = c + 1;
+				flux(h, u, v, b[c], _h[e], velocity(_h[e], _hu[e]),
+					velocity(_h[e], _hv[e]), b[e], fe, dummy);
+			} else {
+				flux(h, u, v, b[c], h, -u, v, b[c], fe, dummy);
+			}
+			if(i > 0) {
+				unsigned w = c - 1;
+				flux(_h[w], velocity(_h[w], _hu[w]),
+					velocity(_h[w], _hv[w]), b[w],
+						h, u, v, b[c], dummy, fw);
+			} else {
+				flux(h, -u, v, b[c], h, u, v, b[c], dummy, fw);
+			}
+			// north and south faces, v is the normal velocity
+			if(j + 1 < ny) {
+				unsigned n = c + nx;
+				flux(h, v, u, b[c], _h[n], velocity(_h[n], _hv[n]),
+					velocity(_h[n], _hu[n]), b[n], fn, dummy);
+			} else {
+				flux(h, v, u, b[c], h, -v, u, b[c], fn, dummy);
+			}
+			if(j > 0) {
+				unsigned n = c - nx;
+				flux(_h[n], velocity(_h[n], _hv[n]),
+					velocity(_h[n], _hu[n]), b[n],
+						h, v, u, b[c], dummy, fs);
+			} else {
+				flux(h, -v, u, b[c], h, v, u, b[c], dummy, fs);
+			}
+
+			double nh = h - kx * (fe[0] - fw[0]) - ky * (fn[0] - fs[0]);
+			double nhu = _hu[c] - kx * (fe[1] - fw[1]) -
+							ky * (fn[2] - fs[2]);
+			double nhv = _hv[c] - kx * (fe[2] - fw[2]) -
+							ky * (fn[1] - fs[1]);
+			// rounding may leave a tiny negative depth
+			nh = max(0.0, nh);
+			if(nh <= DryDepth) {
+				nhu = nhv = 0.0;
+			} else {
+				wet = true;
+			}
+			_next_h[c] = nh;
+			_next_hu[c] = nhu;
+			_next_hv[c] = nhv;
+
+			double wave = sqrt(Gravity * nh);
+			s.speed_x = max(s.speed_x, abs(velocity(nh, nhu)) + wave);
+			s.speed_y = max(s.speed_y, abs(velocity(nh, nhv)) + wave);
+			s.activity = max(s.activity, abs(nh - h));
+		}
+	}
+	// only this thread writes the flag of this tile
+	_wet[ty * _tiles_x + tx] = wet;
+}
+
+void ShallowWaterHeightField::commitTile(unsigned tx, unsigned ty)
+{
+	const unsigned nx = numSamplesX();
+	unsigned i0 = tx * TileSize;
+	unsigned i1 = min((tx + 1) * TileSize, nx);
+	unsigned j1 = min((ty + 1) * TileSize, numSamplesY());
+	for(unsigned j = ty * TileSize; j < j1; j++) {
+		unsigned c0 = j * nx + i0, c1 = j * nx + i1;
+		std::copy(_next_h.begin() + c0, _next_h.begin() + c1,
+							_h.begin() + c0);
+		std::copy(_next_hu.begin() + c0, _next_hu.begin() + c1,
+							_hu.begin() + c0);
+		std::copy(_next_hv.begin() + c0, _next_hv.begin() + c1,
+							_hv.begin() + c0);
+	}
+}
+
+void ShallowWaterHeightField::raiseSurface()
+{
+	FloatArray& z = *elevations();
+	const DoubleVector& b = beds();
+
+	double lo = std::numeric_limits<double>::max();
+	double hi = -std::numeric_limits<double>::max();
+	for(unsigned c = 0; c < _h.size(); c++) {
+		z[c] = b[c] + _h[c];
+		lo = min(lo, static_cast<double>(z[c]));
+		hi = max(hi, static_cast<double>(z[c]));
+	}
+	if(lo < _min_elev) {
+		_min_elev = lo;
+		dirtyBound();
+	}
+	if(hi > _max_elev) {
+		_max_elev = hi;
+		dirtyBound();
+	}
+	modified();
+}
+
+} } // namespace declarations
@@ -0,0 +1,201 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifndef __ORBIS_SHALLOWWATERHEIGHTFIELD_HPP__
+#define __ORBIS_SHALLOWWATERHEIGHTFIELD_HPP__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+#include <vector>
+
+#include <math.hpp>
+#include <gridwater.hpp>
+
+namespace Orbis {
+
+	namespace Drawable {
+
+/*!
+ * \brief A water layer over a terrain, solving the shallow water
+ * equations with an explicit finite volume scheme.
+ *
+ * Each grid point is the centre of a cell holding a depth and the two
+ * components of the discharge. The fluxes between cells are Rusanov
+ * fluxes of states rebuilt by the hydrostatic reconstruction of Audusse
+ * et al., so still water stays still over any bottom and the depths
+ * never become negative, which lets the water flood and leave dry
+ * ground. The borders of the grid are walls.
+ *
+ * Every cell is updated from the previous state of its neighbours only,
+ * so the grid is split in tiles of TileSize^2 cells that are updated by
+ * the threads of the crew. Only the tiles holding water, plus a ring of
+ * dry ones around them, are updated. A step is made of as many substeps
+ * as the CFL condition asks for, up to a limit; the time left is carried
+ * over to the next steps, so the water lags behind but loses no time.
+ */
+class ShallowWaterHeightField : public GridWater {
+public:
+	// OpenSceneGraph stuff
+	META_Object(Orbis, ShallowWaterHeightField)
+
+	//! Constructor.
+	ShallowWaterHeightField();
+
+	/*!
+	 * \brief Copy constructor.
+	 * \param field The original water height field.
+	 * \param copyOp Tells how the copy must be done.
+	 */
+	ShallowWaterHeightField(const ShallowWaterHeightField& field,
+			const osg::CopyOp& copyOp = osg::CopyOp::SHALLOW_COPY);
+
+	/*!
+	 * \brief This is the most-used constructor.
+	 * \param origin The lower-left origin of the height field.
+	 * \param xstep Spacing between samples in the x direction.
+	 * \param ystep Spacing between samples in the y direction.
+	 * \param xsize Number of samples in the x direction.
+	 * \param ysize Number of samples in the y direction.
+	 */
+	ShallowWaterHeightField(const Orbis::Util::Point& origin,
+						double xstep, double ystep,
+							unsigned xsize, unsigned ysize);
+
+	/*!
+	 * \brief Calculates the next state.
+	 *
+	 * The strength of the sources is the volume of water they pour
+	 * each second.
+	 * \param time The elapsed time.
+	 */
+	void evolve(unsigned long time);
+
+	/*!
+	 * \brief Has the water stopped moving?
+	 * \return True if no depth changed more than the sleep threshold
+	 * during the last step.
+	 */
+	bool quiescent() const;
+
+protected:
+	//! destructor
+	virtual ~ShallowWaterHeightField();
+
+private:
+	// side of the tiles
+	static const unsigned TileSize = 16;
+	// most substeps in a step, the time left is carried over
+	static const unsigned MaxSubsteps = 200;
+	// lag, in seconds, beyond which the water is reported as too slow
+	static const double MaxLag;
+	// cells shallower than this are dry, and their water doesn't move
+	static const double DryDepth;
+	// fraction of the largest stable substep that is taken
+	static const double Courant;
+
+	// what a thread found in its share of a substep
+	struct Share {
+		// largest wave speeds along x and y and largest depth change
+		double speed_x, speed_y, activity;
+	};
+
+	// the job of the crew in each substep
+	struct StepJob : public Orbis::Util::WorkCrew::Job {
+		StepJob(ShallowWaterHeightField *water, bool commit)
+			: _water(water), _commit(commit) {}
+		void work(unsigned index, unsigned count);
+		private: ShallowWaterHeightField *_water; bool _commit;
+	};
+	friend struct StepJob;
+
+	// depth and discharges of each cell, and their next values
+	DoubleVector _h, _hu, _hv;
+	DoubleVector _next_h, _next_hu, _next_hv;
+	// number of tiles in each direction
+	unsigned _tiles_x, _tiles_y;
+	// tiles with water, and those plus their neighbours
+	std::vector<char> _wet, _active;
+	// what each thread found in the last substep
+	std::vector<Share> _shares;
+	// largest wave speeds along x and y in the current state
+	double _speed_x, _speed_y;
+	// the current substep, in seconds
+	double _dt;
+	// time left to simulate from the previous steps, in seconds
+	double _lag;
+	// was the lag reported?
+	bool _lag_reported;
+	// largest depth change in the last step
+	double _activity;
+
+	// pours the water of the sources into the cells
+	void pour(double tstep);
+
+	// activates the wet tiles and their neighbours
+	void spreadWetTiles();
+
+	// calculates the next state of the cells of a tile
+	void updateTile(unsigned tx, unsigned ty, Share& s);
+
+	// makes the next state of the cells of a tile the current one
+	void commitTile(unsigned tx, unsigned ty);
+
+	// sets the surface to the current depths
+	void raiseSurface();
+
+	// the velocity of a cell
+	double velocity(double h, double q) const;
+};
+
+inline ShallowWaterHeightField::ShallowWaterHeightField()
+	: GridWater(), _tiles_x(0), _tiles_y(0), _speed_x(0.0), _speed_y(0.0),
+		_dt(0.0), _activity(Orbis::Math::Omega)
+{
+}
+
+inline ShallowWaterHeightField::ShallowWaterHeightField(
+				const ShallowWaterHeightField& field,
+					const osg::CopyOp& copyOp)
+	: GridWater(field, copyOp), _tiles_x(0), _tiles_y(0),
+		_speed_x(0.0), _speed_y(0.0), _dt(0.0),
+			_activity(Orbis::Math::Omega)
+{
+}
+
+inline ShallowWaterHeightField::~ShallowWaterHeightField()
+{
+}
+
+inline double ShallowWaterHeightField::velocity(double h, double q) const
+{
+	return h > DryDepth ? q / h : 0.0;
+}
+
+inline bool ShallowWaterHeightField::quiescent() const
+{
+	return _activity < sleepThreshold();
+}
+
+} } // namespace declarations
+
+#endif  // __ORBIS_SHALLOWWATERHEIGHTFIELD_HPP__
@@ -23,15 +23,24 @@
 #pragma implementation
 #endif
 
+#include <math.hpp>
 #include <stamwatervolume.hpp>
 
+using std::abs;
+using Orbis::Math::min;
+using Orbis::Math::max;
+
 namespace Orbis {
 
 	namespace Drawable {
 
+const double StamWaterVolume::OccupancyEpsilon = 1.0e-6;
+
 StamWaterVolume::StamWaterVolume(const Orbis::Util::Point& point,
 									unsigned size,	double step)
-	: WaterVolume(point, size, size, size, step, step, step), _diff(0.0)
+	: WaterVolume(point, size, size, size, step, step, step),
+		_diff(0.0), _advection(SemiLagrangian),
+			_activity(Orbis::Math::Omega)
 {
 	unsigned size3 = sizeX() * sizeY() * sizeZ();
 
@@ -55,6 +64,13 @@ StamWaterVolume::StamWaterVolume(const Orbis::Util::Point& point,
 		_u_prev[i] = _v_prev[i] = _w_prev[i] = 0.0;
 		_dens[i] = _dens_prev[i] = _dens_buf[i] = 0.0;
 	}
+
+	// everything is empty at the beginning
+	_bricks_x = (sizeX() + BrickSize - 1) / BrickSize;
+	_bricks_y = (sizeY() + BrickSize - 1) / BrickSize;
+	_bricks_z = (sizeZ() + BrickSize - 1) / BrickSize;
+	_dens_mask.resize(_bricks_x * _bricks_y * _bricks_z, false);
+	_vel_mask.resize(_bricks_x * _bricks_y * _bricks_z, false);
 }
 
 StamWaterVolume::~StamWaterVolume()
@@ -67,12 +83,31 @@ void StamWaterVolume::evolve(unsigned long time)
 	const Vector g(0.0, 0.0, -9.81);
 
 	double dt = time / 1000.0;
-	unsigned size = sizeX() * sizeY() * sizeZ();
 
-	// initial state
-	for(unsigned i = 0; i < size; i++) {
-		_w_prev[i] = dt * g.z();
-		_dens_prev[i] = _u_prev[i] = _v_prev[i] = 0.0;
+	// initial state, outside the active bricks everything is already zero
+	BrickList::const_iterator it;
+	for(it = _vel_bricks.begin(); it != _vel_bricks.end(); it++) {
+		clear_brick(*it, _u_prev);
+		clear_brick(*it, _v_prev);
+		clear_brick(*it, _w_prev);
+	}
+	for(it = _dens_bricks.begin(); it != _dens_bricks.end(); it++) {
+		clear_brick(*it, _dens_prev);
+	}
+
+	update_occupancy(dt);
+
+	// gravity pulls wherever there is something to be pulled
+	for(it = _dens_bricks.begin(); it != _dens_bricks.end(); it++) {
+		unsigned lo[3], hi[3];
+		span(*it, false, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					_w_prev[i3d(i, j, k)] = dt * g.z();
+				}
+			}
+		}
 	}
 
 	// adding sources to vectors
@@ -90,6 +125,22 @@ void StamWaterVolume::evolve(unsigned long time)
 	vel_step(_u, _v, _w, _u_prev, _v_prev, _w_prev, viscosity(), dt);
 	dens_step(_dens, _dens_prev, _u, _v, _w, _diff, dt);
 
+	// measuring how much has changed since the last step
+	_activity = 0.0;
+	for(it = _vel_bricks.begin(); it != _vel_bricks.end(); it++) {
+		unsigned lo[3], hi[3];
+		span(*it, false, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					unsigned l = i3d(i, j, k);
+					_activity = max(_activity, abs(_dens[l] - _dens_buf[l]),
+								max(abs(_u[l]), abs(_v[l]), abs(_w[l])));
+				}
+			}
+		}
+	}
+
 	/*
 	 * Locking is only needed when swaping the updated velocities and
 	 * the buffered ones, which is a very fast operation
@@ -102,30 +153,205 @@ void StamWaterVolume::evolve(unsigned long time)
 	swap(_dens, _dens_buf);
 }
 
-void StamWaterVolume::add_sources(DoubleVector& x,
-								const DoubleVector& srcs, double dt) const
+void StamWaterVolume::span(unsigned b, bool interior,
+								unsigned lo[3], unsigned hi[3]) const
+{
+	unsigned size[3] = { sizeX(), sizeY(), sizeZ() };
+	unsigned bidx[3];
+
+	bidx[0] = b % _bricks_x;
+	bidx[1] = (b / _bricks_x) % _bricks_y;
+	bidx[2] = b / (_bricks_x * _bricks_y);
+	for(unsigned d = 0; d < 3; d++) {
+		lo[d] = bidx[d] * BrickSize;
+		hi[d] = min(lo[d] + BrickSize, size[d]);
+		// the boundary layer is left for set_bounds
+		if(interior) {
+			lo[d] = max(lo[d], 1u);
+			hi[d] = min(hi[d], size[d] - 1);
+		}
+	}
+}
+
+void StamWaterVolume::clear_brick(unsigned b, DoubleVector& x) const
 {
-	unsigned size = sizeX() * sizeY() * sizeZ();
+	unsigned lo[3], hi[3];
 
-	for(unsigned i = 0; i < size; i++) {
-		x[i] += srcs[i];
+	span(b, false, lo, hi);
+	for(unsigned k = lo[2]; k < hi[2]; k++) {
+		for(unsigned j = lo[1]; j < hi[1]; j++) {
+			for(unsigned i = lo[0]; i < hi[0]; i++) {
+				x[i3d(i, j, k)] = 0.0;
+			}
+		}
+	}
+}
+
+void StamWaterVolume::update_occupancy(double dt)
+{
+	unsigned nbricks = _bricks_x * _bricks_y * _bricks_z;
+	// how far, in cells, a velocity of one moves things in this step
+	double dt0 = dt * sizeX();
+
+	/*
+	 * Only bricks next to the active ones may have anything in them,
+	 * every other brick is known to be zero, so only those are examined.
+	 */
+	std::vector<bool> near(nbricks, false), dens(nbricks, false),
+											vel(nbricks, false);
+	for(unsigned b = 0; b < nbricks; b++) {
+		if(!_dens_mask[b] && !_vel_mask[b]) {
+			continue;
+		}
+		unsigned bi = b % _bricks_x;
+		unsigned bj = (b / _bricks_x) % _bricks_y;
+		unsigned bk = b / (_bricks_x * _bricks_y);
+		for(unsigned nk = (bk ? bk-1 : 0); nk <= min(bk+1, _bricks_z-1); nk++) {
+			for(unsigned nj = (bj ? bj-1 : 0); nj <= min(bj+1, _bricks_y-1); nj++) {
+				for(unsigned ni = (bi ? bi-1 : 0); ni <= min(bi+1, _bricks_x-1); ni++) {
+					near[(nk * _bricks_y + nj) * _bricks_x + ni] = true;
+				}
+			}
+		}
+	}
+
+	// largest density and velocity of each brick
+	for(unsigned b = 0; b < nbricks; b++) {
+		if(!near[b]) {
+			continue;
+		}
+		double maxd = 0.0, maxv = 0.0;
+		unsigned lo[3], hi[3];
+		span(b, false, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					unsigned l = i3d(i, j, k);
+					maxd = max(maxd, abs(_dens[l]), abs(_dens_buf[l]));
+					maxv = max(maxv,
+						max(abs(_u[l]), abs(_v[l]), abs(_w[l])),
+						max(abs(_u_buf[l]), abs(_v_buf[l]), abs(_w_buf[l])));
+				}
+			}
+		}
+		/*
+		 * Where things move faster than a brick per step, density may be
+		 * brought from farther than the neighbouring bricks.
+		 */
+		dens[b] = maxd > OccupancyEpsilon || maxv * dt0 >= BrickSize;
+		vel[b] = dens[b] || maxv > OccupancyEpsilon;
+	}
+
+	// the sources are always active
+	for(SourceIterator it = sources(); it != sourcesEnd(); it++) {
+		unsigned i, j, k;
+		if(locate(it->position(), &i, &j, &k)) {
+			unsigned b = ((k / BrickSize) * _bricks_y +
+							j / BrickSize) * _bricks_x + i / BrickSize;
+			dens[b] = vel[b] = true;
+		}
+	}
+
+	// dilating by one brick
+	std::vector<bool> dens_mask(nbricks, false), vel_mask(nbricks, false);
+	for(unsigned b = 0; b < nbricks; b++) {
+		if(!dens[b] && !vel[b]) {
+			continue;
+		}
+		unsigned bi = b % _bricks_x;
+		unsigned bj = (b / _bricks_x) % _bricks_y;
+		unsigned bk = b / (_bricks_x * _bricks_y);
+		for(unsigned nk = (bk ? bk-1 : 0); nk <= min(bk+1, _bricks_z-1); nk++) {
+			for(unsigned nj = (bj ? bj-1 : 0); nj <= min(bj+1, _bricks_y-1); nj++) {
+				for(unsigned ni = (bi ? bi-1 : 0); ni <= min(bi+1, _bricks_x-1); ni++) {
+					unsigned n = (nk * _bricks_y + nj) * _bricks_x + ni;
+					if(dens[b]) {
+						dens_mask[n] = true;
+					}
+					if(vel[b]) {
+						vel_mask[n] = true;
+					}
+				}
+			}
+		}
+	}
+
+	// bricks left behind are emptied for good
+	_dens_bricks.clear();
+	_vel_bricks.clear();
+	for(unsigned b = 0; b < nbricks; b++) {
+		if(near[b] && !dens_mask[b]) {
+			clear_brick(b, _dens);
+			clear_brick(b, _dens_prev);
+		}
+		if(near[b] && !vel_mask[b]) {
+			clear_brick(b, _u);
+			clear_brick(b, _v);
+			clear_brick(b, _w);
+			clear_brick(b, _u_prev);
+			clear_brick(b, _v_prev);
+			clear_brick(b, _w_prev);
+		}
+		if(dens_mask[b]) {
+			_dens_bricks.push_back(b);
+		}
+		if(vel_mask[b]) {
+			_vel_bricks.push_back(b);
+		}
+	}
+
+	// the buffered fields are the ones being drawn
+	Locker lock(this);
+	for(unsigned b = 0; b < nbricks; b++) {
+		if(near[b] && !dens_mask[b]) {
+			clear_brick(b, _dens_buf);
+		}
+		if(near[b] && !vel_mask[b]) {
+			clear_brick(b, _u_buf);
+			clear_brick(b, _v_buf);
+			clear_brick(b, _w_buf);
+		}
+	}
+	_dens_mask.swap(dens_mask);
+	_vel_mask.swap(vel_mask);
+}
+
+void StamWaterVolume::add_sources(DoubleVector& x, const DoubleVector& srcs,
+							double dt, const BrickList& bricks) const
+{
+	BrickList::const_iterator it;
+	for(it = bricks.begin(); it != bricks.end(); it++) {
+		unsigned lo[3], hi[3];
+		span(*it, false, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					x[i3d(i, j, k)] += srcs[i3d(i, j, k)];
+				}
+			}
+		}
 	}
 }
 
 void StamWaterVolume::diffuse(int b, DoubleVector& x, DoubleVector& x0,
-						 						double diff, double dt) const
+				double diff, double dt, const BrickList& bricks) const
 {
 	double a = dt * diff * Orbis::Math::cub(sizeX());
 
 	for(unsigned l = 0; l < 20; l++) {
-		for(unsigned i = 1; i < sizeX() - 1; i++) {
-			for(unsigned j = 1; j < sizeY() - 1; j++) {
-				for(unsigned k = 1; k < sizeZ() - 1; k++) {
-					x[i3d(i, j, k)] =
-						(x0[i3d(i, j, k)] +
-							a *(x[i3d(i-1, j, k)] + x[i3d(i+1, j, k)] +
-								x[i3d(i, j-1, k)] + x[i3d(i, j+1, k)] +
-								x[i3d(i, j, k-1)] + x[i3d(i, j, k+1)])) / (1+6*a);
+		BrickList::const_iterator it;
+		for(it = bricks.begin(); it != bricks.end(); it++) {
+			unsigned lo[3], hi[3];
+			span(*it, true, lo, hi);
+			for(unsigned k = lo[2]; k < hi[2]; k++) {
+				for(unsigned j = lo[1]; j < hi[1]; j++) {
+					for(unsigned i = lo[0]; i < hi[0]; i++) {
+						x[i3d(i, j, k)] =
+							(x0[i3d(i, j, k)] +
+								a *(x[i3d(i-1, j, k)] + x[i3d(i+1, j, k)] +
+									x[i3d(i, j-1, k)] + x[i3d(i, j+1, k)] +
+									x[i3d(i, j, k-1)] + x[i3d(i, j, k+1)])) / (1+6*a);
+					}
 				}
 			}
 		}
@@ -133,39 +359,104 @@ void StamWaterVolume::diffuse(int b, DoubleVector& x, DoubleVector& x0,
 	}
 }
 
+double StamWaterVolume::sample(const DoubleVector& d0,
+						double x, double y, double z,
+							double* lo, double* hi) const
+{
+	using Orbis::Math::clamp;
+
+	x = clamp(x, 0.5, sizeX() - 1.5);
+	int i0 = static_cast<int>(x);
+	int i1 = i0 + 1;
+	double s1 = x - i0;
+	double s0 = 1.0 - s1;
+	y = clamp(y, 0.5, sizeY() - 1.5);
+	int j0 = static_cast<int>(y);
+	int j1 = j0 + 1;
+	double t1 = y - j0;
+	double t0 = 1.0 - t1;
+	z = clamp(z, 0.5, sizeZ() - 1.5);
+	int k0 = static_cast<int>(z);
+	int k1 = k0 + 1;
+	double r1 = z - k0;
+	double r0 = 1.0 - r1;
+
+	double d000 = d0[i3d(i0, j0, k0)], d001 = d0[i3d(i0, j0, k1)];
+	double d010 = d0[i3d(i0, j1, k0)], d011 = d0[i3d(i0, j1, k1)];
+	double d100 = d0[i3d(i1, j0, k0)], d101 = d0[i3d(i1, j0, k1)];
+	double d110 = d0[i3d(i1, j1, k0)], d111 = d0[i3d(i1, j1, k1)];
+
+	// range of the values used, for limiting
+	if(lo && hi) {
+		*lo = min(min(min(d000, d001), min(d010, d011)),
+					min(min(d100, d101), min(d110, d111)));
+		*hi = max(max(max(d000, d001), max(d010, d011)),
+					max(max(d100, d101), max(d110, d111)));
+	}
+
+	return s0 * (t0 * (r0 * d000 + r1 * d001) + t1 * (r0 * d010 + r1 * d011)) +
+			s1 * (t0 * (r0 * d100 + r1 * d101) + t1 * (r0 * d110 + r1 * d111));
+}
+
 void StamWaterVolume::advect(int b, DoubleVector& d,
 						DoubleVector& d0, DoubleVector& u,
-						DoubleVector& v, DoubleVector& w, double dt) const
+						DoubleVector& v, DoubleVector& w, double dt,
+						const BrickList& bricks) const
 {
-	using Orbis::Math::clamp;
+	BrickList::const_iterator it;
+	unsigned lo[3], hi[3];
 
+	// first a semi-Lagrangian step, tracing back in time
 	double dt0 = dt * sizeX();
-	for(unsigned i = 1; i < sizeX() - 1; i++) {
-		for(unsigned j = 1; j < sizeY() - 1; j++) {
-			for(unsigned k = 1; k < sizeZ() - 1; k++) {
-				double x = i - dt0 * u[i3d(i, j, k)];
-				double y = j - dt0 * v[i3d(i, j, k)];
-				double z = k - dt0 * w[i3d(i, j, k)];
-				x = clamp(x, 0.5, sizeX() - 1.5);
-				int i0 = static_cast<int>(x);
-				int i1 = i0 + 1;
-				double s1 = x - i0;
-				double s0 = 1.0 - s1;
-				y = clamp(y, 0.5, sizeY() - 1.5);
-				int j0 = static_cast<int>(y);
-				int j1 = j0 + 1;
-				double t1 = y - j0;
-				double t0 = 1.0 - t1;
-				z = clamp(z, 0.5, sizeZ() - 1.5);
-				int k0 = static_cast<int>(z);
-				int k1 = k0 + 1;
-				double r1 = z - k0;
-				double r0 = 1.0 - r1;
-				d[i3d(i, j, k)] =
-					s0 * (t0 * (r0 * d0[i3d(i0, j0, k0)] + r1 * d0[i3d(i0, j0, k1)])  +
-                          t1 * (r0 * d0[i3d(i0, j1, k0)] + r1 * d0[i3d(i0, j1, k1)])) +
-					s1 * (t0 * (r0 * d0[i3d(i1, j0, k0)] + r1 * d0[i3d(i1, j0, k1)])  +
-                          t1 * (r0 * d0[i3d(i1, j1, k0)] + r1 * d0[i3d(i1, j1, k1)]));
+	for(it = bricks.begin(); it != bricks.end(); it++) {
+		span(*it, true, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					unsigned l = i3d(i, j, k);
+					d[l] = sample(d0, i - dt0 * u[l],
+									j - dt0 * v[l], k - dt0 * w[l]);
+				}
+			}
+		}
+	}
+
+	set_bounds(b, d);
+
+	if(_advection != MacCormack) {
+		return;
+	}
+
+	/*
+	 * MacCormack: the result is advected back to the present, and half
+	 * the error of that round trip is used to correct it.
+	 */
+	_back.resize(d.size());
+	for(it = bricks.begin(); it != bricks.end(); it++) {
+		span(*it, true, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					unsigned l = i3d(i, j, k);
+					_back[l] = sample(d, i + dt0 * u[l],
+									j + dt0 * v[l], k + dt0 * w[l]);
+				}
+			}
+		}
+	}
+	for(it = bricks.begin(); it != bricks.end(); it++) {
+		span(*it, true, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					unsigned l = i3d(i, j, k);
+					double dmin, dmax;
+					sample(d0, i - dt0 * u[l], j - dt0 * v[l],
+										k - dt0 * w[l], &dmin, &dmax);
+					// clamping to the stencil keeps it stable
+					d[l] = Orbis::Math::clamp(
+								d[l] + 0.5 * (d0[l] - _back[l]), dmin, dmax);
+				}
 			}
 		}
 	}
@@ -175,16 +466,23 @@ void StamWaterVolume::advect(int b, DoubleVector& d,
 
 void StamWaterVolume::project(DoubleVector& u,
 				 			DoubleVector& v, DoubleVector& w,
-								DoubleVector& p, DoubleVector& div) const
+								DoubleVector& p, DoubleVector& div,
+									const BrickList& bricks) const
 {
+	BrickList::const_iterator it;
+	unsigned lo[3], hi[3];
+
 	double h = 1.0 / sizeX();
-	for(unsigned i = 1; i < sizeX() - 1; i++) {
-		for(unsigned j = 1; j < sizeY() - 1; j++) {
-			for(unsigned k = 1; k < sizeZ() - 1; k++) {
-				div[i3d(i, j, k)] = -0.5 * h * (u[i3d(i+1, j, k)] - u[i3d(i-1, j, k)] +
-							                    v[i3d(i, j+1, k)] - v[i3d(i, j-1, k)] +
-										        w[i3d(i, j, k+1)] - w[i3d(i, j, k-1)]);
-				p[i3d(i, j, k)] = 0.0;
+	for(it = bricks.begin(); it != bricks.end(); it++) {
+		span(*it, true, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					div[i3d(i, j, k)] = -0.5 * h * (u[i3d(i+1, j, k)] - u[i3d(i-1, j, k)] +
+								                    v[i3d(i, j+1, k)] - v[i3d(i, j-1, k)] +
+											        w[i3d(i, j, k+1)] - w[i3d(i, j, k-1)]);
+					p[i3d(i, j, k)] = 0.0;
+				}
 			}
 		}
 	}
@@ -193,31 +491,37 @@ void StamWaterVolume::project(DoubleVector& u,
 	set_bounds(0, p);
 
 	for(unsigned l = 0; l < 20; l++) {
-		for(unsigned i = 1; i < sizeX() - 1; i++) {
-			for(unsigned j = 1; j < sizeY() - 1; j++) {
-				for(unsigned k = 1; k < sizeZ() - 1; k++) {
-					p[i3d(i, j, k)] = (div[i3d(i, j, k)] +
-									p[i3d(i-1, j, k)] +
-									p[i3d(i+1, j, k)] +
-									p[i3d(i, j-1, k)] +
-									p[i3d(i, j+1, k)] +
-									p[i3d(i, j, k-1)] +
-									p[i3d(i, j, k+1)]) / 6.0;
+		for(it = bricks.begin(); it != bricks.end(); it++) {
+			span(*it, true, lo, hi);
+			for(unsigned k = lo[2]; k < hi[2]; k++) {
+				for(unsigned j = lo[1]; j < hi[1]; j++) {
+					for(unsigned i = lo[0]; i < hi[0]; i++) {
+						p[i3d(i, j, k)] = (div[i3d(i, j, k)] +
+										p[i3d(i-1, j, k)] +
+										p[i3d(i+1, j, k)] +
+										p[i3d(i, j-1, k)] +
+										p[i3d(i, j+1, k)] +
+										p[i3d(i, j, k-1)] +
+										p[i3d(i, j, k+1)]) / 6.0;
+					}
 				}
 			}
 		}
 		set_bounds(0, p);
 	}
 
-	for(unsigned i = 1; i < sizeX() - 1; i++) {
-		for(unsigned j = 1; j < sizeY() - 1; j++) {
-			for(unsigned k = 1; k < sizeZ() - 1; k++) {
-				u[i3d(i, j, k)] -=
-					0.5 * (p[i3d(i+1, j, k)] - p[i3d(i-1, j, k)]) * sizeX();
-				v[i3d(i, j, k)] -=
-					0.5 * (p[i3d(i, j+1, k)] - p[i3d(i, j-1, k)]) * sizeY();
-				w[i3d(i, j, k)] -=
-					0.5 * (p[i3d(i, j, k+1)] - p[i3d(i, j, k-1)]) * sizeZ();
+	for(it = bricks.begin(); it != bricks.end(); it++) {
+		span(*it, true, lo, hi);
+		for(unsigned k = lo[2]; k < hi[2]; k++) {
+			for(unsigned j = lo[1]; j < hi[1]; j++) {
+				for(unsigned i = lo[0]; i < hi[0]; i++) {
+					u[i3d(i, j, k)] -=
+						0.5 * (p[i3d(i+1, j, k)] - p[i3d(i-1, j, k)]) * sizeX();
+					v[i3d(i, j, k)] -=
+						0.5 * (p[i3d(i, j+1, k)] - p[i3d(i, j-1, k)]) * sizeY();
+					w[i3d(i, j, k)] -=
+						0.5 * (p[i3d(i, j, k+1)] - p[i3d(i, j, k-1)]) * sizeZ();
+				}
 			}
 		}
 	}
@@ -329,11 +633,11 @@ void StamWaterVolume::dens_step(DoubleVector& d, DoubleVector& d0,
 						DoubleVector& u, DoubleVector& v,
 						DoubleVector& w, double diff, double dt) const
 {
-	add_sources(d, d0, dt);
+	add_sources(d, d0, dt, _dens_bricks);
 	swap(d, d0);
-	diffuse(0, d, d0, diff, dt);
+	diffuse(0, d, d0, diff, dt, _dens_bricks);
 	swap(d, d0);
-	advect(0, d, d0, u, v, w, dt);
+	advect(0, d, d0, u, v, w, dt, _dens_bricks);
 }
 
 void StamWaterVolume::vel_step(DoubleVector& u, DoubleVector& v,
@@ -341,23 +645,23 @@ void StamWaterVolume::vel_step(DoubleVector& u, DoubleVector& v,
 							DoubleVector& v0, DoubleVector& w0,
 										double visc, double dt) const
 {
-	add_sources(u, u0, dt);
-	add_sources(v, v0, dt);
-	add_sources(w, w0, dt);
+	add_sources(u, u0, dt, _vel_bricks);
+	add_sources(v, v0, dt, _vel_bricks);
+	add_sources(w, w0, dt, _vel_bricks);
 	swap(u, u0);
 	swap(v, v0);
 	swap(w, w0);
-	diffuse(1, u, u0, visc, dt);
-	diffuse(2, v, v0, visc, dt);
-	diffuse(3, w, w0, visc, dt);
-	project(u, v, w, u0, v0);
+	diffuse(1, u, u0, visc, dt, _vel_bricks);
+	diffuse(2, v, v0, visc, dt, _vel_bricks);
+	diffuse(3, w, w0, visc, dt, _vel_bricks);
+	project(u, v, w, u0, v0, _vel_bricks);
 	swap(u, u0);
 	swap(v, v0);
 	swap(w, w0);
-	advect(1, u, u0, u0, v0, w0, dt);
-	advect(2, v, v0, u0, v0, w0, dt);
-	advect(3, w, w0, u0, v0, w0, dt);
-	project(u, v, w, u0, v0);
+	advect(1, u, u0, u0, v0, w0, dt, _vel_bricks);
+	advect(2, v, v0, u0, v0, w0, dt, _vel_bricks);
+	advect(3, w, w0, u0, v0, w0, dt, _vel_bricks);
+	project(u, v, w, u0, v0, _vel_bricks);
 }
 
 } } // namespace declarations
@@ -38,9 +38,23 @@ namespace Orbis {
  * 
  * The algorythm used here, one developed by Jos Stam, is indeed general for
  * all fluids. The volume is divided in cubic cells.
+ *
+ * The cells are grouped in bricks of BrickSize^3 cells. Only the bricks
+ * that contain some density or motion, plus a ring of one brick around
+ * them, are simulated; all the others are kept at exactly zero.
  */
 class StamWaterVolume : public WaterVolume {
 public:
+	/*!
+	 * \brief The schemes available for the advection step.
+	 */
+	enum Advection {
+		//! First-order semi-Lagrangian, very stable but diffusive
+		SemiLagrangian,
+		//! Second-order MacCormack, limited to the trilinear stencil
+		MacCormack
+	};
+
 	/*!
 	 * \brief Default constructor.
 	 */
@@ -98,29 +112,76 @@ public:
 	 */
 	void setDiffuse(double diff);
 
+	/*!
+	 * \brief Queries the advection scheme.
+	 * \return The advection scheme.
+	 */
+	Advection advection() const;
+
+	/*!
+	 * \brief Sets the advection scheme.
+	 *
+	 * The MacCormack scheme costs about three times as much as the
+	 * semi-Lagrangian one, but keeps much more detail, so a coarser grid
+	 * may be used for the same results.
+	 * \param adv The new advection scheme.
+	 */
+	void setAdvection(Advection adv);
+
 	/*!
 	 * \brief Updates the water volume state.
 	 * \param time The time slice.
 	 */
 	void evolve(unsigned long time);
 
+	/*!
+	 * \brief Has the fluid come to rest?
+	 * \return True if both the largest velocity component and the largest
+	 * density change of the last step are below the sleep threshold.
+	 */
+	bool quiescent() const;
+
 private:
+	// list of brick indices
+	typedef std::vector<unsigned> BrickList;
+
+	// edge of a brick, in cells
+	static const unsigned BrickSize = 8;
+
+	// values below this are considered empty
+	static const double OccupancyEpsilon;
+
+	// finds the cells spanned by a brick
+	void span(unsigned b, bool interior, unsigned lo[3], unsigned hi[3]) const;
+
+	// sets all the cells of a brick to zero
+	void clear_brick(unsigned b, DoubleVector& x) const;
+
+	// finds out which bricks must be simulated in this step
+	void update_occupancy(double dt);
+
 	// adds from source
-	void add_sources(DoubleVector& x,
-				 		const DoubleVector& srcs, double dt) const;
+	void add_sources(DoubleVector& x, const DoubleVector& srcs,
+						double dt, const BrickList& bricks) const;
 
 	// diffuses through fluid
-	void diffuse(int b, DoubleVector& x,
-						DoubleVector& x0, double diff, double dt) const;
+	void diffuse(int b, DoubleVector& x, DoubleVector& x0,
+				double diff, double dt, const BrickList& bricks) const;
+
+	// interpolates a field at grid coordinates, gives the stencil's range
+	double sample(const DoubleVector& d0, double x, double y, double z,
+						double* lo = 0, double* hi = 0) const;
 
 	// advects by fluid
 	void advect(int b, DoubleVector& d,
 				DoubleVector& d0, DoubleVector& u,
-					DoubleVector& v, DoubleVector& w, double dt) const;
+					DoubleVector& v, DoubleVector& w, double dt,
+						const BrickList& bricks) const;
 
 	// projects field onto mass-conserving one
 	void project(DoubleVector& u, DoubleVector& v,
-				 DoubleVector& w, DoubleVector &p, DoubleVector& div) const;
+				 DoubleVector& w, DoubleVector &p, DoubleVector& div,
+				 		const BrickList& bricks) const;
 
 	// sets the boundary conditions
 	void set_bounds(int b, DoubleVector& x) const;
@@ -137,6 +198,12 @@ private:
 
 	// diffusion rate
 	double _diff;
+	// advection scheme
+	Advection _advection;
+	// scratch space for the MacCormack advection
+	mutable DoubleVector _back;
+	// largest velocity or density change in the last step
+	double _activity;
 	// density in each element
 	DoubleVector _dens;
 	// previous density
@@ -147,6 +214,12 @@ private:
 	DoubleVector _u_prev, _v_prev, _w_prev;
 	// buffering because of multithreading
 	DoubleVector _dens_buf, _u_buf, _v_buf, _w_buf;
+	// number of bricks in each direction
+	unsigned _bricks_x, _bricks_y, _bricks_z;
+	// bricks with density or motion, dilated by one brick
+	std::vector<bool> _dens_mask, _vel_mask;
+	// the same, as lists
+	BrickList _dens_bricks, _vel_bricks;
 };
 
 inline double StamWaterVolume::density(unsigned i, unsigned j, unsigned k) const
@@ -166,6 +239,21 @@ inline Vector StamWaterVolume::velocity(unsigned i, unsigned j, unsigned k) cons
 	return Vector(_u_buf[l], _v_buf[l], _w_buf[l]);
 }
 
+inline bool StamWaterVolume::quiescent() const
+{
+	return _activity < sleepThreshold();
+}
+
+inline StamWaterVolume::Advection StamWaterVolume::advection() const
+{
+	return _advection;
+}
+
+inline void StamWaterVolume::setAdvection(Advection adv)
+{
+	_advection = adv;
+}
+
 inline double StamWaterVolume::diffuse() const
 {
 	return _diff;
@@ -24,6 +24,8 @@
 
 #include <map>
 
+#include <osg/ref_ptr>
+
 #include <vector.hpp>
 #include <dynamic.hpp>
 #include <heightfield.hpp>
@@ -134,6 +136,11 @@ public:
 	 */
 	WaterBase();
 
+	/*!
+	 * \brief Destructor.
+	 */
+	virtual ~WaterBase();
+
 	/*!
 	 * \brief Adds a new source of water.
 	 * \param s The source of water.
@@ -170,25 +177,33 @@ public:
 	virtual void setBottom(const HeightField* const bottom);
 
 private:
-	// bottom
-	const HeightField *_bottom;
+	// bottom, kept alive as long as the water is
+	osg::ref_ptr<const HeightField> _bottom;
 	// list of water sources/sinks
 	SourceList _source_list;
 };
 
 inline WaterBase::WaterBase()
-	: _bottom(0)
 {
 }
 
+inline WaterBase::~WaterBase()
+{
+	if(_bottom.valid()) {
+		_bottom->removeDependent(this);
+	}
+}
+
 inline void WaterBase::addSource(const Source& s)
 {
 	_source_list.push_back(s);
+	wake();
 }
 
 inline void WaterBase::addSink(const Source& s)
 {
 	_source_list.push_back(s);
+	wake();
 }
 
 inline SourceIterator WaterBase::sources() const
@@ -203,12 +218,28 @@ inline SourceIterator WaterBase::sourcesEnd() const
 
 inline const HeightField* WaterBase::bottom() const
 {
-	return _bottom;
+	return _bottom.get();
 }
 
 inline void WaterBase::setBottom(const HeightField* const bottom)
 {
-	_bottom = bottom;
+	// the old bottom is kept alive until it has forgotten this object
+	osg::ref_ptr<const HeightField> old = _bottom;
+	{
+		// the Timer may be evolving over the old bottom
+		Locker lock(this);
+		_bottom = bottom;
+	}
+
+	// outside the lock, as the bottoms wake their dependents holding
+	// their own
+	if(old.valid()) {
+		old->removeDependent(this);
+	}
+	if(bottom) {
+		bottom->addDependent(this);
+	}
+	wake();
 }
 
 } } //namespace declarations
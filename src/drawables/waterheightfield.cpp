@@ -23,120 +23,38 @@
 #pragma implementation
 #endif
 
-#include <osg/Material>
-#include <osg/BlendFunc>
-#include <osg/PolygonOffset>
-
 #include <math.hpp>
 #include <waterheightfield.hpp>
 
 using std::abs;
+using Orbis::Math::min;
 using Orbis::Math::max;
 using Orbis::Math::sqr;
-using Orbis::Math::isZero;
 
-/*!
- * \brief Solves for a vector \a u the tridiagonal linear set.
- * \a a, \a b, \a c, \a r are the input vectors and are not modified.
- * Taken from Numerical Recipes.
- */
-static int triag(double* a, double* b, double* c,
-			 	double *r, double *u, double *gam, unsigned long n)
-{
-	double bet = b[0];
-	if(isZero(bet)) {
-		return -1;
-	}
-	u[0] = r[0] / bet;
-	// decomposition and forward substitution
-	for(unsigned j = 1; j < n; j++) {
-		gam[j] = c[j-1] / bet;
-		bet = b[j] - a[j] * gam[j];
-		// algorithm fails
-		if(isZero(bet)) {
-			return -1;
-		}
-		u[j] = (r[j] - a[j]*u[j-1]) / bet;
-	}
-	// backsubstitution
-	for(unsigned j = n - 2; j > 0; j--)
-		u[j] -= gam[j+1] * u[j+1];
-	u[0] -= gam[1] * u[1];
-
-	return 0;
-}
+// the water film left over dry ground
+static const double Epsilon = 0.0;
+// gravity
+static const double Gravity = 10.0;
 
 namespace Orbis {
 
 	namespace Drawable {
 
-void WaterHeightField::locate(const Point& p, unsigned *i, unsigned *j) const
-{
-	double x = floor((p.x() - origin().x()) / stepX());
-	double y = floor((p.y() - origin().y()) / stepY());
-
-	*i = static_cast<unsigned>(x);
-	*j = static_cast<unsigned>(y);
-}
-
 WaterHeightField::WaterHeightField(const Point& origin,
 							double stepX, double stepY,
 								unsigned samplesX, unsigned samplesY)
-	: GridHeightField(origin, stepX, stepY, samplesX, samplesY),
-				_old_z(0), _e(0), _f(0), _r(0), _u(0), _g(0)
-						
+	: GridWater(origin, stepX, stepY, samplesX, samplesY),
+				_old_z(0), _tiles_x(0), _tiles_y(0), _wet_valid(false),
+					_activity(Orbis::Math::Omega)
 {
-	// auxiliary vectors
-	_e = new double[max(samplesX, samplesY)];
-	_f = new double[max(samplesX, samplesY)];
-	_r = new double[max(samplesX, samplesY)];
-	_u = new double[max(samplesX, samplesY)];
-	_g = new double[max(samplesX, samplesY)];
-
-	osg::StateSet *stateSet = getOrCreateStateSet();
-
-	// the water material
-	osg::Material *mat = new osg::Material;
-	osg::Vec4 amb_colour = osg::Vec4(0.2, 0.2, 0.2, 0.75);
-	osg::Vec4 dif_colour = osg::Vec4(0.0, 0.3, 0.7, 0.75);
-	osg::Vec4 spc_colour = osg::Vec4(0.8, 0.8, 0.8, 0.75);
-	mat->setShininess(osg::Material::FRONT_AND_BACK, 100.0);
-	mat->setAmbient(osg::Material::FRONT_AND_BACK, amb_colour);
-	mat->setDiffuse(osg::Material::FRONT_AND_BACK, dif_colour);
-	mat->setSpecular(osg::Material::FRONT_AND_BACK, spc_colour);
-	stateSet->setAttribute(mat);
-
-	// activating blending in this drawable, so the water is transparent
-	stateSet->setMode(GL_BLEND, osg::StateAttribute::ON);
-	stateSet->setMode(GL_LIGHTING, osg::StateAttribute::ON);
-	stateSet->setMode(GL_DEPTH_TEST, osg::StateAttribute::ON);
-	stateSet->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
-	osg::BlendFunc *bf = new osg::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	stateSet->setAttribute(bf);
-
-	// using polygon offsets to avoid z-fighting with the terrain
-	stateSet->setMode(GL_POLYGON_OFFSET_FILL, osg::StateAttribute::ON);
-	osg::PolygonOffset *po = new osg::PolygonOffset(3.0, 3.0);
-	stateSet->setAttribute(po);
-
-	setUseDisplayList(false);
 }
 
 WaterHeightField::~WaterHeightField()
 {
-	delete [] _e;
-	delete [] _f;
-	delete [] _r;
-	delete [] _u;
-	delete [] _g;
 }
 
 void WaterHeightField::evolve(unsigned long time)
 {
-	// epsilon
-	const double e = 0.0;
-	// gravity
-	const double g = 10.0;
 	// time step in seconds
 	double tstep = time / 1000.0;
 
@@ -144,20 +62,32 @@ void WaterHeightField::evolve(unsigned long time)
 
 	// no bottom, no simulation
 	if(!bottom()) {
+		_activity = 0.0;
 		return;
 	}
+	// the bottom is only sampled again when it changes, and then
+	// some water may be above or below the new bottom
+	if(resampleBottom()) {
+		_wet_valid = false;
+	}
+	_activity = 0.0;
 	if(!_old_z) {
+		_activity = Orbis::Math::Omega;
 		// first run, the "old" height field must be created...
 		_old_z = new FloatArray(numSamplesX() * numSamplesY());
 		// ... and initialised
 		for(unsigned i = 0; i < numSamplesX(); i++) {
 			for(unsigned j = 0; j < numSamplesY(); j++) {
-				Point p = point(i, j);
-				p = bottom()->point(p.x(), p.y());
-				setPoint(i, j, p.z() - e);
-				(*_old_z)[j * numSamplesX() + i] = p.z() - e;
+				setPoint(i, j, bed(i, j) - Epsilon);
+				(*_old_z)[j * numSamplesX() + i] = bed(i, j) - Epsilon;
 			}
 		}
+		// all dry
+		_tiles_x = (numSamplesX() + TileSize - 1) / TileSize;
+		_tiles_y = (numSamplesY() + TileSize - 1) / TileSize;
+		_wet.assign(_tiles_x * _tiles_y, false);
+		_active.assign(_tiles_x * _tiles_y, false);
+		_wet_valid = false;
 	}
 	// update surface using sources/sinks of water
 	// I'd use a bell-like function, but I'd have to run
@@ -169,8 +99,15 @@ void WaterHeightField::evolve(unsigned long time)
 		Point p = it->position();
 		double val = it->strength();
 
+		// a flowing source keeps the water awake
+		_activity = max(_activity, abs(val));
+
 		// finding squared distances from p to grid points a, b, c, d
 		locate(p, &i, &j);
+		wetTile(  i,   j);
+		wetTile(  i, j+1);
+		wetTile(i+1, j+1);
+		wetTile(i+1,   j);
 		double a = (p - point(  i,   j)).sqrLength();
 		double b = (p - point(  i, j+1)).sqrLength();
 		double c = (p - point(i+1, j+1)).sqrLength();
@@ -192,127 +129,268 @@ void WaterHeightField::evolve(unsigned long time)
 			setPoint(i+1,   j, point(  i,   j).z() - d);
 		}
 	}
+	if(!_wet_valid) {
+		findWetTiles(true);
+		_wet_valid = true;
+	}
 	/// now the most important step, the differential solver ///
-	// I update first the rows
-	double fac = (g * sqr(tstep)) / (2.0 * sqr(stepX()));
-	for(unsigned j = 0; j < numSamplesY(); j++) {
-		Point h, b;
-		// depths
-		h = point(0, j);
-		b = bottom()->point(h.x(), h.y());
-		double d0 = max(0.0, h.z() - b.z());
-		h = point(1, j);
-		b = bottom()->point(h.x(), h.y());
-		double d1 = max(0.0, h.z() - b.z());
-		// some before the loop
-		_f[0] = -fac * (d0 + d1);
-		_e[0] = 1.0 + (d0 + d1) * fac;
-		_r[0] = 2.0 * point(0, j).z() - (*_old_z)[j*numSamplesX()];
-		for(unsigned i = 1; i < numSamplesX(); i++) {
-			double d2;
-			if(i == numSamplesX() - 1) {
-				d2 = -d1;
-			} else {
-				h = point(i+1, j);
-				b = bottom()->point(h.x(), h.y());
-				d2 = max(0.0, h.z() - b.z());
+	// I update first the rows...
+	spreadWetTiles();
+	sweep(true, (Gravity * sqr(tstep)) / (2.0 * sqr(stepX())));
+	findWetTiles(false);
+	// ... and then the columns
+	spreadWetTiles();
+	sweep(false, (Gravity * sqr(tstep)) / (2.0 * sqr(stepY())));
+	findWetTiles(false);
+	modified();
+	// the drawing thread only has to swap the new arrays in
+	fillArrays();
+}
+
+void WaterHeightField::sweep(bool rows, double fac)
+{
+	if(rows) {
+		_lines = numSamplesY();
+		_length = numSamplesX();
+		_line_stride = numSamplesX();
+		_sample_stride = 1;
+		_tiles = _tiles_x;
+		_tile_line_stride = _tiles_x;
+		_tile_stride = 1;
+	} else {
+		_lines = numSamplesX();
+		_length = numSamplesY();
+		_line_stride = 1;
+		_sample_stride = numSamplesX();
+		_tiles = _tiles_y;
+		_tile_line_stride = 1;
+		_tile_stride = _tiles_x;
+	}
+	_fac = fac;
+
+	_scratch.resize(crew().size());
+	SweepJob job(this);
+	crew().run(job);
+
+	// gathering the results of all threads
+	double act = _scratch[0].activity;
+	double lo = _scratch[0].min_elev;
+	double hi = _scratch[0].max_elev;
+	for(unsigned k = 1; k < _scratch.size(); k++) {
+		act = max(act, _scratch[k].activity);
+		lo = min(lo, _scratch[k].min_elev);
+		hi = max(hi, _scratch[k].max_elev);
+	}
+	_activity = max(_activity, act);
+	if(lo < _min_elev) {
+		_min_elev = lo;
+		dirtyBound();
+	}
+	if(hi > _max_elev) {
+		_max_elev = hi;
+		dirtyBound();
+	}
+}
+
+void WaterHeightField::SweepJob::work(unsigned index, unsigned count)
+{
+	_water->solveShare(index, count, _water->_scratch[index]);
+}
+
+void WaterHeightField::solveShare(unsigned index, unsigned count, Scratch& s)
+{
+	// each thread takes a contiguous run of batches
+	unsigned batches = (_lines + Lanes - 1) / Lanes;
+	unsigned first = batches * index / count;
+	unsigned last = batches * (index + 1) / count;
+
+	s.activity = 0.0;
+	s.min_elev = std::numeric_limits<double>::max();
+	s.max_elev = -std::numeric_limits<double>::max();
+	for(unsigned b = first; b < last; b++) {
+		unsigned lanes = min(_lines - b * Lanes, Lanes);
+		solveBatch(b * Lanes, lanes, s);
+	}
+}
+
+void WaterHeightField::findWetTiles(bool all)
+{
+	const FloatArray& z = *elevations();
+	const FloatArray& old = *_old_z;
+	const DoubleVector& ground = beds();
+
+	for(unsigned ty = 0; ty < _tiles_y; ty++) {
+		for(unsigned tx = 0; tx < _tiles_x; tx++) {
+			unsigned t = ty * _tiles_x + tx;
+			// the inactive tiles were left alone, so they are still dry
+			if(!all && !_active[t]) {
+				continue;
 			}
-			_f[i] = -fac * (d1 + d2);
-			_e[i] = 1.0 + (d0 + 2.0 * d1 + d2) * fac;
-			_r[i] = 2.0 * point(i, j).z() -
-					(*_old_z)[j*numSamplesX()+i];
-			d0 = d1;
-			d1 = d2;
-		}
-		// solving for this row
-		triag(_f-1, _e, _f, _r, _u, _g, numSamplesX());
-		// updating height field
-		for(unsigned i = 0; i < numSamplesX(); i++) {
-			h = point(i, j);
-			b = bottom()->point(h.x(), h.y());
-			if(_u[i] < b.z()) {
-				(*_old_z)[j * numSamplesX() + i] = b.z() - e;
-				setPoint(i, j, b.z() - e);
-			} else {
-				(*_old_z)[j * numSamplesX() + i] = point(i, j).z();
-				setPoint(i, j, _u[i]);
+			unsigned i1 = min((tx + 1) * TileSize, numSamplesX());
+			unsigned j1 = min((ty + 1) * TileSize, numSamplesY());
+			bool wet = false;
+			for(unsigned j = ty * TileSize; j < j1 && !wet; j++) {
+				for(unsigned i = tx * TileSize; i < i1; i++) {
+					unsigned idx = j * numSamplesX() + i;
+					// a dry sample lies still below its bottom
+					if(z[idx] > ground[idx] || z[idx] != old[idx]) {
+						wet = true;
+						break;
+					}
+				}
 			}
+			_wet[t] = wet;
 		}
 	}
-	// Now I'm gonna update the columns
-	fac = (g * sqr(tstep)) / (2.0 * sqr(stepY()));
-	for(unsigned i = 0; i < numSamplesX(); i++) {
-		Point h, b;
-		// depths
-		h = point(i, 0);
-		b = bottom()->point(h.x(), h.y());
-		double d0 = max(0.0, h.z() - b.z());
-		h = point(i, 1);
-		b = bottom()->point(h.x(), h.y());
-		double d1 = max(0.0, h.z() - b.z());
-		// some before the loop
-		_f[0] = -fac * (d0 + d1);
-		_e[0] = 1.0 + (d0 + d1) * fac;
-		_r[0] = 2.0 * point(i, 0).z() - (*_old_z)[i];
-		for(unsigned j = 1; j < numSamplesY(); j++) {
-			double d2;
-			if(j == numSamplesY() - 1) {
-				d2 = -d1;
-			} else {
-				h = point(i, j+1);
-				b = bottom()->point(h.x(), h.y());
-				d2 = max(0.0, h.z() - b.z());
+}
+
+/*
+ * The water advances at most one sample into dry ground in each sweep,
+ * so a ring of one tile around the wet ones is enough.
+ */
+void WaterHeightField::spreadWetTiles()
+{
+	_active.assign(_tiles_x * _tiles_y, false);
+	for(unsigned ty = 0; ty < _tiles_y; ty++) {
+		for(unsigned tx = 0; tx < _tiles_x; tx++) {
+			if(!_wet[ty * _tiles_x + tx]) {
+				continue;
 			}
-			_f[j] = -fac * (d1 + d2);
-			_e[j] = 1.0 + (d0 + 2.0 * d1 + d2) * fac;
-			_r[j] = 2.0 * point(i, j).z() -
-					(*_old_z)[j*numSamplesX()+i];
-			d0 = d1;
-			d1 = d2;
-		}
-		// solving for this column
-		triag(_f-1, _e, _f, _r, _u, _g, numSamplesY());
-		// updating height field
-		for(unsigned j = 0; j < numSamplesY(); j++) {
-			h = point(i, j);
-			b = bottom()->point(h.x(), h.y());
-			if(_u[j] < b.z()) {
-				(*_old_z)[j * numSamplesX() + i] = b.z() - e;
-				setPoint(i, j, b.z() - e);
-			} else {
-				(*_old_z)[j * numSamplesX() + i] = point(i, j).z();
-				setPoint(i, j, _u[j]);
+			unsigned x1 = min(tx + 2, _tiles_x);
+			unsigned y1 = min(ty + 2, _tiles_y);
+			for(unsigned y = ty > 0 ? ty - 1 : 0; y < y1; y++) {
+				for(unsigned x = tx > 0 ? tx - 1 : 0; x < x1; x++) {
+					_active[y * _tiles_x + x] = true;
+				}
 			}
 		}
 	}
 }
 
-void WaterHeightField::drawImplementation(osg::State& state) const
+/*
+ * Only the runs of active tiles along the lines are solved. Across the
+ * ends of a run both samples are dry, so the runs are independent of
+ * each other and of the samples outside them.
+ */
+void WaterHeightField::solveBatch(unsigned first, unsigned count, Scratch& s)
 {
-	Locker lock(this);
+	unsigned base = (first / TileSize) * _tile_line_stride;
+	unsigned t = 0;
+	while(t < _tiles) {
+		if(!_active[base + t * _tile_stride]) {
+			t++;
+			continue;
+		}
+		unsigned t0 = t;
+		while(t < _tiles && _active[base + t * _tile_stride]) {
+			t++;
+		}
+		unsigned start = t0 * TileSize;
+		unsigned end = min(t * TileSize, _length);
+		// a lone sample can only be dry and still
+		if(end - start > 1) {
+			solveSpan(first, count, start, end - start, s);
+		}
+	}
+}
 
-	// the grid is composed of a set of triangle strips
-	for(unsigned j = 0; j < numSamplesY() - 1; j++) {
-		glBegin(GL_TRIANGLE_STRIP);
-		for(unsigned i = 0; i < numSamplesX(); i++) {
-			Point p = point(i, j);
-			Vector n = normal(i, j);
-			// first point
-			glTexCoord2f(
-				static_cast<float>(i) / (numSamplesX() - 1),
-				static_cast<float>(j) / (numSamplesY() - 1));
-			glNormal3f(n.x(), n.y(), n.z());
-			glVertex3f(p.x(), p.y(), p.z());
-			// second point
-			p = point(i, j + 1);
-			n = normal(i, j + 1);
-			glTexCoord2f(
-				static_cast<float>(i) / (numSamplesX() - 1),
-				static_cast<float>(j+1) / (numSamplesY() - 1));
-			glNormal3f(n.x(), n.y(), n.z());
-			glVertex3f(p.x(), p.y(), p.z());
+/*
+ * Solves Lanes tridiagonal systems at once, with the Thomas algorithm
+ * taken from Numerical Recipes. Sample k of lane l lives at k * Lanes + l,
+ * so the inner loops run over the lanes and may be vectorised. For the
+ * columns this is also a transposed tile of the grid. The systems are
+ * diagonally dominant, so no pivot can vanish.
+ */
+void WaterHeightField::solveSpan(unsigned first, unsigned count,
+					unsigned start, unsigned n, Scratch& s)
+{
+	const double fac = _fac;
+	FloatArray& z = *elevations();
+	FloatArray& old = *_old_z;
+	const DoubleVector& ground = beds();
+
+	if(s.d.size() < n * Lanes) {
+		s.d.resize(n * Lanes);
+		s.e.resize(n * Lanes);
+		s.f.resize(n * Lanes);
+		s.r.resize(n * Lanes);
+		s.u.resize(n * Lanes);
+		s.g.resize(n * Lanes);
+	}
+	double *d = &s.d[0], *e = &s.e[0], *f = &s.f[0];
+	double *r = &s.r[0], *u = &s.u[0], *g = &s.g[0];
+
+	// depths and right-hand sides, the unused lanes repeat the last line
+	for(unsigned k = 0; k < n; k++) {
+		for(unsigned l = 0; l < Lanes; l++) {
+			unsigned line = first + (l < count ? l : count - 1);
+			unsigned idx = line * _line_stride +
+						(start + k) * _sample_stride;
+			d[k*Lanes + l] = max(0.0, z[idx] - ground[idx]);
+			r[k*Lanes + l] = 2.0 * z[idx] - old[idx];
+		}
+	}
+	// the diagonal and the upper diagonal, the lower one is f shifted
+	for(unsigned l = 0; l < Lanes; l++) {
+		f[l] = -fac * (d[l] + d[Lanes + l]);
+		e[l] = 1.0 + (d[l] + d[Lanes + l]) * fac;
+	}
+	for(unsigned k = 1; k < n - 1; k++) {
+		const double *d0 = d + (k-1) * Lanes;
+		const double *d1 = d + k * Lanes;
+		const double *d2 = d + (k+1) * Lanes;
+		for(unsigned l = 0; l < Lanes; l++) {
+			f[k*Lanes + l] = -fac * (d1[l] + d2[l]);
+			e[k*Lanes + l] = 1.0 + (d0[l] + 2.0 * d1[l] + d2[l]) * fac;
+		}
+	}
+	for(unsigned l = 0; l < Lanes; l++) {
+		// at the border, the depth beyond mirrors the last one
+		f[(n-1)*Lanes + l] = 0.0;
+		e[(n-1)*Lanes + l] = 1.0 + (d[(n-2)*Lanes + l] +
+						d[(n-1)*Lanes + l]) * fac;
+	}
+
+	// decomposition and forward substitution
+	double bet[Lanes];
+	for(unsigned l = 0; l < Lanes; l++) {
+		bet[l] = e[l];
+		u[l] = r[l] / bet[l];
+	}
+	for(unsigned k = 1; k < n; k++) {
+		for(unsigned l = 0; l < Lanes; l++) {
+			unsigned c = k * Lanes + l, p = c - Lanes;
+			g[c] = f[p] / bet[l];
+			bet[l] = e[c] - f[p] * g[c];
+			u[c] = (r[c] - f[p] * u[p]) / bet[l];
+		}
+	}
+	// backsubstitution
+	for(unsigned k = n - 1; k-- > 0; ) {
+		for(unsigned l = 0; l < Lanes; l++) {
+			u[k*Lanes + l] -= g[(k+1)*Lanes + l] * u[(k+1)*Lanes + l];
+		}
+	}
+
+	// updating height field, the water can't go below its bottom
+	for(unsigned k = 0; k < n; k++) {
+		for(unsigned l = 0; l < count; l++) {
+			unsigned idx = (first + l) * _line_stride +
+						(start + k) * _sample_stride;
+			double h = z[idx];
+			double b = ground[idx];
+			double v = u[k*Lanes + l];
+			if(v < b) {
+				v = b - Epsilon;
+				old[idx] = v;
+			} else {
+				old[idx] = h;
+			}
+			z[idx] = v;
+			s.activity = max(s.activity, abs(h - v));
+			s.min_elev = min(s.min_elev, v);
+			s.max_elev = max(s.max_elev, v);
 		}
-		glEnd();
 	}
 }
 
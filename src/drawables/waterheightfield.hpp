@@ -26,8 +26,10 @@
 #pragma interface
 #endif
 
-#include <waterbase.hpp>
-#include <gridheightfield.hpp>
+#include <vector>
+
+#include <math.hpp>
+#include <gridwater.hpp>
 
 namespace Orbis {
 
@@ -35,8 +37,15 @@ namespace Orbis {
 
 /*!
  * \brief This class represents a water layer over a terrain.
+ *
+ * Each step solves the rows and then the columns of the grid as
+ * independent tridiagonal systems. They are solved Lanes at a time, with
+ * their samples interleaved, and the batches may be split among a few
+ * threads. The grid is also split in tiles of TileSize^2 samples, and
+ * only the tiles holding water, plus a ring of dry ones around them
+ * into which the water may advance, are solved.
  */
-class WaterHeightField : public WaterBase, public GridHeightField {
+class WaterHeightField : public GridWater {
 public:
 	// OpenSceneGraph stuff
 	META_Object(Orbis, WaterHeightField)
@@ -71,34 +80,102 @@ public:
 	void evolve(unsigned long time);
 
 	/*!
-	 * \brief Draws this drawable.
-	 * \param state The rendering engine state.
+	 * \brief Has the surface stopped moving?
+	 * \return True if no height changed more than the sleep threshold
+	 * during the last step.
 	 */
-	virtual void drawImplementation(osg::State& state) const;
+	bool quiescent() const;
 
 protected:
 	//! destructor
 	virtual ~WaterHeightField();
 
 private:
+	// lines solved together
+	static const unsigned Lanes = 4;
+	// side of the tiles, a multiple of Lanes so a batch never
+	// straddles two rows of tiles
+	static const unsigned TileSize = 16;
+
+	// scratch space of a solving thread, with Lanes lines interleaved
+	struct Scratch {
+		DoubleVector d, e, f, r, u, g;
+		// largest height change and elevation bounds of its lines
+		double activity, min_elev, max_elev;
+	};
+
+	// the job of the crew in each sweep
+	struct SweepJob : public Orbis::Util::WorkCrew::Job {
+		SweepJob(WaterHeightField *water) : _water(water) {}
+		void work(unsigned index, unsigned count);
+		private: WaterHeightField *_water;
+	};
+	friend struct SweepJob;
+
 	// set of old heights
 	osg::ref_ptr<osg::FloatArray> _old_z;
-	// auxiliary vectors
-	double *_e, *_f, *_r, *_u, *_g;
-
-	// locates a point in the grid
-	void locate(const Orbis::Util::Point& p, unsigned *i, unsigned *j) const;
+	// scratch space of each solving thread
+	std::vector<Scratch> _scratch;
+	// the current sweep: number of lines, samples per line, distance
+	// between lines and between samples in a line, and coupling factor
+	unsigned _lines, _length, _line_stride, _sample_stride;
+	double _fac;
+	// the tiles along the lines of the current sweep: their number and
+	// the distance between lines of tiles and between tiles in a line
+	unsigned _tiles, _tile_line_stride, _tile_stride;
+	// number of tiles in each direction
+	unsigned _tiles_x, _tiles_y;
+	// tiles with water or moving samples, and those plus their neighbours
+	std::vector<bool> _wet, _active;
+	// must all tiles be checked for water again?
+	bool _wet_valid;
+	// largest height change in the last step
+	double _activity;
+
+	// solves all the rows or all the columns
+	void sweep(bool rows, double fac);
+
+	// solves a share of the current sweep
+	void solveShare(unsigned index, unsigned count, Scratch& s);
+
+	// solves a batch of up to Lanes lines of the current sweep
+	void solveBatch(unsigned first, unsigned count, Scratch& s);
+
+	// solves the samples [start, start + n) of a batch of lines
+	void solveSpan(unsigned first, unsigned count,
+				unsigned start, unsigned n, Scratch& s);
+
+	// checks the active tiles, or all of them, for water
+	void findWetTiles(bool all);
+
+	// activates the wet tiles and their neighbours
+	void spreadWetTiles();
+
+	// marks the tile of a grid point as wet
+	void wetTile(unsigned i, unsigned j);
 };
 
 inline WaterHeightField::WaterHeightField()
-	: GridHeightField()
+	: GridWater(), _tiles_x(0), _tiles_y(0), _wet_valid(false),
+		_activity(Orbis::Math::Omega)
 {
 }
 
 inline WaterHeightField::WaterHeightField(const WaterHeightField& field,
 						const osg::CopyOp& copyOp)
-	: GridHeightField(field, copyOp)
+	: GridWater(field, copyOp), _tiles_x(0), _tiles_y(0), _wet_valid(false),
+		_activity(Orbis::Math::Omega)
+{
+}
+
+inline void WaterHeightField::wetTile(unsigned i, unsigned j)
+{
+	_wet[(j / TileSize) * _tiles_x + i / TileSize] = true;
+}
+
+inline bool WaterHeightField::quiescent() const
 {
+	return _activity < sleepThreshold();
 }
 
 } } // namespace declarations
@@ -22,16 +22,30 @@
 #ifndef __ORBIS_DYNAMIC_HPP__
 #define __ORBIS_DYNAMIC_HPP__
 
+#include <vector>
+#include <algorithm>
+
 #include <OpenThreads/Mutex>
 
 namespace Orbis {
 
+	namespace Util {
+
+class Timer;
+
+	}
+
 /*!
  * \brief This class is the parent of all the dynamic objects.
  * 
  * Every object of the system which changes over time or needs to be notified
  * by the global Timer is a descendant of this class. As the Timer runs in
  * another thread, it has its own mutex.
+ *
+ * Objects that have settled down may be put to sleep by the Timer, which
+ * then stops calling evolve() on them until something wakes them up again:
+ * a new source, a change in the data they depend on or a change in one of
+ * their neighbours.
  */
 class Dynamic {
 public:
@@ -51,7 +65,54 @@ public:
 	 */
 	virtual void evolve(unsigned long time) = 0;
 
+	/*!
+	 * \brief Tells if the last call to evolve changed anything noticeable.
+	 *
+	 * The default implementation always returns false, so objects which
+	 * don't know how to measure their own activity are never put to sleep.
+	 * \return True if the object has settled down, false otherwise.
+	 * \sa sleepThreshold
+	 */
+	virtual bool quiescent() const;
+
+	/*!
+	 * \brief Is this object sleeping?
+	 * \return True if the Timer is not evolving this object.
+	 */
+	bool sleeping() const;
+
+	/*!
+	 * \brief Wakes this object up, so it's evolved again by the Timer.
+	 */
+	void wake();
+
+	/*!
+	 * \brief Makes this object and another one neighbours, each one
+	 * woken up whenever the other changes.
+	 *
+	 * The link is undone when either of them is destroyed.
+	 * \param d The neighbour object.
+	 */
+	void addNeighbour(Dynamic* d);
+
+	/*!
+	 * \brief The amount of change below which this object is considered
+	 * quiescent.
+	 * \return The threshold.
+	 * \sa setSleepThreshold
+	 */
+	double sleepThreshold() const;
+
+	/*!
+	 * \brief Sets the amount of change below which this object is
+	 * considered quiescent.
+	 * \param thr The new threshold. Zero or less never lets it sleep.
+	 * \sa sleepThreshold
+	 */
+	void setSleepThreshold(double thr);
+
 	friend class Locker;
+	friend class Orbis::Util::Timer;
 
 protected:
 
@@ -68,16 +129,125 @@ protected:
 	int unlock() const;
 
 private:
+	//! Number of consecutive quiescent steps before going to sleep
+	static const unsigned SleepDelay = 10;
+
+	//! Called by the Timer after each step of evolution
+	void settle();
+
+	//! Forgets a neighbour
+	void removeNeighbour(Dynamic* d);
+
 	//! To prevent the evolving from different threads
 	mutable OpenThreads::Mutex _mutex;
+	//! Is this object sleeping?
+	volatile bool _sleeping;
+	//! Consecutive steps that changed nothing
+	unsigned _quiet_steps;
+	//! Threshold used by quiescent()
+	double _sleep_thr;
+	//! Objects woken up by changes in this one
+	std::vector<Dynamic*> _neighbours;
 };
 
 inline Dynamic::Dynamic()
+	: _sleeping(false), _quiet_steps(0), _sleep_thr(1.0e-5)
 {
 }
 
 inline Dynamic::~Dynamic()
 {
+	std::vector<Dynamic*> neighbours = _neighbours;
+	std::vector<Dynamic*>::iterator it;
+	for(it = neighbours.begin(); it != neighbours.end(); it++) {
+		(*it)->removeNeighbour(this);
+	}
+}
+
+inline bool Dynamic::quiescent() const
+{
+	return false;
+}
+
+inline bool Dynamic::sleeping() const
+{
+	return _sleeping;
+}
+
+inline void Dynamic::wake()
+{
+	// the Timer counts the quiet steps in its own thread
+	lock();
+	_quiet_steps = 0;
+	_sleeping = false;
+	unlock();
+}
+
+inline void Dynamic::addNeighbour(Dynamic* d)
+{
+	if(!d || d == this) {
+		return;
+	}
+
+	// one lock at a time, so that two links never wait for each other
+	lock();
+	bool linked = std::find(_neighbours.begin(), _neighbours.end(), d) !=
+							_neighbours.end();
+	if(!linked) {
+		_neighbours.push_back(d);
+	}
+	unlock();
+	if(!linked) {
+		d->lock();
+		d->_neighbours.push_back(this);
+		d->unlock();
+	}
+}
+
+inline void Dynamic::removeNeighbour(Dynamic* d)
+{
+	lock();
+	_neighbours.erase(std::remove(_neighbours.begin(), _neighbours.end(), d),
+							_neighbours.end());
+	unlock();
+}
+
+inline double Dynamic::sleepThreshold() const
+{
+	return _sleep_thr;
+}
+
+inline void Dynamic::setSleepThreshold(double thr)
+{
+	lock();
+	_sleep_thr = thr;
+	unlock();
+	wake();
+}
+
+inline void Dynamic::settle()
+{
+	std::vector<Dynamic*> woken;
+
+	// a wake() from another thread restarts the count
+	lock();
+	if(_sleep_thr > 0.0 && quiescent()) {
+		// must stay quiet for a while before sleeping
+		if(++_quiet_steps >= SleepDelay) {
+			_sleeping = true;
+		}
+	} else {
+		_quiet_steps = 0;
+		woken = _neighbours;
+	}
+	unlock();
+
+	// I've changed, so my neighbours may change too, they are woken
+	// without holding my lock
+	std::vector<Dynamic*>::iterator it;
+	for(it = woken.begin(); it != woken.end(); it++) {
+		(*it)->wake();
+	}
 }
 
 inline int Dynamic::lock() const
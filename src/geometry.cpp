@@ -19,8 +19,14 @@
  * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
  */
 
+#include <cmath>
+#include <algorithm>
+
 #include <geometry.hpp>
 
+using Orbis::Math::min;
+using Orbis::Math::max;
+using Orbis::Math::clamp;
 using Orbis::Math::order;
 using Orbis::Math::areEqual;
 
@@ -71,6 +77,30 @@ bool intersectSegments(const Point& p1, const Point& p2,
 	return true;
 }
 
+/*
+ * finds where a side of a polygon crosses the horizontal line at height
+ * y, a side crosses it at most once, at its upper end but not its lower
+ * one, and horizontal sides never do
+ */
+static bool crossSide(const Point& p1, const Point& p2, double y, double& x)
+{
+	if(areEqual(p1.y(), p2.y())) {
+		return false;
+	}
+	double y1 = p1.y(), y2 = p2.y();
+	// is side vertical?
+	if(areEqual(p1.x(), p2.x())) {
+		x = p1.x();
+	} else {
+		double m = (y1 - y2) / (p1.x() - p2.x());
+		double c = y1 - m * p1.x();
+		x = (y - c) / m;
+	}
+	order(y1, y2);
+
+	return !areEqual(y, y1) && y <= y2 && y >= y1;
+}
+
 /* finds if point is inside the polygon */
 bool pointInPolygon(const Point& p, const PolyLine& poly)
 {
@@ -82,38 +112,124 @@ bool pointInPolygon(const Point& p, const PolyLine& poly)
 
 	Point p1 = poly.back();
 	for(PolyLineIterator p2 = poly.begin(); p2 != poly.end(); p2++) {
-		// a horizontal side doesn't change the result
-		if(areEqual(p1.y(), p2->y())) {
-			p1 = *p2;
-			continue;
+		double x;
+		if(crossSide(p1, *p2, p.y(), x) && p.x() < x) {
+			inter++;
 		}
-		// is side vertical?
-		if(areEqual(p1.x(), p2->x())) {
-			double y1 = p1.y(), y2 = p2->y();
-			order(y1, y2);
-			if(!areEqual(p.y(), y1) &&
-							 p.x() < p1.x() &&
-							 p.y() <= y2 &&
-							 p.y() >= y1) {
-				inter++;
-			}
-		} else {
-			double y1 = p1.y(), y2 = p2->y();
-			double m = (y1 - y2) / (p1.x() - p2->x());
-			double c = y1 - m * p1.x();
-			double x = (p.y() - c) / m;
-			order(y1, y2);
-			if(!areEqual(p.y(), y1) &&
-							 p.x() < x &&
-							 p.y() <= y2 &&
-							 p.y() >= y1) {
-				inter++;
+		p1 = *p2;
+	}
+
+	return inter % 2;
+}
+
+// a side of a polygon and the grid rows it may cross
+struct Edge {
+	Point p1, p2;
+	unsigned first, last;
+
+	bool operator<(const Edge& e) const
+	{
+		return first < e.first;
+	}
+};
+
+// the first sample of a grid line at or after x
+static unsigned firstAfter(double x, double x0, double dx, unsigned n)
+{
+	double guess = clamp(ceil((x - x0) / dx), 0.0, static_cast<double>(n));
+	unsigned i = static_cast<unsigned>(guess);
+	// the guess may be off by one, the samples are placed as the
+	// height fields place them
+	while(i > 0 && (i - 1) * dx + x0 >= x) {
+		i--;
+	}
+	while(i < n && i * dx + x0 < x) {
+		i++;
+	}
+	return i;
+}
+
+/* finds the samples of a grid inside a polygon */
+void rasterizePolygon(const PolyLine& poly, double x0, double y0,
+			double dx, double dy, unsigned nx, unsigned ny,
+						std::vector<Span>& spans)
+{
+	spans.clear();
+	if(poly.size() < 3 || nx == 0 || ny == 0) {
+		return;
+	}
+
+	// the edge table, each side with the rows its ends span, one more
+	// on each side for rounding
+	std::vector<Edge> edges;
+	Point p1 = poly.back();
+	for(PolyLineIterator p2 = poly.begin(); p2 != poly.end(); p2++) {
+		if(!areEqual(p1.y(), p2->y())) {
+			double lo = min(p1.y(), p2->y()), hi = max(p1.y(), p2->y());
+			double first = floor((lo - y0) / dy) - 1.0;
+			double last = ceil((hi - y0) / dy) + 1.0;
+			if(last >= 0.0 && first < ny) {
+				Edge e;
+				e.p1 = p1;
+				e.p2 = *p2;
+				e.first = static_cast<unsigned>(max(first, 0.0));
+				e.last = static_cast<unsigned>(min(last, ny - 1.0));
+				edges.push_back(e);
 			}
 		}
 		p1 = *p2;
 	}
+	if(edges.empty()) {
+		return;
+	}
+	std::sort(edges.begin(), edges.end());
 
-	return inter % 2;
+	// the active edges are those whose rows include the current one
+	std::vector<const Edge*> active;
+	std::vector<double> xs;
+	unsigned next = 0;
+	for(unsigned j = edges[0].first; j < ny; j++) {
+		while(next < edges.size() && edges[next].first <= j) {
+			active.push_back(&edges[next++]);
+		}
+		unsigned k = 0;
+		for(unsigned e = 0; e < active.size(); e++) {
+			if(active[e]->last >= j) {
+				active[k++] = active[e];
+			}
+		}
+		active.resize(k);
+		if(active.empty()) {
+			if(next == edges.size()) {
+				break;
+			}
+			continue;
+		}
+
+		// a sample is inside when an odd number of sides cross the
+		// row after it, the samples between every other pair of
+		// crossings from the right
+		double y = j * dy + y0;
+		xs.clear();
+		for(unsigned e = 0; e < active.size(); e++) {
+			double x;
+			if(crossSide(active[e]->p1, active[e]->p2, y, x)) {
+				xs.push_back(x);
+			}
+		}
+		std::sort(xs.begin(), xs.end());
+		for(int r = xs.size() - 1; r >= 0; r -= 2) {
+			unsigned first = r > 0 ? firstAfter(xs[r-1], x0, dx, nx) : 0;
+			unsigned last = firstAfter(xs[r], x0, dx, nx);
+			if(first < last) {
+				Span s;
+				s.row = j;
+				s.first = first;
+				s.last = last;
+				spans.push_back(s);
+			}
+		}
+	}
 }
 
 } } // namespace declarations
@@ -52,6 +52,38 @@ bool intersectSegments(const Point& p1, const Point& p2,
  */
 bool pointInPolygon(const Point& p, const PolyLine& poly);
 
+/*!
+ * \brief A run of samples in a row of a grid.
+ */
+struct Span {
+	//! The row.
+	unsigned row;
+	//! The first sample of the run.
+	unsigned first;
+	//! The sample just after the run.
+	unsigned last;
+};
+
+/*!
+ * \brief Finds the samples of a regular grid inside a polygon.
+ *
+ * The polygon is scanned a row at a time, only the sides crossing a
+ * row are looked at, so the cost grows with the rows the polygon spans
+ * and the samples it covers. A sample is inside exactly when
+ * pointInPolygon() says so.
+ * \param poly The polygon.
+ * \param x0 The x coordinate of the first sample of every row.
+ * \param y0 The y coordinate of the first row.
+ * \param dx The spacing between samples in a row.
+ * \param dy The spacing between rows.
+ * \param nx The number of samples in a row.
+ * \param ny The number of rows.
+ * \param spans The runs of samples inside the polygon, row after row.
+ */
+void rasterizePolygon(const PolyLine& poly, double x0, double y0,
+			double dx, double dy, unsigned nx, unsigned ny,
+						std::vector<Span>& spans);
+
 /*!
  * \brief Tests if a point is inside a rectangular volume.
  * \param p The point which will be tested.
@@ -0,0 +1,389 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifdef __GNUG__
+#pragma implementation
+#endif
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <math.hpp>
+#include <gridfilter.hpp>
+
+using Orbis::Math::sqr;
+using Orbis::Math::min;
+using Orbis::Math::max;
+using Orbis::Util::WorkCrew;
+
+// the part of n things done by a share of the work
+static void share(unsigned n, unsigned index, unsigned count,
+					unsigned& first, unsigned& last)
+{
+	first = n * index / count;
+	last = n * (index + 1) / count;
+}
+
+// convolves each row with a kernel
+class RowConvolveJob : public WorkCrew::Job {
+public:
+	RowConvolveJob(float *z, unsigned nx, unsigned ny,
+					const std::vector<float>& k)
+		: _z(z), _nx(nx), _ny(ny), _k(k)
+	{
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned first, last;
+		share(_ny, index, count, first, last);
+		int r = _k.size() / 2;
+		// a copy of the row, extended past its borders
+		std::vector<float> line(_nx + 2 * r);
+		for(unsigned j = first; j < last; j++) {
+			float *row = _z + j * _nx;
+			for(int i = 0; i < static_cast<int>(line.size()); i++) {
+				line[i] = row[max(0, min(i - r,
+						static_cast<int>(_nx) - 1))];
+			}
+			std::fill(row, row + _nx, 0.0f);
+			for(unsigned t = 0; t < _k.size(); t++) {
+				const float *in = &line[t];
+				float w = _k[t];
+				for(unsigned i = 0; i < _nx; i++) {
+					row[i] += w * in[i];
+				}
+			}
+		}
+	}
+
+private:
+	float *_z;
+	unsigned _nx, _ny;
+	const std::vector<float>& _k;
+};
+
+// convolves each column with a kernel, a tile of columns at a time
+class ColumnConvolveJob : public WorkCrew::Job {
+public:
+	ColumnConvolveJob(float *z, unsigned nx, unsigned ny, unsigned tile,
+					const std::vector<float>& k)
+		: _z(z), _nx(nx), _ny(ny), _tile(tile), _k(k)
+	{
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned tiles = (_nx + _tile - 1) / _tile;
+		unsigned first, last;
+		share(tiles, index, count, first, last);
+		int r = _k.size() / 2;
+		// a copy of the tile, extended past the first and last rows
+		std::vector<float> strip((_ny + 2 * r) * _tile);
+		for(unsigned t = first; t < last; t++) {
+			unsigned c0 = t * _tile;
+			unsigned w = min(_tile, _nx - c0);
+			for(int j = 0; j < static_cast<int>(_ny) + 2 * r; j++) {
+				const float *src = _z + max(0, min(j - r,
+					static_cast<int>(_ny) - 1)) * _nx + c0;
+				std::copy(src, src + w, &strip[j * w]);
+			}
+			for(unsigned j = 0; j < _ny; j++) {
+				float *row = _z + j * _nx + c0;
+				std::fill(row, row + w, 0.0f);
+				for(unsigned s = 0; s < _k.size(); s++) {
+					const float *in = &strip[(j + s) * w];
+					float k = _k[s];
+					for(unsigned c = 0; c < w; c++) {
+						row[c] += k * in[c];
+					}
+				}
+			}
+		}
+	}
+
+private:
+	float *_z;
+	unsigned _nx, _ny, _tile;
+	const std::vector<float>& _k;
+};
+
+// mixes each sample of the rows with the one before it
+class RowSweepJob : public WorkCrew::Job {
+public:
+	RowSweepJob(float *z, unsigned nx, unsigned ny, double k, bool forward)
+		: _z(z), _nx(nx), _ny(ny), _k(k), _forward(forward)
+	{
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned first, last;
+		share(_ny, index, count, first, last);
+		for(unsigned j = first; j < last; j++) {
+			float *row = _z + j * _nx;
+			if(_forward) {
+				for(unsigned i = 1; i < _nx; i++) {
+					row[i] = row[i] * (1 - _k) + row[i-1] * _k;
+				}
+			} else {
+				for(unsigned i = _nx - 1; i > 0; i--) {
+					row[i-1] = row[i-1] * (1 - _k) + row[i] * _k;
+				}
+			}
+		}
+	}
+
+private:
+	float *_z;
+	unsigned _nx, _ny;
+	double _k;
+	bool _forward;
+};
+
+// mixes each sample of the columns with the one before it, the tiles
+// are swept a whole row at a time
+class ColumnSweepJob : public WorkCrew::Job {
+public:
+	ColumnSweepJob(float *z, unsigned nx, unsigned ny, unsigned tile,
+						double k, bool forward)
+		: _z(z), _nx(nx), _ny(ny), _tile(tile), _k(k), _forward(forward)
+	{
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned tiles = (_nx + _tile - 1) / _tile;
+		unsigned first, last;
+		share(tiles, index, count, first, last);
+		for(unsigned t = first; t < last; t++) {
+			unsigned c0 = t * _tile;
+			unsigned w = min(_tile, _nx - c0);
+			for(unsigned n = 1; n < _ny; n++) {
+				unsigned j = _forward ? n : _ny - 1 - n;
+				float *row = _z + j * _nx + c0;
+				const float *prev = _forward ? row - _nx : row + _nx;
+				for(unsigned c = 0; c < w; c++) {
+					row[c] = row[c] * (1 - _k) + prev[c] * _k;
+				}
+			}
+		}
+	}
+
+private:
+	float *_z;
+	unsigned _nx, _ny, _tile;
+	double _k;
+	bool _forward;
+};
+
+// the bilateral filter, reading from a copy of the grid
+class BilateralJob : public WorkCrew::Job {
+public:
+	BilateralJob(const std::vector<float>& src, float *z,
+			unsigned nx, unsigned ny, int rx, int ry,
+			const std::vector<float>& weights, double range)
+		: _src(src), _z(z), _nx(nx), _ny(ny), _rx(rx), _ry(ry),
+			_weights(weights), _scale(-0.5 / sqr(range))
+	{
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned first, last;
+		share(_ny, index, count, first, last);
+		int nx = _nx, ny = _ny;
+		for(int j = first; j < static_cast<int>(last); j++) {
+			for(int i = 0; i < nx; i++) {
+				float z0 = _src[j * nx + i];
+				double sum = 0.0, total = 0.0;
+				const float *w = &_weights[0];
+				for(int b = -_ry; b <= _ry; b++) {
+					const float *row =
+						&_src[max(0, min(j + b, ny - 1)) * nx];
+					for(int a = -_rx; a <= _rx; a++, w++) {
+						float z = row[max(0, min(i + a, nx - 1))];
+						double f = *w * exp(_scale * sqr(z - z0));
+						sum += f * z;
+						total += f;
+					}
+				}
+				_z[j * nx + i] = sum / total;
+			}
+		}
+	}
+
+private:
+	const std::vector<float>& _src;
+	float *_z;
+	unsigned _nx, _ny;
+	int _rx, _ry;
+	// the spatial weights of the window, row after row
+	const std::vector<float>& _weights;
+	double _scale;
+};
+
+// finds the extreme elevations of each share of the rows
+class RangeJob : public WorkCrew::Job {
+public:
+	RangeJob(const float *z, unsigned nx, unsigned ny, unsigned shares)
+		: _z(z), _nx(nx), _ny(ny), _lo(shares), _hi(shares)
+	{
+	}
+
+	void work(unsigned index, unsigned count)
+	{
+		unsigned first, last;
+		share(_ny, index, count, first, last);
+		float lo = std::numeric_limits<float>::max();
+		float hi = -lo;
+		for(const float *z = _z + first * _nx; z < _z + last * _nx; z++) {
+			lo = min(lo, *z);
+			hi = max(hi, *z);
+		}
+		_lo[index] = lo;
+		_hi[index] = hi;
+	}
+
+	float lowest() const
+	{
+		return *std::min_element(_lo.begin(), _lo.end());
+	}
+
+	float highest() const
+	{
+		return *std::max_element(_hi.begin(), _hi.end());
+	}
+
+private:
+	const float *_z;
+	unsigned _nx, _ny;
+	std::vector<float> _lo, _hi;
+};
+
+namespace Orbis {
+
+	namespace Util {
+
+GridFilter::GridFilter(float *z, unsigned nx, unsigned ny, WorkCrew& crew)
+	: _z(z), _nx(nx), _ny(ny), _crew(crew)
+{
+}
+
+void GridFilter::convolve(const std::vector<float>& kx,
+					const std::vector<float>& ky)
+{
+	if(_nx == 0 || _ny == 0) {
+		return;
+	}
+
+	if(kx.size() > 1) {
+		RowConvolveJob rows(_z, _nx, _ny, kx);
+		_crew.run(rows);
+	}
+	if(ky.size() > 1) {
+		ColumnConvolveJob columns(_z, _nx, _ny, TileSize, ky);
+		_crew.run(columns);
+	}
+}
+
+void GridFilter::box(unsigned rx, unsigned ry)
+{
+	std::vector<float> kx(2 * rx + 1, 1.0f / (2 * rx + 1));
+	std::vector<float> ky(2 * ry + 1, 1.0f / (2 * ry + 1));
+
+	convolve(kx, ky);
+}
+
+void GridFilter::gaussianKernel(double s, std::vector<float>& k)
+{
+	// three deviations hold nearly all of the weight
+	int r = s > 0.0 ? static_cast<int>(ceil(3.0 * s)) : 0;
+	k.resize(2 * r + 1);
+	double total = 0.0;
+	for(int t = -r; t <= r; t++) {
+		k[t + r] = r > 0 ? exp(-0.5 * sqr(t / s)) : 1.0;
+		total += k[t + r];
+	}
+	for(unsigned t = 0; t < k.size(); t++) {
+		k[t] /= total;
+	}
+}
+
+void GridFilter::gaussian(double sx, double sy)
+{
+	std::vector<float> kx, ky;
+	gaussianKernel(sx, kx);
+	gaussianKernel(sy, ky);
+
+	convolve(kx, ky);
+}
+
+void GridFilter::bilateral(double sx, double sy, double range)
+{
+	if(_nx == 0 || _ny == 0 || range <= 0.0) {
+		return;
+	}
+
+	// the spatial weights, two deviations wide
+	int rx = sx > 0.0 ? static_cast<int>(ceil(2.0 * sx)) : 0;
+	int ry = sy > 0.0 ? static_cast<int>(ceil(2.0 * sy)) : 0;
+	std::vector<float> weights;
+	for(int b = -ry; b <= ry; b++) {
+		for(int a = -rx; a <= rx; a++) {
+			double d = (rx > 0 ? sqr(a / sx) : 0.0) +
+					(ry > 0 ? sqr(b / sy) : 0.0);
+			weights.push_back(exp(-0.5 * d));
+		}
+	}
+
+	std::vector<float> src(_z, _z + _nx * _ny);
+	BilateralJob job(src, _z, _nx, _ny, rx, ry, weights, range);
+	_crew.run(job);
+}
+
+void GridFilter::sweep(double k)
+{
+	if(_nx == 0 || _ny == 0) {
+		return;
+	}
+
+	RowSweepJob right(_z, _nx, _ny, k, true);
+	_crew.run(right);
+	ColumnSweepJob up(_z, _nx, _ny, TileSize, k, true);
+	_crew.run(up);
+	RowSweepJob left(_z, _nx, _ny, k, false);
+	_crew.run(left);
+	ColumnSweepJob down(_z, _nx, _ny, TileSize, k, false);
+	_crew.run(down);
+}
+
+void GridFilter::range(float& lo, float& hi)
+{
+	RangeJob job(_z, _nx, _ny, _crew.size());
+	_crew.run(job);
+
+	lo = job.lowest();
+	hi = job.highest();
+}
+
+} } // namespace declarations
@@ -0,0 +1,123 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifndef __ORBIS_GRIDFILTER_HPP__
+#define __ORBIS_GRIDFILTER_HPP__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+#include <vector>
+
+#include <workcrew.hpp>
+
+namespace Orbis {
+
+	namespace Util {
+
+/*!
+ * \brief Filters a grid of elevations in place.
+ *
+ * The grid is stored row after row. The separable filters run over the
+ * rows and then over the columns, the columns being done a tile at a
+ * time, so that the inner loops always walk along a row. The rows and
+ * the tiles are split among the threads of a crew. The samples past
+ * the borders repeat the border ones.
+ */
+class GridFilter {
+public:
+	/*!
+	 * \brief Constructor.
+	 * \param z The elevations, row after row.
+	 * \param nx The number of samples in a row.
+	 * \param ny The number of rows.
+	 * \param crew The threads that do the filtering.
+	 */
+	GridFilter(float *z, unsigned nx, unsigned ny, WorkCrew& crew);
+
+	/*!
+	 * \brief Convolves the grid with a separable kernel.
+	 * \param kx The kernel along the rows, of odd size.
+	 * \param ky The kernel along the columns, of odd size.
+	 */
+	void convolve(const std::vector<float>& kx, const std::vector<float>& ky);
+
+	/*!
+	 * \brief Averages the samples in a box around each sample.
+	 * \param rx The half width of the box, in samples.
+	 * \param ry The half height of the box, in samples.
+	 */
+	void box(unsigned rx, unsigned ry);
+
+	/*!
+	 * \brief Convolves the grid with a Gaussian.
+	 * \param sx The standard deviation along the rows, in samples.
+	 * \param sy The standard deviation along the columns, in samples.
+	 */
+	void gaussian(double sx, double sy);
+
+	/*!
+	 * \brief Smooths the grid but keeps the steps in it.
+	 *
+	 * Each sample becomes an average of its neighbours weighted both by
+	 * their distance and by their difference in elevation, so cliffs and
+	 * ridges are not blurred.
+	 * \param sx The spatial standard deviation along the rows, in samples.
+	 * \param sy The spatial standard deviation along the columns,
+	 * in samples.
+	 * \param range The standard deviation of the elevation differences.
+	 */
+	void bilateral(double sx, double sy, double range);
+
+	/*!
+	 * \brief Smooths the grid with four recursive sweeps.
+	 *
+	 * Each sample is mixed with the one before it, left to right, bottom
+	 * to top, right to left and top to bottom.
+	 * \param k The weight of the previous sample, between 0 and 1.
+	 */
+	void sweep(double k);
+
+	/*!
+	 * \brief Finds the extreme elevations of the grid.
+	 * \param lo The lowest elevation.
+	 * \param hi The highest elevation.
+	 */
+	void range(float& lo, float& hi);
+
+private:
+	// number of columns in a tile
+	static const unsigned TileSize = 64;
+
+	// the elevations
+	float *_z;
+	unsigned _nx, _ny;
+	// the threads
+	WorkCrew& _crew;
+
+	// a Gaussian kernel, or a single tap if the deviation is too small
+	static void gaussianKernel(double s, std::vector<float>& k);
+};
+
+} } // namespace declarations
+
+#endif  // __ORBIS_GRIDFILTER_HPP__
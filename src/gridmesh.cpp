@@ -0,0 +1,89 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifdef __GNUG__
+#pragma implementation
+#endif
+
+#include <math.hpp>
+#include <gridmesh.hpp>
+
+using Orbis::Math::min;
+
+// number of cells across a band, so that the first two rows of points
+// of a band, which are met interleaved, fit in a vertex cache of 16
+// entries, and each later row of points is transformed only once
+static const unsigned BandCells = 6;
+
+// fills the triangles with indices of any size
+template<class Elements>
+static void triangles(Elements& tris, unsigned nx, unsigned ny)
+{
+	typedef typename Elements::value_type Index;
+
+	tris.reserve(tris.size() + 6 * (nx - 1) * (ny - 1));
+	for(unsigned i0 = 0; i0 + 1 < nx; i0 += BandCells) {
+		unsigned i1 = min(i0 + BandCells, nx - 1);
+		for(unsigned j = 0; j + 1 < ny; j++) {
+			for(unsigned i = i0; i < i1; i++) {
+				Index a = j * nx + i, b = a + 1;
+				Index c = a + nx, d = c + 1;
+				tris.push_back(c);
+				tris.push_back(a);
+				tris.push_back(d);
+				tris.push_back(d);
+				tris.push_back(a);
+				tris.push_back(b);
+			}
+		}
+	}
+}
+
+namespace Orbis {
+
+	namespace Util {
+
+osg::PrimitiveSet* gridTriangles(unsigned nx, unsigned ny)
+{
+	if(nx < 2 || ny < 2) {
+		return 0;
+	}
+	if(nx * ny <= 65536) {
+		osg::DrawElementsUShort *tris =
+			new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES);
+		triangles(*tris, nx, ny);
+		return tris;
+	}
+	osg::DrawElementsUInt *tris =
+			new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES);
+	triangles(*tris, nx, ny);
+	return tris;
+}
+
+void gridTriangles(unsigned nx, unsigned ny, std::vector<GLuint>& tris)
+{
+	if(nx < 2 || ny < 2) {
+		return;
+	}
+	triangles(tris, nx, ny);
+}
+
+} } // namespace declarations
@@ -0,0 +1,66 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifndef __ORBIS_GRIDMESH_HPP__
+#define __ORBIS_GRIDMESH_HPP__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+#include <vector>
+
+#include <osg/PrimitiveSet>
+
+namespace Orbis {
+
+	namespace Util {
+
+/*!
+ * \brief The triangles of a grid of points, in a single primitive set.
+ *
+ * The points are stored row after row. The cells are walked in bands of
+ * a few columns, a row of each band at a time, so that the points shared
+ * with the row below are still in the vertex cache when they are used
+ * again. Each cell is split along the diagonal from its first point, and
+ * the triangles face up when the rows go up. The indices take 16 bits
+ * when there are few enough points.
+ * \param nx The number of points in a row.
+ * \param ny The number of rows.
+ * \return The triangles, or null if the grid has no cells.
+ */
+osg::PrimitiveSet* gridTriangles(unsigned nx, unsigned ny);
+
+/*!
+ * \brief The triangles of a grid of points, appended to a list of
+ * indices.
+ *
+ * The triangles are the ones of the primitive set, in the same order,
+ * for drawables that keep their indices themselves.
+ * \param nx The number of points in a row.
+ * \param ny The number of rows.
+ * \param tris The indices the triangles are appended to.
+ */
+void gridTriangles(unsigned nx, unsigned ny, std::vector<GLuint>& tris);
+
+} } // namespace declarations
+
+#endif // __ORBIS_GRIDMESH_HPP__
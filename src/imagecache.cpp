@@ -0,0 +1,373 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifdef __GNUG__
+#pragma implementation
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <osgDB/ReadFile>
+#include <OpenThreads/Thread>
+
+#include <cachefile.hpp>
+#include <imagecache.hpp>
+
+// the first bytes of the files of the disk cache
+static const char CacheMagic[Orbis::Util::MagicSize] =
+			{ 'O', 'R', 'B', 'I', 'S', 'I', 'M', '1' };
+
+// is a number a power of two?
+static bool isPowerOfTwo(unsigned n)
+{
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
+namespace Orbis {
+
+	namespace Util {
+
+ImageCache* ImageCache::_cache = 0;
+
+/*!
+ * \brief The thread of the cache. It reads the queued files, one at a
+ * time, and wakes up whoever is waiting for them.
+ */
+class ImageCache::Reader : public OpenThreads::Thread {
+public:
+	Reader(ImageCache *cache)
+		: _cache(cache)
+	{
+	}
+
+	virtual void run()
+	{
+		_cache->_mutex.lock();
+		for(;;) {
+			while(_cache->_queue.empty() && !_cache->_quit) {
+				_cache->_queued.wait(&_cache->_mutex);
+			}
+			if(_cache->_quit) {
+				break;
+			}
+			std::string filename = _cache->_queue.front();
+			_cache->_queue.pop_front();
+			time_t mtime = _cache->_entries[filename].mtime;
+			std::string dir = _cache->_directory;
+
+			// reading doesn't block the others
+			_cache->_mutex.unlock();
+			osg::ref_ptr<osg::Image> img = read(filename, mtime, dir);
+			_cache->_mutex.lock();
+
+			// the file may have been modified meanwhile, then it was
+			// queued again
+			Entry& e = _cache->_entries[filename];
+			if(e.mtime == mtime) {
+				e.image = img;
+				e.pending = false;
+			}
+			_cache->_read.broadcast();
+		}
+		_cache->_mutex.unlock();
+	}
+
+private:
+	ImageCache *_cache;
+};
+
+ImageCache::ImageCache()
+	: _reader(0), _quit(false)
+{
+	const char *home = getenv("HOME");
+	if(home) {
+		_directory = std::string(home) + "/.orbis/textures";
+	}
+}
+
+ImageCache::~ImageCache()
+{
+	if(_reader) {
+		_mutex.lock();
+		_quit = true;
+		_queued.signal();
+		_mutex.unlock();
+		_reader->join();
+		delete _reader;
+	}
+}
+
+void ImageCache::setDirectory(const std::string& dir)
+{
+	_mutex.lock();
+	_directory = dir;
+	_mutex.unlock();
+}
+
+void ImageCache::prefetch(const std::string& filename)
+{
+	_mutex.lock();
+	request(filename, false);
+	_mutex.unlock();
+}
+
+osg::ref_ptr<osg::Image> ImageCache::image(const std::string& filename)
+{
+	_mutex.lock();
+	Entry& e = request(filename, true);
+	while(e.pending) {
+		_read.wait(&_mutex);
+	}
+	osg::ref_ptr<osg::Image> img = e.image;
+	_mutex.unlock();
+
+	return img;
+}
+
+ImageCache::Entry& ImageCache::request(const std::string& filename,
+								bool urgent)
+{
+	// a file that can't be found now may still be found by osgDB in
+	// its data path, it is then read once and never written to disk
+	struct stat st;
+	time_t mtime = stat(filename.c_str(), &st) == 0 ? st.st_mtime : 0;
+
+	std::map<std::string, Entry>::iterator it = _entries.find(filename);
+	if(it != _entries.end() && it->second.mtime == mtime) {
+		// a file needed now goes before the prefetched ones
+		if(it->second.pending && urgent) {
+			std::deque<std::string>::iterator q =
+				std::find(_queue.begin(), _queue.end(), filename);
+			if(q != _queue.end()) {
+				_queue.erase(q);
+				_queue.push_front(filename);
+			}
+		}
+		return it->second;
+	}
+
+	Entry& e = _entries[filename];
+	e.mtime = mtime;
+	e.pending = true;
+	e.image = 0;
+	if(urgent) {
+		_queue.push_front(filename);
+	} else {
+		_queue.push_back(filename);
+	}
+
+	if(!_reader) {
+		_reader = new Reader(this);
+		_reader->start();
+	}
+	_queued.signal();
+
+	return e;
+}
+
+osg::Image* ImageCache::read(const std::string& filename, time_t mtime,
+						const std::string& dir)
+{
+	bool cached = mtime != 0 && !dir.empty();
+	std::string path;
+	if(cached) {
+		path = cacheFile(filename, mtime, dir);
+		osg::Image *img = readCached(path, filename, mtime);
+		if(img) {
+			return img;
+		}
+	}
+
+	osg::Image *img = osgDB::readImageFile(filename);
+	if(!img) {
+		return 0;
+	}
+
+	// the mipmaps are made once, here, and not by the driver every
+	// time the program starts
+	osg::Image *mip = mipmapped(*img);
+	if(!mip) {
+		return img;
+	}
+	// the image without mipmaps is freed on return
+	osg::ref_ptr<osg::Image> original = img;
+	if(cached) {
+		// the directory is created if needed
+		if(makeDirectory(dir)) {
+			writeCached(path, filename, mtime, *mip);
+		}
+	}
+
+	return mip;
+}
+
+std::string ImageCache::cacheFile(const std::string& filename, time_t mtime,
+						const std::string& dir)
+{
+	std::ostringstream name;
+	name << dir << '/' << std::hex << hash(filename) << '-'
+			<< static_cast<unsigned long>(mtime) << ".img";
+
+	return name.str();
+}
+
+osg::Image* ImageCache::readCached(const std::string& path,
+				const std::string& filename, time_t mtime)
+{
+	std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+	if(!in.is_open()) {
+		return 0;
+	}
+
+	// the file must be of the same image, at the same time
+	if(!getMagic(in, CacheMagic) ||
+			get<unsigned long>(in) != static_cast<unsigned long>(mtime)) {
+		return 0;
+	}
+	std::string name = getString(in);
+	if(!in || name != filename) {
+		return 0;
+	}
+
+	int s = get<int>(in), t = get<int>(in);
+	int internal_format = get<int>(in);
+	int pixel_format = get<int>(in), type = get<int>(in);
+	osg::Image::MipmapDataType offsets(get<unsigned>(in));
+	for(unsigned k = 0; k < offsets.size(); k++) {
+		offsets[k] = get<unsigned>(in);
+	}
+	unsigned size = get<unsigned>(in);
+	if(!in || s <= 0 || t <= 0) {
+		return 0;
+	}
+	unsigned char *data = new unsigned char[size];
+	in.read(reinterpret_cast<char*>(data), size);
+	if(!in) {
+		delete[] data;
+		return 0;
+	}
+
+	osg::Image *img = new osg::Image;
+	img->setImage(s, t, 1, internal_format, pixel_format, type, data,
+						osg::Image::USE_NEW_DELETE, 1);
+	img->setMipmapData(offsets);
+	img->setFileName(filename);
+
+	return img;
+}
+
+void ImageCache::writeCached(const std::string& path,
+				const std::string& filename, time_t mtime,
+						const osg::Image& img)
+{
+	// written aside, and named once complete
+	std::string temp = temporaryFile(path);
+	std::ofstream out(temp.c_str(), std::ios::out | std::ios::binary);
+	if(!out.is_open()) {
+		return;
+	}
+
+	putMagic(out, CacheMagic);
+	put<unsigned long>(out, mtime);
+	putString(out, filename);
+	put<int>(out, img.s());
+	put<int>(out, img.t());
+	put<int>(out, img.getInternalTextureFormat());
+	put<int>(out, img.getPixelFormat());
+	put<int>(out, img.getDataType());
+	const osg::Image::MipmapDataType& offsets = img.getMipmapData();
+	put<unsigned>(out, offsets.size());
+	for(unsigned k = 0; k < offsets.size(); k++) {
+		put<unsigned>(out, offsets[k]);
+	}
+	put<unsigned>(out, img.getTotalSizeInBytesIncludingMipmaps());
+	out.write(reinterpret_cast<const char*>(img.data()),
+				img.getTotalSizeInBytesIncludingMipmaps());
+	out.close();
+	finishFile(temp, path, !out.fail());
+}
+
+osg::Image* ImageCache::mipmapped(const osg::Image& img)
+{
+	// only plain 2D images of bytes, with sides that halve evenly
+	if(img.isMipmap() || img.r() != 1 ||
+			img.getDataType() != GL_UNSIGNED_BYTE ||
+			!isPowerOfTwo(img.s()) || !isPowerOfTwo(img.t())) {
+		return 0;
+	}
+
+	unsigned n = osg::Image::computeNumComponents(img.getPixelFormat());
+	unsigned s = img.s(), t = img.t();
+	// the levels are packed one after another, each one row after row
+	osg::Image::MipmapDataType offsets;
+	unsigned size = s * t * n;
+	for(unsigned w = s, h = t; w > 1 || h > 1; ) {
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+		offsets.push_back(size);
+		size += w * h * n;
+	}
+
+	unsigned char *data = new unsigned char[size];
+	for(unsigned j = 0; j < t; j++) {
+		memcpy(data + j * s * n, img.data(0, j), s * n);
+	}
+	// each texel of a level is the average of up to four of the one
+	// before it
+	unsigned char *src = data;
+	unsigned w = s, h = t;
+	for(unsigned l = 0; l < offsets.size(); l++) {
+		unsigned char *dst = data + offsets[l];
+		unsigned w2 = w > 1 ? w / 2 : 1, h2 = h > 1 ? h / 2 : 1;
+		unsigned dx = w > 1 ? n : 0, dy = h > 1 ? w * n : 0;
+		for(unsigned j = 0; j < h2; j++) {
+			const unsigned char *row = src + (h > 1 ? 2 * j : j) * w * n;
+			for(unsigned i = 0; i < w2; i++) {
+				const unsigned char *p = row + (w > 1 ? 2 * i : i) * n;
+				for(unsigned c = 0; c < n; c++) {
+					dst[(j * w2 + i) * n + c] = (p[c] + p[c + dx] +
+						p[c + dy] + p[c + dx + dy] + 2) / 4;
+				}
+			}
+		}
+		src = dst;
+		w = w2;
+		h = h2;
+	}
+
+	osg::Image *mip = new osg::Image;
+	mip->setImage(s, t, 1, img.getInternalTextureFormat(),
+			img.getPixelFormat(), GL_UNSIGNED_BYTE, data,
+						osg::Image::USE_NEW_DELETE, 1);
+	mip->setMipmapData(offsets);
+	mip->setFileName(img.getFileName());
+
+	return mip;
+}
+
+} } // namespace declarations
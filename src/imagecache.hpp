@@ -0,0 +1,176 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifndef __ORBIS_IMAGECACHE_HPP__
+#define __ORBIS_IMAGECACHE_HPP__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+#include <map>
+#include <deque>
+#include <string>
+#include <ctime>
+
+#include <osg/Image>
+#include <osg/ref_ptr>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+
+namespace Orbis {
+
+	namespace Util {
+
+/*!
+ * \brief Keeps the images read by the whole program.
+ *
+ * An image is read once for each file and modification time. It is
+ * read by a thread of the cache, so files can be asked for ahead of
+ * their use with prefetch(). The images read are also written to a
+ * disk cache, with their mipmaps, so they load faster the next time.
+ *
+ * Design patterns: singleton
+ */
+class ImageCache {
+public:
+	/*!
+	 * \brief Access the cache's unique instance.
+	 * \return The cache.
+	 */
+	static ImageCache* instance();
+
+	/*!
+	 * \brief Stops the reading thread and frees the images.
+	 */
+	static void shutdown();
+
+	/*!
+	 * \brief The directory of the disk cache.
+	 * \return The directory, empty if there is no disk cache.
+	 */
+	const std::string& directory() const;
+
+	/*!
+	 * \brief Sets the directory of the disk cache.
+	 * \param dir The directory, empty for no disk cache.
+	 */
+	void setDirectory(const std::string& dir);
+
+	/*!
+	 * \brief Starts reading an image in the background.
+	 * \param filename The name of the image file.
+	 */
+	void prefetch(const std::string& filename);
+
+	/*!
+	 * \brief The image in a file, waiting for it to be read if needed.
+	 *
+	 * The image is shared by everybody asking for the same file, and
+	 * stays alive while it is referenced, even if the file is read
+	 * again because it was modified.
+	 * \param filename The name of the image file.
+	 * \return The image, or null if it can't be read.
+	 */
+	osg::ref_ptr<osg::Image> image(const std::string& filename);
+
+private:
+	// an image file and what was read from it
+	struct Entry {
+		// modification time of the file when it was read
+		time_t mtime;
+		// still being read?
+		bool pending;
+		osg::ref_ptr<osg::Image> image;
+	};
+
+	// the thread reading the files
+	class Reader;
+	friend class Reader;
+
+	// the unique instance
+	static ImageCache* _cache;
+
+	// the files read or being read
+	std::map<std::string, Entry> _entries;
+	// the files waiting to be read
+	std::deque<std::string> _queue;
+	// protects all of the above
+	OpenThreads::Mutex _mutex;
+	// signalled when a file is queued or read
+	OpenThreads::Condition _queued, _read;
+	Reader *_reader;
+	// tells the reader to quit
+	bool _quit;
+	// directory of the disk cache
+	std::string _directory;
+
+	ImageCache();
+	~ImageCache();
+
+	// queues a file unless it was read since it was last modified,
+	// the mutex must be held
+	Entry& request(const std::string& filename, bool urgent);
+	// reads an image, from a disk cache directory if it's there
+	static osg::Image* read(const std::string& filename, time_t mtime,
+						const std::string& dir);
+	// the name of the file of an image in a disk cache directory
+	static std::string cacheFile(const std::string& filename, time_t mtime,
+						const std::string& dir);
+	// reads an image from a file of the disk cache
+	static osg::Image* readCached(const std::string& path,
+				const std::string& filename, time_t mtime);
+	// writes an image and its mipmaps to a file of the disk cache
+	static void writeCached(const std::string& path,
+				const std::string& filename, time_t mtime,
+						const osg::Image& img);
+	// a copy of an image with its mipmaps, or null if they can't
+	// be made
+	static osg::Image* mipmapped(const osg::Image& img);
+
+	// the cache can't be copied
+	ImageCache(const ImageCache&);
+	ImageCache& operator=(const ImageCache&);
+};
+
+inline ImageCache* ImageCache::instance()
+{
+	if(_cache == 0) {
+		_cache = new ImageCache;
+	}
+
+	return _cache;
+}
+
+inline void ImageCache::shutdown()
+{
+	delete _cache;
+	_cache = 0;
+}
+
+inline const std::string& ImageCache::directory() const
+{
+	return _directory;
+}
+
+} } // namespace declarations
+
+#endif  // __ORBIS_IMAGECACHE_HPP__
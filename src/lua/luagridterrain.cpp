@@ -24,11 +24,47 @@
 #endif
 
 #include <world.hpp>
+#include <imagecache.hpp>
 #include <luapoint.hpp>
+#include <luavector.hpp>
 #include <luapatch.hpp>
 #include <luagridterrain.hpp>
 
 using Orbis::Drawable::GridTerrain;
+using Orbis::Util::ImageCache;
+using Orbis::Util::Spline;
+
+/* the cross-section of a stamp, by its name */
+static GridTerrain::StampShape checkShape(lua_State* L, int index)
+{
+	std::string shape = luaL_checklstring(L, index, 0);
+
+	if(shape == "gaussian") {
+		return GridTerrain::Gaussian;
+	} else if(shape == "plateau") {
+		return GridTerrain::Plateau;
+	} else if(shape != "paraboloid") {
+		luaL_argerror(L, index, "unknown stamp shape");
+	}
+
+	return GridTerrain::Paraboloid;
+}
+
+/* how a stamp is combined with the terrain, by its name */
+static GridTerrain::StampMode checkMode(lua_State* L, int index)
+{
+	std::string mode = luaL_checklstring(L, index, 0);
+
+	if(mode == "raise") {
+		return GridTerrain::Raise;
+	} else if(mode == "add") {
+		return GridTerrain::Add;
+	} else if(mode != "lower") {
+		luaL_argerror(L, index, "unknown stamp mode");
+	}
+
+	return GridTerrain::Lower;
+}
 
 namespace Orbis {
 
@@ -41,10 +77,25 @@ const char LuaGridTerrain::className[] = "GridTerrain";
 const luaL_reg LuaGridTerrain::methods[] = {
 	method(LuaGridTerrain, addPatch),
 	method(LuaGridTerrain, faultLineGeneration),
+	method(LuaGridTerrain, diamondSquareGeneration),
+	method(LuaGridTerrain, noiseGeneration),
+	method(LuaGridTerrain, setGeneratorThreads),
+	method(LuaGridTerrain, setCacheResults),
 	method(LuaGridTerrain, smooth),
+	method(LuaGridTerrain, boxFilter),
+	method(LuaGridTerrain, gaussianFilter),
+	method(LuaGridTerrain, bilateralFilter),
+	method(LuaGridTerrain, stamp),
+	method(LuaGridTerrain, sweep),
 	method(LuaGridTerrain, point),
 	method(LuaGridTerrain, setPoint),
+	method(LuaGridTerrain, sample),
+	method(LuaGridTerrain, elevationRange),
+	method(LuaGridTerrain, intersect),
+	method(LuaGridTerrain, setLODError),
 	method(LuaGridTerrain, setTexture),
+	method(LuaGridTerrain, setSplatSize),
+	method(LuaGridTerrain, save),
 	method(LuaGridTerrain, addToWorld),
 	{0, 0}
 };
@@ -111,8 +162,17 @@ int LuaGridTerrain::create(lua_State* L)
 						static_cast<unsigned>(ysize));
 	} else {
 		const char* fname = luaL_checklstring(L, 1, 0);
-
-		t = new GridTerrain(fname);
+		double decimation = luaL_optnumber(L, 2, 1.0);
+		double column = luaL_optnumber(L, 3, 0.0);
+		double line = luaL_optnumber(L, 4, 0.0);
+		double columns = luaL_optnumber(L, 5, 0.0);
+		double lines = luaL_optnumber(L, 6, 0.0);
+
+		t = new GridTerrain(fname, static_cast<unsigned>(decimation),
+						static_cast<unsigned>(column),
+						static_cast<unsigned>(line),
+						static_cast<unsigned>(columns),
+						static_cast<unsigned>(lines));
 	}
 
 	t->ref();
@@ -145,6 +205,11 @@ int LuaGridTerrain::addPatch(lua_State* L)
 	Patch *p = LuaPatch::checkInstance(L, 2);
 
 	t->addPatch(*p);
+	// the texture is read while the script goes on
+	std::string texture = p->attribute("texture");
+	if(!texture.empty()) {
+		ImageCache::instance()->prefetch(texture);
+	}
 
 	return 0;
 }
@@ -154,8 +219,63 @@ int LuaGridTerrain::faultLineGeneration(lua_State* L)
 {
 	GridTerrain *t = checkInstance(L, 1);
 	double iters = luaL_checknumber(L, 2);
+	double seed = luaL_optnumber(L, 3, 0.0);
+
+	t->faultLineGeneration(static_cast<unsigned>(iters),
+				static_cast<unsigned long>(seed));
+
+	return 0;
+}
+
+/* adds a random terrain made by the diamond-square algorithm */
+int LuaGridTerrain::diamondSquareGeneration(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double amplitude = luaL_checknumber(L, 2);
+	double roughness = luaL_checknumber(L, 3);
+	double seed = luaL_optnumber(L, 4, 0.0);
+
+	t->diamondSquareGeneration(amplitude, roughness,
+				static_cast<unsigned long>(seed));
+
+	return 0;
+}
+
+/* adds fractal noise to the terrain */
+int LuaGridTerrain::noiseGeneration(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double amplitude = luaL_checknumber(L, 2);
+	double wavelength = luaL_checknumber(L, 3);
+	double octaves = luaL_checknumber(L, 4);
+	double persistence = luaL_optnumber(L, 5, 0.5);
+	double seed = luaL_optnumber(L, 6, 0.0);
+
+	t->noiseGeneration(amplitude, wavelength,
+				static_cast<unsigned>(octaves), persistence,
+				static_cast<unsigned long>(seed));
+
+	return 0;
+}
+
+/* sets the number of threads generating terrains */
+int LuaGridTerrain::setGeneratorThreads(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double n = luaL_checknumber(L, 2);
 
-	t->faultLineGeneration(static_cast<unsigned>(iters));
+	t->setGeneratorThreads(static_cast<unsigned>(n));
+
+	return 0;
+}
+
+/* sets whether the generated terrains are cached */
+int LuaGridTerrain::setCacheResults(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	luaL_checktype(L, 2, LUA_TBOOLEAN);
+
+	t->setCacheResults(lua_toboolean(L, 2));
 
 	return 0;
 }
@@ -171,6 +291,82 @@ int LuaGridTerrain::smooth(lua_State* L)
 	return 0;
 }
 
+/* averages the terrain over a box around each sample */
+int LuaGridTerrain::boxFilter(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double radius = luaL_checknumber(L, 2);
+
+	t->boxFilter(radius);
+
+	return 0;
+}
+
+/* convolves the terrain with a Gaussian */
+int LuaGridTerrain::gaussianFilter(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double sigma = luaL_checknumber(L, 2);
+
+	t->gaussianFilter(sigma);
+
+	return 0;
+}
+
+/* smooths the terrain but keeps its cliffs and ridges */
+int LuaGridTerrain::bilateralFilter(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double sigma = luaL_checknumber(L, 2);
+	double range = luaL_checknumber(L, 3);
+
+	t->bilateralFilter(sigma, range);
+
+	return 0;
+}
+
+/* stamps a shape on the terrain */
+int LuaGridTerrain::stamp(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	Point *centre = LuaPoint::checkInstance(L, 2);
+	double radius = luaL_checknumber(L, 3);
+	double height = luaL_checknumber(L, 4);
+	GridTerrain::StampShape shape = checkShape(L, 5);
+	GridTerrain::StampMode mode = checkMode(L, 6);
+
+	t->stamp(*centre, radius, height, shape, mode);
+
+	return 0;
+}
+
+/* sweeps a stamp along a spline through a table of points */
+int LuaGridTerrain::sweep(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	double radius = luaL_checknumber(L, 3);
+	double height = luaL_checknumber(L, 4);
+	GridTerrain::StampShape shape = checkShape(L, 5);
+	GridTerrain::StampMode mode = checkMode(L, 6);
+
+	// sixteen subdivisions between control points, unless told
+	unsigned count = luaL_getn(L, 2);
+	double subdivs = luaL_optnumber(L, 7,
+				count > 1 ? 16.0 * (count - 1) : 0.0);
+
+	Spline path(static_cast<int>(subdivs));
+	for(unsigned k = 0; k < count; k++) {
+		lua_rawgeti(L, 2, k + 1);
+		path.addCtrlPoint(*LuaPoint::checkInstance(L, lua_gettop(L)));
+		lua_pop(L, 1);
+	}
+
+	t->sweep(path, radius, height, shape, mode);
+
+	return 0;
+}
+
 /* retrieves the height of a point on the terrain */
 int LuaGridTerrain::point(lua_State* L)
 {
@@ -201,6 +397,93 @@ int LuaGridTerrain::setPoint(lua_State* L)
 	return 0;
 }
 
+/* retrieves the elevations at many points of the terrain */
+int LuaGridTerrain::sample(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+
+	// the coordinates come in two tables, x's and y's
+	unsigned count = luaL_getn(L, 2);
+	if(luaL_getn(L, 3) < static_cast<int>(count)) {
+		return luaL_argerror(L, 3, "too few y coordinates");
+	}
+	std::vector<double> xs(count), ys(count), zs(count);
+	for(unsigned k = 0; k < count; k++) {
+		lua_rawgeti(L, 2, k + 1);
+		xs[k] = lua_tonumber(L, -1);
+		lua_rawgeti(L, 3, k + 1);
+		ys[k] = lua_tonumber(L, -1);
+		lua_pop(L, 2);
+	}
+
+	if(count > 0) {
+		t->sample(count, &xs[0], &ys[0], &zs[0]);
+	}
+
+	lua_newtable(L);
+	for(unsigned k = 0; k < count; k++) {
+		lua_pushnumber(L, zs[k]);
+		lua_rawseti(L, -2, k + 1);
+	}
+
+	return 1;
+}
+
+/* retrieves the extreme elevations over a rectangle */
+int LuaGridTerrain::elevationRange(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double x0 = luaL_checknumber(L, 2);
+	double y0 = luaL_checknumber(L, 3);
+	double x1 = luaL_checknumber(L, 4);
+	double y1 = luaL_checknumber(L, 5);
+
+	double lo, hi;
+	if(!t->elevationRange(x0, y0, x1, y1, lo, hi)) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushnumber(L, lo);
+	lua_pushnumber(L, hi);
+
+	return 2;
+}
+
+/* finds the first point of the terrain hit by a ray */
+int LuaGridTerrain::intersect(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	Point *start = LuaPoint::checkInstance(L, 2);
+	Vector *dir = LuaVector::checkInstance(L, 3);
+
+	Point hit;
+	if(!t->intersect(*start, *dir, hit)) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	Point *p = new Point(hit);
+	lua_boxpointer(L, p);
+	luaL_getmetatable(L, "Point");
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+/* sets the screen-space error allowed when drawing the terrain */
+int LuaGridTerrain::setLODError(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double pixels = luaL_checknumber(L, 2);
+
+	t->setLODError(pixels);
+
+	return 0;
+}
+
 /* applies a texture to the terrain patch */
 int LuaGridTerrain::setTexture(lua_State* L)
 {
@@ -212,6 +495,28 @@ int LuaGridTerrain::setTexture(lua_State* L)
 	return 0;
 }
 
+/* sets the size of the texture the patches are baked into */
+int LuaGridTerrain::setSplatSize(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	double texels = luaL_checknumber(L, 2);
+
+	t->setSplatSize(static_cast<unsigned>(texels));
+
+	return 0;
+}
+
+/* writes the terrain to a file in the native format */
+int LuaGridTerrain::save(lua_State* L)
+{
+	GridTerrain *t = checkInstance(L, 1);
+	const char* fname = luaL_checklstring(L, 2, 0);
+
+	lua_pushboolean(L, t->save(fname));
+
+	return 1;
+}
+
 /* adds this drawable to the World */
 int LuaGridTerrain::addToWorld(lua_State* L)
 {
@@ -87,6 +87,34 @@ private:
 	 */
 	static int faultLineGeneration(lua_State* L);
 
+	/*!
+	 * \brief Adds a random terrain made by the diamond-square algorithm.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int diamondSquareGeneration(lua_State* L);
+
+	/*!
+	 * \brief Adds fractal noise to the terrain.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int noiseGeneration(lua_State* L);
+
+	/*!
+	 * \brief Sets the number of threads generating terrains.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setGeneratorThreads(lua_State* L);
+
+	/*!
+	 * \brief Sets whether the generated and filtered terrains are cached.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setCacheResults(lua_State* L);
+
 	/*!
 	 * \brief Smooths the terrain.
 	 * \param L The Lua state.
@@ -94,6 +122,41 @@ private:
 	 */
 	static int smooth(lua_State* L);
 
+	/*!
+	 * \brief Averages the terrain over a box around each sample.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int boxFilter(lua_State* L);
+
+	/*!
+	 * \brief Convolves the terrain with a Gaussian.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int gaussianFilter(lua_State* L);
+
+	/*!
+	 * \brief Smooths the terrain but keeps its cliffs and ridges.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int bilateralFilter(lua_State* L);
+
+	/*!
+	 * \brief Stamps a shape on the terrain.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int stamp(lua_State* L);
+
+	/*!
+	 * \brief Sweeps a stamp along a spline through some points.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int sweep(lua_State* L);
+
 	/*!
 	 * \brief Retrieves the height of a point on the terrain.
 	 * \param L The Lua state.
@@ -108,6 +171,34 @@ private:
 	 */
 	static int setPoint(lua_State* L);
 
+	/*!
+	 * \brief Retrieves the elevations at many points of the terrain.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int sample(lua_State* L);
+
+	/*!
+	 * \brief Retrieves the extreme elevations over a rectangle.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int elevationRange(lua_State* L);
+
+	/*!
+	 * \brief Finds the first point of the terrain hit by a ray.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int intersect(lua_State* L);
+
+	/*!
+	 * \brief Sets the screen-space error allowed when drawing the terrain.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setLODError(lua_State* L);
+
 	/*!
 	 * \brief Applies a texture to the terrain patch.
 	 * \param L The Lua state.
@@ -115,6 +206,20 @@ private:
 	 */
 	static int setTexture(lua_State* L);
 
+	/*!
+	 * \brief Sets the size of the texture the patches are baked into.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setSplatSize(lua_State* L);
+
+	/*!
+	 * \brief Writes the terrain to a file in the native format.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int save(lua_State* L);
+
 	/*!
 	 * \brief Adds this drawable to the World.
 	 * \param L The Lua state.
@@ -40,6 +40,7 @@ extern "C" {
 #include <luastamwatervolume.hpp>
 #include <luafosterwatervolume.hpp>
 #include <luawaterheightfield.hpp>
+#include <luashallowwaterheightfield.hpp>
 #include <luaisosurfacerenderer.hpp>
 #include <luanoisevolumerenderer.hpp>
 
@@ -114,6 +115,7 @@ LuaScript::LuaScript()
 	LuaStamWaterVolume::registerIntoLua(_lua_state);
 	LuaFosterWaterVolume::registerIntoLua(_lua_state);
 	LuaWaterHeightField::registerIntoLua(_lua_state);
+	LuaShallowWaterHeightField::registerIntoLua(_lua_state);
 	LuaIsoSurfaceRenderer::registerIntoLua(_lua_state);
 	LuaNoiseVolumeRenderer::registerIntoLua(_lua_state);
 
@@ -0,0 +1,147 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2003 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifndef __ORBIS__LUASHALLOWWATERHEIGHTFIELD_HPP__
+#define __ORBIS__LUASHALLOWWATERHEIGHTFIELD_HPP__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+#include <shallowwaterheightfield.hpp>
+
+using Orbis::Drawable::ShallowWaterHeightField;
+
+namespace Orbis {
+
+namespace Script {
+
+/*!
+ * \brief Exports the ShallowWaterHeightField class to the Lua interpreter.
+ */
+class LuaShallowWaterHeightField {
+public:
+	/*!
+	 * \brief Register this class to the Lua interpreter.
+	 * \param L The Lua state.
+	 */
+	static void registerIntoLua(lua_State* L);
+
+	/*!
+	 * \brief checks if element at given index is a ShallowWaterHeightField.
+	 * \param L The Lua state.
+	 * \param index Stack index of element to be checked.
+	 * \return A pointer to the object or 0 if element is not of this type
+	 */
+	static ShallowWaterHeightField* checkInstance(lua_State* L, int index);
+
+private:
+	/*!
+	 * \brief Creates a new instance of a ShallowWaterHeightField.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int create(lua_State* L);
+
+	/*!
+	 * \brief Collects the memory of a ShallowWaterHeightField.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int collect(lua_State* L);
+
+	/*!
+	 * \brief Adds a new source of water.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int addSource(lua_State* L);
+
+	/*!
+	 * \brief Adds a new sink of water.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int addSink(lua_State* L);
+
+	/*!
+	 * \brief Sets the bottom of the water.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setBottom(lua_State* L);
+
+	/*!
+	 * \brief Sets the texture of the water.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setTexture(lua_State* L);
+
+	/*!
+	 * \brief Sets the amount of change below which the simulation sleeps.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setSleepThreshold(lua_State* L);
+
+	/*!
+	 * \brief Tells if the simulation is sleeping.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int sleeping(lua_State* L);
+
+	/*!
+	 * \brief Makes two fields neighbours, woken up by each other's changes.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int addNeighbour(lua_State* L);
+
+	/*!
+	 * \brief Sets the number of threads solving the water.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setSolverThreads(lua_State* L);
+
+	/*!
+	 * \brief Adds this drawable to the World.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int addToWorld(lua_State* L);
+
+	// metadata
+	static const char className[];
+	static const luaL_reg methods[];
+};
+
+} } // namespace declarations
+
+#endif // __ORBIS__LUASHALLOWWATERHEIGHTFIELD_HPP__
+
@@ -48,9 +48,14 @@ const luaL_reg LuaStamWaterVolume::methods[] = {
 	method(LuaStamWaterVolume, addSink),
 	method(LuaStamWaterVolume, diffuse),
 	method(LuaStamWaterVolume, setDiffuse),
+	method(LuaStamWaterVolume, advection),
+	method(LuaStamWaterVolume, setAdvection),
 	method(LuaStamWaterVolume, viscosity),
 	method(LuaStamWaterVolume, setViscosity),
 	method(LuaStamWaterVolume, setBottom),
+	method(LuaStamWaterVolume, setSleepThreshold),
+	method(LuaStamWaterVolume, sleeping),
+	method(LuaStamWaterVolume, addNeighbour),
 	method(LuaStamWaterVolume, addToWorld),
 	{0, 0}
 };
@@ -227,6 +232,35 @@ int LuaStamWaterVolume::setDiffuse(lua_State* L)
 	return 0;
 }
 
+int LuaStamWaterVolume::advection(lua_State* L)
+{
+	StamWaterVolume *wv = checkInstance(L, 1);
+
+	if(wv->advection() == StamWaterVolume::MacCormack) {
+		lua_pushstring(L, "maccormack");
+	} else {
+		lua_pushstring(L, "semilagrangian");
+	}
+
+	return 1;
+}
+
+int LuaStamWaterVolume::setAdvection(lua_State* L)
+{
+	StamWaterVolume *wv = checkInstance(L, 1);
+	std::string adv = luaL_checklstring(L, 2, 0);
+
+	if(adv == "maccormack") {
+		wv->setAdvection(StamWaterVolume::MacCormack);
+	} else if(adv == "semilagrangian") {
+		wv->setAdvection(StamWaterVolume::SemiLagrangian);
+	} else {
+		luaL_argerror(L, 2, "unknown advection scheme");
+	}
+
+	return 0;
+}
+
 int LuaStamWaterVolume::viscosity(lua_State* L)
 {
 	StamWaterVolume *wv = checkInstance(L, 1);
@@ -256,6 +290,35 @@ int LuaStamWaterVolume::setBottom(lua_State* L)
 	return 0;
 }
 
+int LuaStamWaterVolume::setSleepThreshold(lua_State* L)
+{
+	StamWaterVolume *wv = checkInstance(L, 1);
+	double thr = luaL_checknumber(L, 2);
+
+	wv->setSleepThreshold(thr);
+
+	return 0;
+}
+
+int LuaStamWaterVolume::sleeping(lua_State* L)
+{
+	StamWaterVolume *wv = checkInstance(L, 1);
+
+	lua_pushboolean(L, wv->sleeping());
+
+	return 1;
+}
+
+int LuaStamWaterVolume::addNeighbour(lua_State* L)
+{
+	StamWaterVolume *wv = checkInstance(L, 1);
+	StamWaterVolume *other = checkInstance(L, 2);
+
+	wv->addNeighbour(other);
+
+	return 0;
+}
+
 int LuaStamWaterVolume::addToWorld(lua_State* L)
 {
 	StamWaterVolume *wv = checkInstance(L, 1);
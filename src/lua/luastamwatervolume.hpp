@@ -127,6 +127,20 @@ private:
 	 */
 	static int setDiffuse(lua_State* L);
 
+	/*!
+	 * \brief Queries the advection scheme.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int advection(lua_State* L);
+
+	/*!
+	 * \brief Sets the advection scheme, "semilagrangian" or "maccormack".
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setAdvection(lua_State* L);
+
 	/*!
 	 * \brief Queries the viscosity of the fluid.
 	 * \param L The Lua state.
@@ -148,6 +162,27 @@ private:
 	 */
 	static int setBottom(lua_State* L);
 
+	/*!
+	 * \brief Sets the amount of change below which the simulation sleeps.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setSleepThreshold(lua_State* L);
+
+	/*!
+	 * \brief Tells if the simulation is sleeping.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int sleeping(lua_State* L);
+
+	/*!
+	 * \brief Makes two volumes neighbours, woken up by each other's changes.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int addNeighbour(lua_State* L);
+
 	/*!
 	 * \brief Adds this object to the world.
 	 * \param L The Lua state.
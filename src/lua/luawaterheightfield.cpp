@@ -46,6 +46,10 @@ const luaL_reg LuaWaterHeightField::methods[] = {
 	method(LuaWaterHeightField, addSink),
 	method(LuaWaterHeightField, setBottom),
 	method(LuaWaterHeightField, setTexture),
+	method(LuaWaterHeightField, setSleepThreshold),
+	method(LuaWaterHeightField, sleeping),
+	method(LuaWaterHeightField, addNeighbour),
+	method(LuaWaterHeightField, setSolverThreads),
 	method(LuaWaterHeightField, addToWorld),
 	{0, 0}
 };
@@ -176,6 +180,49 @@ int LuaWaterHeightField::setTexture(lua_State* L)
 	return 0;
 }
 
+/* Sets the amount of change below which the simulation sleeps. */
+int LuaWaterHeightField::setSleepThreshold(lua_State* L)
+{
+	WaterHeightField *water = checkInstance(L, 1);
+	double thr = luaL_checknumber(L, 2);
+
+	water->setSleepThreshold(thr);
+
+	return 0;
+}
+
+/* Tells if the simulation is sleeping. */
+int LuaWaterHeightField::sleeping(lua_State* L)
+{
+	WaterHeightField *water = checkInstance(L, 1);
+
+	lua_pushboolean(L, water->sleeping());
+
+	return 1;
+}
+
+/* Makes two fields neighbours, woken up by each other's changes. */
+int LuaWaterHeightField::addNeighbour(lua_State* L)
+{
+	WaterHeightField *water = checkInstance(L, 1);
+	WaterHeightField *other = checkInstance(L, 2);
+
+	water->addNeighbour(other);
+
+	return 0;
+}
+
+/* Sets the number of threads solving the water. */
+int LuaWaterHeightField::setSolverThreads(lua_State* L)
+{
+	WaterHeightField *water = checkInstance(L, 1);
+	double n = luaL_checknumber(L, 2);
+
+	water->setSolverThreads(static_cast<unsigned>(n));
+
+	return 0;
+}
+
 /* Adds this drawable to the World. */
 int LuaWaterHeightField::addToWorld(lua_State* L)
 {
@@ -103,6 +103,34 @@ private:
 	 */
 	static int setTexture(lua_State* L);
 
+	/*!
+	 * \brief Sets the amount of change below which the simulation sleeps.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setSleepThreshold(lua_State* L);
+
+	/*!
+	 * \brief Tells if the simulation is sleeping.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int sleeping(lua_State* L);
+
+	/*!
+	 * \brief Makes two fields neighbours, woken up by each other's changes.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int addNeighbour(lua_State* L);
+
+	/*!
+	 * \brief Sets the number of threads solving the water.
+	 * \param L The Lua state.
+	 * \return The number of results pushed onto the stack.
+	 */
+	static int setSolverThreads(lua_State* L);
+
 	/*!
 	 * \brief Adds this drawable to the World.
 	 * \param L The Lua state.
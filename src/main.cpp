@@ -25,6 +25,7 @@
 
 #include <gtkmm.h>
 
+#include <imagecache.hpp>
 #include <mainwindow.hpp>
 
 int main(int argc, char* argv[])
@@ -36,6 +37,9 @@ int main(int argc, char* argv[])
 
 	Gtk::Main::run(window);
 
+	// the images are read by a thread of their own
+	Orbis::Util::ImageCache::shutdown();
+
 	return 0;
 }
 
@@ -50,6 +50,13 @@ bool Patch::contains(const Point& p) const
 	return pointInPolygon(p, _poly_line);
 }
 
+/* finds the samples of a regular grid in the patch */
+void Patch::rasterize(double x0, double y0, double dx, double dy,
+			unsigned nx, unsigned ny, std::vector<Span>& spans) const
+{
+	rasterizePolygon(_poly_line, x0, y0, dx, dy, nx, ny, spans);
+}
+
 const std::string Patch::attribute(const std::string& key) const
 {
 	std::string res;
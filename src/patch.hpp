@@ -87,6 +87,14 @@ public:
 	 */
 	bool contains(const Point& p) const;
 
+	/*!
+	 * \brief Finds the samples of a regular grid in the patch.
+	 * \sa rasterizePolygon
+	 */
+	void rasterize(double x0, double y0, double dx, double dy,
+				unsigned nx, unsigned ny,
+					std::vector<Span>& spans) const;
+
 	//! Gets an attribute from the list
 	const std::string attribute(const std::string& key) const;
 
@@ -55,8 +55,8 @@ Point Spline::pointOnSpline(double x)
 		_b.push_back(_ctrl_points[0]);
 		_b.push_back(_ctrl_points[1]);
 		t_aux = x / static_cast<double>(_sub_divs);
-		p = Point(_b[1].x()*(1-t_aux) + _b[0].x()*t_aux, 
-				_b[1].y()*(1-t_aux) + _b[0].y()*t_aux);
+		p = Point(_b[0].x()*(1-t_aux) + _b[1].x()*t_aux,
+				_b[0].y()*(1-t_aux) + _b[1].y()*t_aux);
 		break;
 
 	case 3:
@@ -80,7 +80,7 @@ Point Spline::pointOnSpline(double x)
 
 	default:
 		_b.clear();
-		_b.reserve(3 * size - 8);
+		_b.resize(3 * size - 8);
 		double *delta = new double[size-1];
 
 		for(i = 0; i < size-1; i++) {
@@ -189,7 +189,7 @@ Vector Spline::derivativeOnSpline(double x)
 	case 1:
 		return Vector();
 	case 2:
-		aux = _ctrl_points[0] - _ctrl_points[1];
+		aux = _ctrl_points[1] - _ctrl_points[0];
 		break;
 
 	case 3:
@@ -217,7 +217,7 @@ Vector Spline::derivativeOnSpline(double x)
 
 	default:
 		_b.clear();
-		_b.reserve(3*size-8);
+		_b.resize(3*size-8);
 		double *delta = new double[size-1];
 
 		for(i = 0; i < size-1; i++) {
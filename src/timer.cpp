@@ -71,6 +71,7 @@ void Timer::addDynamic(Orbis::Dynamic* obj)
 {
 	_mutex.lock();
 	_dynamic_objects.push_back(obj);
+	obj->wake();
 	_mutex.unlock();
 }
 
@@ -98,7 +99,12 @@ void Timer::run()
 		std::vector<Orbis::Dynamic*>::iterator it;
 		for(it = _dynamic_objects.begin();
 					it != _dynamic_objects.end(); it++) {
+			// sleeping objects cost nothing until woken up
+			if((*it)->sleeping()) {
+				continue;
+			}
 			(*it)->evolve(_time_out);
+			(*it)->settle();
 		}
 		_mutex.unlock();
 	}
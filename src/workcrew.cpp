@@ -0,0 +1,108 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifdef __GNUG__
+#pragma implementation
+#endif
+
+#include <workcrew.hpp>
+
+namespace Orbis {
+
+	namespace Util {
+
+/*!
+ * \brief A thread of the crew. It waits for a job to start, does its
+ * share and waits for the others to finish theirs.
+ */
+class WorkCrew::Worker : public OpenThreads::Thread {
+public:
+	Worker(WorkCrew *crew, unsigned index)
+		: _crew(crew), _index(index)
+	{
+	}
+
+	virtual void run()
+	{
+		for(;;) {
+			_crew->_start->block();
+			if(_crew->_quit) {
+				break;
+			}
+			_crew->_job->work(_index, _crew->size());
+			_crew->_finish->block();
+		}
+	}
+
+private:
+	WorkCrew *_crew;
+	unsigned _index;
+};
+
+void WorkCrew::resize(unsigned n)
+{
+	stop();
+	if(n < 2) {
+		return;
+	}
+	_quit = false;
+	_start = new OpenThreads::Barrier(n);
+	_finish = new OpenThreads::Barrier(n);
+	for(unsigned k = 1; k < n; k++) {
+		Worker *worker = new Worker(this, k);
+		_workers.push_back(worker);
+		worker->start();
+	}
+}
+
+void WorkCrew::run(Job& job)
+{
+	if(_workers.empty()) {
+		job.work(0, 1);
+		return;
+	}
+	_job = &job;
+	_start->block();
+	job.work(0, size());
+	_finish->block();
+	_job = 0;
+}
+
+void WorkCrew::stop()
+{
+	if(_workers.empty()) {
+		return;
+	}
+	// the workers are waiting for a job that will never come
+	_quit = true;
+	_start->block();
+	std::vector<Worker*>::iterator it;
+	for(it = _workers.begin(); it != _workers.end(); it++) {
+		(*it)->join();
+		delete *it;
+	}
+	_workers.clear();
+	delete _start;
+	delete _finish;
+	_start = _finish = 0;
+}
+
+} } // namespace declarations
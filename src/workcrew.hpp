@@ -0,0 +1,123 @@
+/*
+ * The Orbis world simulator
+ * Copyright (C) 2001-2004 Alex Sandro Queiroz e Silva
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * The author may be contacted by eletronic e-mail at <asandro@lcg.dc.ufc.br>
+ */
+
+#ifndef __ORBIS_WORKCREW_HPP__
+#define __ORBIS_WORKCREW_HPP__
+
+#ifdef __GNUG__
+#pragma interface
+#endif
+
+#include <vector>
+
+#include <OpenThreads/Barrier>
+#include <OpenThreads/Thread>
+
+namespace Orbis {
+
+	namespace Util {
+
+/*!
+ * \brief A few threads that share the work of a simulation step.
+ *
+ * The thread calling run() does its share too, the others wait between
+ * jobs. A crew of one has no threads of its own.
+ */
+class WorkCrew {
+public:
+	/*!
+	 * \brief A piece of work that can be split among threads.
+	 */
+	struct Job {
+		virtual ~Job() {}
+
+		/*!
+		 * \brief Does a share of the work.
+		 * \param index Which share, from 0 to count - 1.
+		 * \param count How many shares the work was split into.
+		 */
+		virtual void work(unsigned index, unsigned count) = 0;
+	};
+
+	//! Constructor, creates a crew of one.
+	WorkCrew();
+
+	//! Destructor, stops the threads.
+	~WorkCrew();
+
+	/*!
+	 * \brief Number of threads in the crew.
+	 * \return The number of threads, the calling one included.
+	 */
+	unsigned size() const;
+
+	/*!
+	 * \brief Sets the number of threads in the crew.
+	 * \param n The new number of threads, the calling one included.
+	 */
+	void resize(unsigned n);
+
+	/*!
+	 * \brief Splits a job among the crew and waits for it to be done.
+	 * \param job The job.
+	 */
+	void run(Job& job);
+
+private:
+	// a thread of the crew
+	class Worker;
+	friend class Worker;
+
+	// the threads, besides the calling one
+	std::vector<Worker*> _workers;
+	// synchronise the workers with the calling thread
+	OpenThreads::Barrier *_start, *_finish;
+	// the job being done
+	Job *_job;
+	// tells the workers to quit
+	volatile bool _quit;
+
+	// stops and frees the workers
+	void stop();
+
+	// the crew can't be copied
+	WorkCrew(const WorkCrew&);
+	WorkCrew& operator=(const WorkCrew&);
+};
+
+inline WorkCrew::WorkCrew()
+	: _start(0), _finish(0), _job(0), _quit(false)
+{
+}
+
+inline WorkCrew::~WorkCrew()
+{
+	stop();
+}
+
+inline unsigned WorkCrew::size() const
+{
+	return _workers.size() + 1;
+}
+
+} } // namespace declarations
+
+#endif  // __ORBIS_WORKCREW_HPP__
@@ -26,10 +26,85 @@
 #endif
 
 #include <osg/Geode>
+#include <osg/NodeVisitor>
 #include <osgGA/TrackballManipulator>
 
+#include <dynamic.hpp>
 #include <world.hpp>
 #include <worldview3d.hpp>
+#include <gridheightfield.hpp>
+
+using Orbis::Drawable::GridHeightField;
+using Orbis::Dynamic;
+using Orbis::Locker;
+
+/*!
+ * \brief A class to visit every node looking for the nearest height
+ * field hit by a ray.
+ */
+class PickNodeVisitor : public osg::NodeVisitor {
+public:
+	//! Constructor
+	PickNodeVisitor(const Point& start, const Vector& dir);
+
+	//! Apply this visitor to a geode
+	void apply(osg::Geode& geode);
+
+	//! The nearest height field hit, zero if none
+	GridHeightField* picked() const;
+
+protected:
+	//! Destructor
+	~PickNodeVisitor();
+
+private:
+	// the ray
+	Point _start;
+	Vector _dir;
+	// nearest hit so far
+	GridHeightField *_picked;
+	double _distance;
+};
+
+PickNodeVisitor::PickNodeVisitor(const Point& start, const Vector& dir)
+	: osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+		_start(start), _dir(dir), _picked(0),
+		_distance(std::numeric_limits<double>::max())
+{
+}
+
+PickNodeVisitor::~PickNodeVisitor()
+{
+}
+
+void PickNodeVisitor::apply(osg::Geode& geode)
+{
+	for(unsigned i = 0; i < geode.getNumDrawables(); i++) {
+		GridHeightField *hf =
+				dynamic_cast<GridHeightField*>(geode.getDrawable(i));
+		if(!hf) {
+			continue;
+		}
+		// water is changed by the timer's thread meanwhile
+		Point hit;
+		{
+			Locker lock(dynamic_cast<const Dynamic*>(hf));
+			if(!hf->intersect(_start, _dir, hit)) {
+				continue;
+			}
+		}
+		double distance = (hit - _start).length();
+		if(distance < _distance) {
+			_distance = distance;
+			_picked = hf;
+		}
+	}
+}
+
+inline GridHeightField* PickNodeVisitor::picked() const
+{
+	return _picked;
+}
 
 namespace Orbis {
 
@@ -175,9 +250,41 @@ bool WorldView3D::handle(osgGA::GUIEventAdapter& ea,
 					static_cast<int>(height));
 	}
 
+	// shift-clicking selects a height field
+	if(ea.getEventType() == osgGA::GUIEventAdapter::PUSH &&
+		(ea.getModKeyMask() & osgGA::GUIEventAdapter::MODKEY_SHIFT)) {
+		pick(ea.getXnormalized(), ea.getYnormalized());
+		aa.requestRedraw();
+		return true;
+	}
+
 	return _matrix_manipulator->handle(ea, aa);
 }
 
+Drawable::Drawable* WorldView3D::pick(float x, float y)
+{
+	using Orbis::Util::Point;
+	using Orbis::Util::Vector;
+
+	// the ray from the near to the far plane through the point
+	osg::Matrix inverse;
+	inverse.invert(_scene_view->getViewMatrix() *
+					_scene_view->getProjectionMatrix());
+	osg::Vec3 near_point = osg::Vec3(x, y, -1.0f) * inverse;
+	osg::Vec3 far_point = osg::Vec3(x, y, 1.0f) * inverse;
+	Point start(near_point.x(), near_point.y(), near_point.z());
+	Vector dir(far_point.x() - near_point.x(),
+				far_point.y() - near_point.y(),
+				far_point.z() - near_point.z());
+
+	osg::ref_ptr<PickNodeVisitor> visitor = new PickNodeVisitor(start, dir);
+	world()->root()->accept(*visitor);
+
+	_selected->setSelected(visitor->picked());
+
+	return visitor->picked();
+}
+
 void WorldView3D::setCamera(const Orbis::Util::Camera& cam)
 {
 	using osg::Vec3;
@@ -150,6 +150,17 @@ public:
 	 */
 	void setCamera(const Orbis::Util::Camera& cam);
 
+	/*!
+	 * \brief Selects the height field seen at a point of the view.
+	 *
+	 * Height fields under a transformation are tested as if they
+	 * were not.
+	 * \param x The horizontal coordinate, from -1 to 1.
+	 * \param y The vertical coordinate, from -1 to 1.
+	 * \return The height field selected, zero if none was hit.
+	 */
+	Drawable::Drawable* pick(float x, float y);
+
 private:
 	//! OSG's Scene Handler
 	ref_ptr<SceneView> _scene_view;
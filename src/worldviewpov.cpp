@@ -25,7 +25,9 @@
 #pragma implementation
 #endif
 
+#include <vector>
 #include <fstream>
+#include <algorithm>
 
 #include <osg/Group>
 #include <osg/Geode>
@@ -157,13 +159,20 @@ void POVWriteNodeVisitor::write(const GridHeightField* hf) const
 	unsigned num_x = hf->numSamplesX();
 	unsigned num_y = hf->numSamplesY();
 
+	// the vertices are sampled a row at a time
+	std::vector<double> xs(num_x), ys(num_x), zs(num_x);
+	for(unsigned i = 0; i < num_x; i++) {
+		xs[i] = hf->origin().x() + i * hf->stepX();
+	}
+
 	_out << "mesh2 {\n";
 	_out << "vertex_vectors {\n";
 	_out << num_x * num_y << ",\n";
 	for(unsigned j = 0; j < num_y; j++) {
+		std::fill(ys.begin(), ys.end(), hf->origin().y() + j * hf->stepY());
+		hf->sample(num_x, &xs[0], &ys[0], &zs[0]);
 		for(unsigned i = 0; i < num_x; i++) {
-			Point p = hf->point(i, j);
-			_out << "<" << p.x() << "," << p.y() << "," << p.z() << ">";
+			_out << "<" << xs[i] << "," << ys[i] << "," << zs[i] << ">";
 			if((i != num_x - 1) && (j != num_y - 1)) {
 				_out << ", ";
 			}